@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_BG_WORK_H_
+#define KB_BG_WORK_H_
+
+/**@file
+ * @defgroup kb_bg_work Background work queue API
+ * @{
+ * @brief Low priority work queue for slow work off the key path.
+ *
+ * Settings writes wait for flash erases and the pairing UI waits for the
+ * user. Run from the Bluetooth RX thread or the system workqueue they
+ * hold up key events and split link traffic. Work submitted here runs
+ * at CONFIG_KB_BG_WORK_PRIORITY, below every thread of the key path:
+ *
+ * - Matrix thread, cooperative: scans the key matrix.
+ * - Bluetooth host threads and the system workqueue, cooperative: split
+ *   link and HID traffic.
+ * - HID thread, highest preemptible (central half): turns key events
+ *   into HID reports.
+ * - Background work queue, low preemptible: settings and pairing.
+ * - Log thread, lowest: formats deferred log messages.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/kernel.h>
+
+/** @brief Submit a work item to the background work queue.
+ *
+ * @param work Work item.
+ *
+ * @return As k_work_submit_to_queue().
+ */
+int bg_work_submit(struct k_work *work);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_BG_WORK_H_ */
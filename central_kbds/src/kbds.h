@@ -18,6 +18,10 @@ extern "C" {
 #endif
 
 #include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#include "keyset.h"
 
 /** @brief KBDS Service UUID. */
 #define BT_UUID_KBDS_VAL \
@@ -27,12 +31,96 @@ extern "C" {
 #define BT_UUID_KBDS_BUTTON_VAL \
 	BT_UUID_128_ENCODE(0x00001524, 0x1212, 0xedfe, 0x2523, 0x7855eabcd123)
 
+/** @brief Key Event Characteristic UUID. */
+#define BT_UUID_KBDS_EVENT_VAL \
+	BT_UUID_128_ENCODE(0x00001525, 0x1212, 0xedfe, 0x2523, 0x7855eabcd123)
 
 #define BT_UUID_KBDS           BT_UUID_DECLARE_128(BT_UUID_KBDS_VAL)
 #define BT_UUID_KBDS_BUTTON    BT_UUID_DECLARE_128(BT_UUID_KBDS_BUTTON_VAL)
+#define BT_UUID_KBDS_EVENT     BT_UUID_DECLARE_128(BT_UUID_KBDS_EVENT_VAL)
+
+/** @brief Size of the sequence number that starts every notification.
+ *
+ * Button notifications carry one sequence number per notification.
+ * Key Event notifications carry the sequence number of their first event,
+ * the following events are numbered on from it. A sequence number is used
+ * up even if its notification or event could not be sent, so the client
+ * sees a gap. If no event follows lost ones, a notification without
+ * events carries the number of the next event.
+ */
+#define BT_KBDS_SEQ_LEN          1
+/** @brief Size of the module ID.
+ *
+ * Starts the Button value and follows the sequence number of every
+ * notification, so a client with several servers knows which module a
+ * key belongs to. Set by CONFIG_BT_KBDS_MODULE_ID.
+ */
+#define BT_KBDS_MODULE_LEN       1
+/** @brief Module ID of a client that has not heard from its server yet. */
+#define BT_KBDS_MODULE_INVALID   0xFF
+/** @brief Size of the send time that follows the module ID of a Key
+ *  Event notification.
+ *
+ * Server uptime when the notification was built, in units of
+ * BT_KBDS_EVT_TIME_UNIT_US, the low 32 bits little endian. Together with
+ * the event ages it places every event on the server clock.
+ */
+#define BT_KBDS_EVT_SEND_TIME_LEN 4
+/** @brief Size of the Key Event notification header. */
+#define BT_KBDS_EVT_HDR_LEN      (BT_KBDS_SEQ_LEN + BT_KBDS_MODULE_LEN + \
+				  BT_KBDS_EVT_SEND_TIME_LEN)
+/** @brief Size of the key state, little endian, in the Button value.
+ *
+ * One bit per key of the server matrix. Clients take the width from the
+ * value length, keys beyond their own matrix are dropped.
+ */
+#define BT_KBDS_KEYSTATE_LEN     KEYSET_BYTES
 
-/** @brief Callback type for when the button state is pulled. */
-typedef uint32_t (*button_cb_t)(void);
+/** @brief Size of one key event in a Key Event notification.
+ *
+ * Byte 0 holds the key position in bits 0-6 and BT_KBDS_EVT_PRESSED.
+ * Bytes 1-2 hold the age of the event, little endian.
+ */
+#define BT_KBDS_EVT_LEN          3
+/** @brief Key event flag for a press, cleared for a release. */
+#define BT_KBDS_EVT_PRESSED      BIT(7)
+/** @brief Mask of the key position in a key event. */
+#define BT_KBDS_EVT_POS_MASK     0x7F
+/** @brief Unit of the key event age [us]. */
+#define BT_KBDS_EVT_TIME_UNIT_US 125
+
+/** @brief Key event. */
+struct bt_kbds_key_evt {
+	/** Key position. */
+	uint8_t position;
+	/** True for a press, false for a release. */
+	bool pressed;
+	/** Time from the event to the notification that carried it, in
+	 *  units of BT_KBDS_EVT_TIME_UNIT_US.
+	 */
+	uint16_t age;
+	/** Time of the event on the receiver clock, see bt_kbds_time_get().
+	 *  Only set by the KBDS Client.
+	 */
+	uint32_t time;
+};
+
+/** @brief Get the clock key events are timed with.
+ *
+ * @return Uptime in units of BT_KBDS_EVT_TIME_UNIT_US, wrapping at
+ *         32 bits. Compare two times by their signed difference.
+ */
+static inline uint32_t bt_kbds_time_get(void)
+{
+	return k_ticks_to_us_floor64(k_uptime_ticks()) /
+	       BT_KBDS_EVT_TIME_UNIT_US;
+}
+
+/** @brief Callback type for when the button state is pulled.
+ *
+ * @param[out] keystate Filled with the keys that are pressed.
+ */
+typedef void (*button_cb_t)(struct keyset *keystate);
 
 /** @brief Callback struct used by the KBDS Service. */
 struct bt_kbds_cb {
@@ -61,15 +149,30 @@ int bt_kbds_init(struct bt_kbds_cb *callbacks);
 
 /** @brief Send the button state.
  *
- * This function sends a binary state, typically the state of a
- * button, to all connected peers.
+ * This function sends the state of every key of the matrix to all
+ * connected peers, after the next sequence number.
  *
- * @param[in] keystate The state of the button.
+ * @param[in] keystate The keys that are pressed.
  *
  * @retval 0 If the operation was successful.
  *           Otherwise, a (negative) error code is returned.
  */
-int bt_kbds_send_keystate(uint32_t keystate);
+int bt_kbds_send_keystate(const struct keyset *keystate);
+
+/** @brief Send a key event.
+ *
+ * The event is queued and sent to all connected peers that subscribed to
+ * the Key Event Characteristic. Queued events are sent in order, batched
+ * into as few notifications as possible.
+ *
+ * @param[in] position The key position.
+ * @param[in] pressed  True if the key was pressed, false if released.
+ *
+ * @retval 0 If the operation was successful.
+ * @retval -EACCES If no peer subscribed to key events.
+ * @retval -ENOMEM If the event queue is full.
+ */
+int bt_kbds_send_key_event(uint8_t position, bool pressed);
 
 #ifdef __cplusplus
 }
@@ -7,13 +7,253 @@
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/bluetooth/gatt.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/settings/settings.h>
 
 //#include <bluetooth/services/kbds_client.h>
 #include "kbds.h"
 #include "kbds_client.h"
+#include "bg_work.h"
 
 #include <zephyr/logging/log.h>
-//LOG_MODULE_REGISTER(kbds_client, CONFIG_BT_KBDS_CLIENT_LOG_LEVEL);
+LOG_MODULE_REGISTER(kbds_client, CONFIG_BT_KBDS_CLIENT_LOG_LEVEL);
+
+/* Settings key prefix of the handle cache, followed by the server
+ * address in hex.
+ */
+#define KBDS_CACHE_KEY_PREFIX "kbds/hc/"
+#define KBDS_CACHE_KEY_LEN \
+	(sizeof(KBDS_CACHE_KEY_PREFIX) + 2 * sizeof(bt_addr_le_t))
+
+/* Handles of one server, as stored in settings. */
+struct kbds_handle_cache {
+	uint8_t db_hash[BT_KBDS_DB_HASH_LEN];
+	uint16_t val_handle;
+	uint16_t ccc_handle;
+	uint16_t evt_handle;
+	uint16_t evt_ccc_handle;
+	uint8_t properties;
+};
+
+/* Sequence numbers a notification may lag behind the expected one and
+ * still be taken as stale. A larger lag is taken as a loss that wrapped
+ * the 8-bit sequence number.
+ */
+#define KBDS_SEQ_STALE_MAX 16
+
+struct kbds_cache_load {
+	struct kbds_handle_cache *cache;
+	bool found;
+};
+
+/* Client objects of the connected modules, with the connection each one
+ * is allocated to.
+ */
+static struct bt_kbds_client pool[CONFIG_BT_KBDS_CLIENT_COUNT];
+static struct bt_conn *pool_conns[CONFIG_BT_KBDS_CLIENT_COUNT];
+
+BUILD_ASSERT(CONFIG_BT_KBDS_CLIENT_COUNT <= ATOMIC_BITS,
+	     "Too many clients for the pending cache masks");
+
+/* Cache lookups and deletes waiting for the background work queue, by
+ * pool index. Settings access can wait for flash, so it is kept out of
+ * the GATT callbacks.
+ */
+static atomic_t cache_load_pending;
+static atomic_t cache_stale_pending;
+/* Settings keys of the entries to delete. */
+static char cache_stale_keys[CONFIG_BT_KBDS_CLIENT_COUNT][KBDS_CACHE_KEY_LEN];
+
+/**
+ * @brief Parse a Button value
+ *
+ * @param kbds      KBDS Client object.
+ * @param keystates Filled with the key state.
+ * @param data      Button value, module ID first.
+ * @param length    The size of the value.
+ *
+ * @retval 0 If the operation was successful.
+ * @retval -EMSGSIZE If the value holds no key state.
+ */
+static int button_value_parse(struct bt_kbds_client *kbds,
+			      struct keyset *keystates,
+			      const uint8_t *data, uint16_t length)
+{
+	if (!data || length <= BT_KBDS_MODULE_LEN) {
+		return -EMSGSIZE;
+	}
+
+	kbds->module_id = data[0];
+	keyset_from_bytes(keystates, &data[BT_KBDS_MODULE_LEN],
+			  length - BT_KBDS_MODULE_LEN);
+
+	return 0;
+}
+
+/**
+ * @brief Check the sequence number of a notification
+ *
+ * @param kbds KBDS Client object.
+ * @param seq  Sequence of the notification stream.
+ * @param val  Sequence number of the notification.
+ * @param cnt  Sequence numbers used by the notification.
+ *
+ * @return Number of lost sequence numbers, or a negative value if the
+ *         notification is at most KBDS_SEQ_STALE_MAX older than the
+ *         expected one.
+ */
+static int seq_check(struct bt_kbds_client *kbds, struct bt_kbds_seq *seq,
+		     uint8_t val, uint8_t cnt)
+{
+	uint8_t gap = seq->valid ? (uint8_t)(val - seq->next) : 0;
+
+	if (gap > UINT8_MAX - KBDS_SEQ_STALE_MAX) {
+		LOG_WRN("Stale notification %u, expected %u.", val,
+		        seq->next);
+		kbds->stats.stale++;
+		return -1;
+	}
+	if (gap) {
+		LOG_WRN("Lost %d notification(s) before %u.", gap, val);
+		kbds->stats.lost += gap;
+	}
+
+	seq->next = val + cnt;
+	seq->valid = true;
+
+	return gap;
+}
+
+/**
+ * @brief Signed difference of two times
+ */
+static int32_t time_diff(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b);
+}
+
+/**
+ * @brief Update the server clock estimate
+ *
+ * @param clock Server clock estimate.
+ * @param send  Server time the notification was sent at.
+ * @param recv  Client time the notification was received at.
+ */
+static void clock_update(struct bt_kbds_clock *clock, uint32_t send,
+			 uint32_t recv)
+{
+	uint32_t window = CONFIG_BT_KBDS_CLOCK_WINDOW_MS * USEC_PER_MSEC /
+			  BT_KBDS_EVT_TIME_UNIT_US;
+	uint32_t sample = recv - send;
+
+	if (!clock->valid) {
+		clock->win_min = sample;
+		clock->prev_min = sample;
+		clock->win_start = recv;
+		clock->valid = true;
+	} else if (time_diff(recv, clock->win_start) >= window) {
+		clock->prev_min = clock->win_min;
+		clock->win_min = sample;
+		clock->win_start = recv;
+	} else if (time_diff(sample, clock->win_min) < 0) {
+		clock->win_min = sample;
+	}
+
+	clock->offset = time_diff(clock->win_min, clock->prev_min) < 0 ?
+			clock->win_min : clock->prev_min;
+}
+
+/**
+ * @brief Report the difference to a resynced key state as key events
+ *
+ * @param kbds      KBDS Client object.
+ * @param keystates Key state read from the server.
+ */
+static void resync_apply(struct bt_kbds_client *kbds,
+			 const struct keyset *keystates)
+{
+	struct keyset has_changed = *keystates;
+	uint32_t now = bt_kbds_time_get();
+
+	if (kbds->keystates_valid) {
+		keyset_xor(&has_changed, keystates, &kbds->keystates);
+	}
+	kbds->keystates = *keystates;
+	kbds->keystates_valid = true;
+
+	if (!kbds->evt_cb) {
+		return;
+	}
+
+	KEYSET_FOREACH(&has_changed, i) {
+		struct bt_kbds_key_evt evt = {
+			.position = i,
+			.pressed = keyset_test(keystates, i),
+			.time = now,
+		};
+
+		kbds->evt_cb(kbds, &evt);
+	}
+}
+
+/**
+ * @brief Process resync read
+ *
+ * @param conn   Connection handler.
+ * @param err    Read ATT error code.
+ * @param params Read parameters structure.
+ * @param data   Pointer to the data buffer.
+ * @param length The size of the received data.
+ *
+ * @retval BT_GATT_ITER_STOP     Stop reading
+ */
+static uint8_t resync_process(struct bt_conn *conn, uint8_t err,
+			      struct bt_gatt_read_params *params,
+			      const void *data, uint16_t length)
+{
+	struct bt_kbds_client *kbds;
+	struct keyset keystates;
+
+	kbds = CONTAINER_OF(params, struct bt_kbds_client, resync_params);
+	kbds->resync_pending = false;
+
+	if (err) {
+		LOG_ERR("Resync read error: %d", err);
+	} else if (button_value_parse(kbds, &keystates, data, length)) {
+		LOG_ERR("Unexpected resync value size.");
+	} else {
+		kbds->stats.resyncs++;
+		resync_apply(kbds, &keystates);
+	}
+
+	return BT_GATT_ITER_STOP;
+}
+
+/**
+ * @brief Read the full key state after a lost key event
+ *
+ * @param kbds KBDS Client object.
+ */
+static void kbds_resync(struct bt_kbds_client *kbds)
+{
+	int err;
+
+	if (kbds->resync_pending || !kbds->conn) {
+		return;
+	}
+
+	kbds->resync_params.func = resync_process;
+	kbds->resync_params.handle_count  = 1;
+	kbds->resync_params.single.handle = kbds->val_handle;
+	kbds->resync_params.single.offset = 0;
+
+	err = bt_gatt_read(kbds->conn, &kbds->resync_params);
+	if (err) {
+		LOG_ERR("Resync read failed: %d", err);
+		return;
+	}
+	kbds->resync_pending = true;
+}
 
 /**
  * @brief Process battery level value notification
@@ -34,47 +274,115 @@ static uint8_t notify_process(struct bt_conn *conn,
 			   const void *data, uint16_t length)
 {
 	struct bt_kbds_client *kbds;
-	uint32_t keystates;
-	const uint32_t *bdata = data;
+	const uint8_t *bdata = data;
 
 	kbds = CONTAINER_OF(params, struct bt_kbds_client, notify_params);
-    /*
+
 	if (!data || !length) {
-		printk("Notifications disabled.\n");
+		LOG_INF("Notifications disabled.");
 		if (kbds->notify_cb) {
-			kbds->notify_cb(kbds, BT_KBDS_VAL_INVALID);
+			kbds->notify_cb(kbds, NULL);
 		}
 		return BT_GATT_ITER_STOP;
 	}
-	if (length != 1) {
-		printk("Unexpected notification value size.\n");
-		if (kbds->notify_cb) {
-			kbds->notify_cb(kbds, BT_KBDS_VAL_INVALID);
-		}
-		return BT_GATT_ITER_STOP;
+	if (length <= BT_KBDS_SEQ_LEN + BT_KBDS_MODULE_LEN) {
+		LOG_ERR("Unexpected notification value size.");
+		return BT_GATT_ITER_CONTINUE;
 	}
-    printk("length %d\n",length);//4
-    printk("bdata[0]: %x\n",bdata[0]);//LSB
-    printk("bdata[1]: %x\n",bdata[1]);
-    printk("bdata[2]: %x\n",bdata[2]);
-    printk("bdata[3]: %x\n",bdata[3]);//MSB
-    printk("\n");
-    */
 
-	keystates = bdata[0];
-    /*
+	/* Every notification holds the full state, a gap needs no resync. */
+	if (seq_check(kbds, &kbds->notify_seq, bdata[0], 1) < 0) {
+		return BT_GATT_ITER_CONTINUE;
+	}
 
-	if (keystates > BT_KBDS_VAL_MAX) {
-		printk("Unexpected notification value.\n");
-		if (kbds->notify_cb) {
-			kbds->notify_cb(kbds, BT_KBDS_VAL_INVALID);
-		}
+	button_value_parse(kbds, &kbds->keystates, &bdata[BT_KBDS_SEQ_LEN],
+			   length - BT_KBDS_SEQ_LEN);
+	kbds->keystates_valid = true;
+	if (kbds->notify_cb) {
+		kbds->notify_cb(kbds, &kbds->keystates);
+	}
+
+	return BT_GATT_ITER_CONTINUE;
+}
+
+/**
+ * @brief Process key event notification
+ *
+ * Internal function to split a key event notification into events and
+ * pass them further, oldest first.
+ *
+ * @param conn   Connection handler.
+ * @param params Notification parameters structure - the pointer
+ *               to the structure provided to subscribe function.
+ * @param data   Pointer to the data buffer.
+ * @param length The size of the received data.
+ *
+ * @retval BT_GATT_ITER_STOP     Stop notification
+ * @retval BT_GATT_ITER_CONTINUE Continue notification
+ */
+static uint8_t evt_notify_process(struct bt_conn *conn,
+				  struct bt_gatt_subscribe_params *params,
+				  const void *data, uint16_t length)
+{
+	struct bt_kbds_client *kbds;
+	const uint8_t *bdata = data;
+	uint32_t send;
+	int gap;
+
+	kbds = CONTAINER_OF(params, struct bt_kbds_client, evt_notify_params);
+
+	if (!data) {
+		LOG_INF("Key event notifications disabled.");
+		kbds->evt_cb = NULL;
 		return BT_GATT_ITER_STOP;
 	}
-    */
-	kbds->keystates = keystates;
-	if (kbds->notify_cb) {
-		kbds->notify_cb(kbds, keystates);
+	if (length < BT_KBDS_EVT_HDR_LEN ||
+	    (length - BT_KBDS_EVT_HDR_LEN) % BT_KBDS_EVT_LEN) {
+		LOG_ERR("Unexpected key event notification size %u.", length);
+		return BT_GATT_ITER_CONTINUE;
+	}
+
+	gap = seq_check(kbds, &kbds->evt_seq, bdata[0],
+			(length - BT_KBDS_EVT_HDR_LEN) / BT_KBDS_EVT_LEN);
+	if (gap < 0) {
+		/* Applying old events would undo newer ones. */
+		return BT_GATT_ITER_CONTINUE;
+	}
+	if (gap > 0) {
+		/* Events went missing, the key state may be wrong. */
+		kbds_resync(kbds);
+	}
+	kbds->module_id = bdata[BT_KBDS_SEQ_LEN];
+	send = sys_get_le32(&bdata[BT_KBDS_SEQ_LEN + BT_KBDS_MODULE_LEN]);
+	clock_update(&kbds->clock, send, bt_kbds_time_get());
+	bdata += BT_KBDS_EVT_HDR_LEN;
+	length -= BT_KBDS_EVT_HDR_LEN;
+
+	for (; length; length -= BT_KBDS_EVT_LEN, bdata += BT_KBDS_EVT_LEN) {
+		struct bt_kbds_key_evt evt = {
+			.position = bdata[0] & BT_KBDS_EVT_POS_MASK,
+			.pressed = bdata[0] & BT_KBDS_EVT_PRESSED,
+			.age = sys_get_le16(&bdata[1]),
+		};
+
+		evt.time = send - evt.age + kbds->clock.offset;
+
+		if (evt.position < KEYSET_KEYS) {
+			if (!kbds->keystates_valid) {
+				keyset_clear(&kbds->keystates);
+				kbds->keystates_valid = true;
+			}
+			/* Already applied by a resync read. */
+			if (keyset_test(&kbds->keystates, evt.position) ==
+			    evt.pressed) {
+				continue;
+			}
+			keyset_write(&kbds->keystates, evt.position,
+				     evt.pressed);
+		}
+		if (kbds->evt_cb) {
+			kbds->evt_cb(kbds, &evt);
+		}
 	}
 
 	return BT_GATT_ITER_CONTINUE;
@@ -100,27 +408,19 @@ static uint8_t read_process(struct bt_conn *conn, uint8_t err,
 			     const void *data, uint16_t length)
 {
 	struct bt_kbds_client *kbds;
-	uint32_t keystates = BT_KBDS_VAL_INVALID;
-	const uint8_t *bdata = data;
 
 	kbds = CONTAINER_OF(params, struct bt_kbds_client, read_params);
 
 	if (!kbds->read_cb) {
-		printk("No read callback present");
+		LOG_ERR("No read callback present");
 	} else  if (err) {
-		printk("Read value error: %d", err);
-		kbds->read_cb(kbds,  keystates, err);
-	} else if (!data || length != 1) {
-		kbds->read_cb(kbds,  keystates, -EMSGSIZE);
+		LOG_ERR("Read value error: %d", err);
+		kbds->read_cb(kbds, NULL, err);
+	} else if (button_value_parse(kbds, &kbds->keystates, data, length)) {
+		kbds->read_cb(kbds, NULL, -EMSGSIZE);
 	} else {
-		keystates = bdata[0];
-		if (keystates > BT_KBDS_VAL_MAX) {
-			printk("Unexpected read value.\n");
-			kbds->read_cb(kbds, BT_KBDS_VAL_INVALID, err);
-		} else {
-			kbds->keystates = keystates;
-			kbds->read_cb(kbds, keystates, err);
-		}
+		kbds->keystates_valid = true;
+		kbds->read_cb(kbds, &kbds->keystates, err);
 	}
 
 	kbds->read_cb = NULL;
@@ -150,25 +450,23 @@ static uint8_t periodic_read_process(struct bt_conn *conn, uint8_t err,
 {
 	int32_t interval;
 	struct bt_kbds_client *kbds;
-	uint32_t keystates = BT_KBDS_VAL_INVALID;
-	const uint8_t *bdata = data;
+	struct keyset keystates;
 
 	kbds = CONTAINER_OF(params, struct bt_kbds_client,
 			periodic_read.params);
 
 	if (!kbds->notify_cb) {
-		printk("No notification callback present");
+		LOG_ERR("No notification callback present");
 	} else  if (err) {
-		printk("Read value error: %d", err);
-	} else if (!data || length != 1) {
-		printk("Unexpected read value size.\n");
+		LOG_ERR("Read value error: %d", err);
+	} else if (button_value_parse(kbds, &keystates, data, length)) {
+		LOG_ERR("Unexpected read value size.");
 	} else {
-		keystates = bdata[0];
-		if (keystates > BT_KBDS_VAL_MAX) {
-			printk("Unexpected read value.\n");
-		} else if (kbds->keystates != keystates) {
+		if (!kbds->keystates_valid ||
+		    !keyset_equal(&kbds->keystates, &keystates)) {
 			kbds->keystates = keystates;
-			kbds->notify_cb(kbds, keystates);
+			kbds->keystates_valid = true;
+			kbds->notify_cb(kbds, &kbds->keystates);
 		} else {
 			/* Do nothing. */
 		}
@@ -202,7 +500,7 @@ static void kbds_read_value_handler(struct k_work *work)
 	}
 
 	if (!kbds->conn) {
-		printk("No connection object.\n");
+		LOG_ERR("No connection object.");
 		return;
 	}
 
@@ -217,12 +515,209 @@ static void kbds_read_value_handler(struct k_work *work)
 	 * Periodic read process is stopped after disconnection.
 	 */
 	if (err) {
-		printk("Periodic Battery Level characteristic read error: %d",
+		LOG_ERR("Periodic Battery Level characteristic read error: %d",
 			err);
 	}
 }
 
 
+/**
+ * @brief Build the handle cache key of a server
+ *
+ * @param addr Server address.
+ * @param key  Filled with the key, KBDS_CACHE_KEY_LEN bytes.
+ */
+static void cache_key(const bt_addr_le_t *addr, char *key)
+{
+	size_t len = strlen(KBDS_CACHE_KEY_PREFIX);
+
+	memcpy(key, KBDS_CACHE_KEY_PREFIX, len);
+	bin2hex((const uint8_t *)addr, sizeof(*addr), &key[len],
+		KBDS_CACHE_KEY_LEN - len);
+}
+
+static int cache_load_cb(const char *key, size_t len,
+			 settings_read_cb read_cb, void *cb_arg, void *param)
+{
+	struct kbds_cache_load *load = param;
+
+	if (len != sizeof(*load->cache)) {
+		return -EINVAL;
+	}
+
+	load->found = read_cb(cb_arg, load->cache, len) == len;
+
+	return 0;
+}
+
+/**
+ * @brief Look up the cached handles of a server
+ *
+ * Runs on the background work queue, after the database hash read.
+ *
+ * @param i Pool index of the KBDS Client object.
+ */
+static void cache_load(size_t i)
+{
+	struct bt_kbds_client *kbds = &pool[i];
+	struct bt_conn *conn = pool_conns[i];
+	struct kbds_handle_cache cache;
+	struct kbds_cache_load load = {
+		.cache = &cache,
+	};
+	char key[KBDS_CACHE_KEY_LEN];
+
+	if (!conn) {
+		return;
+	}
+
+	cache_key(bt_conn_get_dst(conn), key);
+	settings_load_subtree_direct(key, cache_load_cb, &load);
+	if (pool_conns[i] != conn) {
+		/* Disconnected during the lookup. */
+		return;
+	}
+	if (!load.found) {
+		kbds->cache_cb(kbds, -ENOENT);
+		return;
+	}
+	if (memcmp(cache.db_hash, kbds->db_hash, sizeof(cache.db_hash))) {
+		kbds->cache_cb(kbds, -ESTALE);
+		return;
+	}
+
+	kbds->val_handle = cache.val_handle;
+	kbds->ccc_handle = cache.ccc_handle;
+	kbds->notify = cache.ccc_handle != 0;
+	kbds->evt_handle = cache.evt_handle;
+	kbds->evt_ccc_handle = cache.evt_ccc_handle;
+	kbds->properties = cache.properties;
+	kbds->cached = true;
+
+	kbds->cache_cb(kbds, 0);
+}
+
+static void cache_work_fn(struct k_work *work)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(pool); i++) {
+		if (atomic_test_and_clear_bit(&cache_stale_pending, i)) {
+			settings_delete(cache_stale_keys[i]);
+			if (pool_conns[i] && pool[i].cache_cb) {
+				pool[i].cache_cb(&pool[i], -ESTALE);
+			}
+		}
+		if (atomic_test_and_clear_bit(&cache_load_pending, i)) {
+			cache_load(i);
+		}
+	}
+}
+
+static K_WORK_DEFINE(cache_work, cache_work_fn);
+
+/**
+ * @brief Drop the cached handles after a failed subscription
+ *
+ * Both subscriptions can fail, the first one reports the stale cache,
+ * once per connection.
+ *
+ * @param kbds KBDS Client object.
+ */
+static void cache_stale(struct bt_kbds_client *kbds)
+{
+	size_t i = kbds - pool;
+
+	if (!kbds->cached || kbds->cache_stale_reported) {
+		return;
+	}
+
+	LOG_WRN("Cached handles are stale.");
+	kbds->cached = false;
+	kbds->cache_stale_reported = true;
+
+	cache_key(bt_conn_get_dst(kbds->conn), cache_stale_keys[i]);
+	atomic_set_bit(&cache_stale_pending, i);
+	bg_work_submit(&cache_work);
+}
+
+/**
+ * @brief Process database hash read
+ *
+ * Looks up the cached handles on the background work queue.
+ *
+ * @param conn   Connection handler.
+ * @param err    Read ATT error code.
+ * @param params Read parameters structure.
+ * @param data   Pointer to the data buffer.
+ * @param length The size of the received data.
+ *
+ * @retval BT_GATT_ITER_STOP     Stop reading
+ */
+static uint8_t hash_read_process(struct bt_conn *conn, uint8_t err,
+				 struct bt_gatt_read_params *params,
+				 const void *data, uint16_t length)
+{
+	struct bt_kbds_client *kbds;
+
+	kbds = CONTAINER_OF(params, struct bt_kbds_client, hash_params);
+
+	if (err == BT_ATT_ERR_ATTRIBUTE_NOT_FOUND) {
+		kbds->cache_cb(kbds, -ENOTSUP);
+		return BT_GATT_ITER_STOP;
+	}
+	if (err) {
+		LOG_ERR("Database hash read error: %d", err);
+		kbds->cache_cb(kbds, -EIO);
+		return BT_GATT_ITER_STOP;
+	}
+	if (!data || length != BT_KBDS_DB_HASH_LEN) {
+		LOG_ERR("Unexpected database hash size.");
+		kbds->cache_cb(kbds, -ENOTSUP);
+		return BT_GATT_ITER_STOP;
+	}
+
+	memcpy(kbds->db_hash, data, sizeof(kbds->db_hash));
+	kbds->db_hash_valid = true;
+
+	atomic_set_bit(&cache_load_pending, kbds - pool);
+	bg_work_submit(&cache_work);
+
+	return BT_GATT_ITER_STOP;
+}
+
+/**
+ * @brief Check the result of a Button subscription
+ */
+static void subscribe_done(struct bt_conn *conn, uint8_t err,
+			   struct bt_gatt_subscribe_params *params)
+{
+	struct bt_kbds_client *kbds;
+
+	kbds = CONTAINER_OF(params, struct bt_kbds_client, notify_params);
+
+	if (err) {
+		LOG_ERR("Report notification subscribe failed: %d.", err);
+		kbds->notify_cb = NULL;
+		cache_stale(kbds);
+	}
+}
+
+/**
+ * @brief Check the result of a Key Event subscription
+ */
+static void evt_subscribe_done(struct bt_conn *conn, uint8_t err,
+			       struct bt_gatt_subscribe_params *params)
+{
+	struct bt_kbds_client *kbds;
+
+	kbds = CONTAINER_OF(params, struct bt_kbds_client, evt_notify_params);
+
+	if (err) {
+		LOG_ERR("Key event subscribe failed: %d.", err);
+		kbds->evt_cb = NULL;
+		cache_stale(kbds);
+	}
+}
+
 /**
  * @brief Reinitialize the KBDS Client.
  *
@@ -232,18 +727,27 @@ static void kbds_reinit(struct bt_kbds_client *kbds)
 {
 	kbds->ccc_handle = 0;
 	kbds->val_handle = 0;
-	kbds->keystates = BT_KBDS_VAL_INVALID;
+	kbds->keystates_valid = false;
+	kbds->module_id = BT_KBDS_MODULE_INVALID;
 	kbds->conn = NULL;
+	kbds->evt_ccc_handle = 0;
+	kbds->evt_handle = 0;
 	kbds->notify_cb = NULL;
+	kbds->evt_cb = NULL;
 	kbds->read_cb = NULL;
 	kbds->notify = false;
+	kbds->notify_seq.valid = false;
+	kbds->evt_seq.valid = false;
+	kbds->clock.valid = false;
+	kbds->resync_pending = false;
+	kbds->cached = false;
 }
 
 
 void bt_kbds_client_init(struct bt_kbds_client *kbds)
 {
 	memset(kbds, 0, sizeof(*kbds));
-	kbds->keystates = BT_KBDS_VAL_INVALID;
+	kbds->module_id = BT_KBDS_MODULE_INVALID;
 
 	k_work_init_delayable(&kbds->periodic_read.read_work,
 			      kbds_read_value_handler);
@@ -264,7 +768,7 @@ int bt_kbds_handles_assign(struct bt_gatt_dm *dm,
 	if (bt_uuid_cmp(gatt_service->uuid, BT_UUID_KBDS)) {
 		return -ENOTSUP;
 	}
-	printk("Getting handles from battery service.\n");
+	LOG_DBG("Getting handles from battery service.");
 
 	/* If connection is established again, cancel previous read request. */
 	k_work_cancel_delayable(&kbds->periodic_read.read_work);
@@ -274,7 +778,7 @@ int bt_kbds_handles_assign(struct bt_gatt_dm *dm,
 	/* Battery level characteristic */
 	gatt_chrc = bt_gatt_dm_char_by_uuid(dm, BT_UUID_KBDS_BUTTON);
 	if (!gatt_chrc) {
-		printk("No battery level characteristic found.\n");
+		LOG_ERR("No battery level characteristic found.");
 		return -EINVAL;
 	}
 	chrc_val = bt_gatt_dm_attr_chrc_val(gatt_chrc);
@@ -285,24 +789,113 @@ int bt_kbds_handles_assign(struct bt_gatt_dm *dm,
 	gatt_desc = bt_gatt_dm_desc_by_uuid(dm, gatt_chrc,
 					    BT_UUID_KBDS_BUTTON);
 	if (!gatt_desc) {
-		printk("No battery level characteristic value found.\n");
+		LOG_ERR("No battery level characteristic value found.");
 		return -EINVAL;
 	}
 	kbds->val_handle = gatt_desc->handle;
 
 	gatt_desc = bt_gatt_dm_desc_by_uuid(dm, gatt_chrc, BT_UUID_GATT_CCC);
 	if (!gatt_desc) {
-		printk("No battery CCC descriptor found. Battery service do not supported notification.\n");
+		LOG_WRN("No battery CCC descriptor found. "
+			"Battery service do not supported notification.");
 	} else {
 		kbds->notify = true;
 		kbds->ccc_handle = gatt_desc->handle;
 	}
 
+	/* Key event characteristic, optional for older servers */
+	gatt_chrc = bt_gatt_dm_char_by_uuid(dm, BT_UUID_KBDS_EVENT);
+	if (gatt_chrc) {
+		gatt_desc = bt_gatt_dm_desc_by_uuid(dm, gatt_chrc,
+						    BT_UUID_KBDS_EVENT);
+		if (gatt_desc) {
+			kbds->evt_handle = gatt_desc->handle;
+		}
+		gatt_desc = bt_gatt_dm_desc_by_uuid(dm, gatt_chrc,
+						    BT_UUID_GATT_CCC);
+		if (gatt_desc) {
+			kbds->evt_ccc_handle = gatt_desc->handle;
+		} else {
+			kbds->evt_handle = 0;
+		}
+	}
+	if (!kbds->evt_handle) {
+		LOG_ERR("No key event characteristic found.");
+	}
+
 	/* Finally - save connection object */
 	kbds->conn = bt_gatt_dm_conn_get(dm);
 	return 0;
 }
 
+int bt_kbds_handles_cached_assign(struct bt_kbds_client *kbds,
+				  struct bt_conn *conn,
+				  bt_kbds_cache_cb func)
+{
+	int err;
+
+	if (!kbds || !conn || !func) {
+		return -EINVAL;
+	}
+	if ((size_t)(kbds - pool) >= ARRAY_SIZE(pool)) {
+		return -EINVAL;
+	}
+	if (!IS_ENABLED(CONFIG_SETTINGS)) {
+		return -ENOTSUP;
+	}
+
+	/* If connection is established again, cancel previous read request. */
+	k_work_cancel_delayable(&kbds->periodic_read.read_work);
+	kbds_reinit(kbds);
+	kbds->db_hash_valid = false;
+	kbds->cache_cb = func;
+	/* Kept on failure too, so the caller can fall back to a discovery. */
+	kbds->conn = conn;
+
+	kbds->hash_params.func = hash_read_process;
+	kbds->hash_params.handle_count = 0;
+	kbds->hash_params.by_uuid.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+	kbds->hash_params.by_uuid.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	kbds->hash_params.by_uuid.uuid = BT_UUID_GATT_DB_HASH;
+
+	err = bt_gatt_read(conn, &kbds->hash_params);
+	if (err) {
+		LOG_ERR("Database hash read failed: %d", err);
+	}
+
+	return err;
+}
+
+int bt_kbds_handles_store(struct bt_kbds_client *kbds)
+{
+	struct kbds_handle_cache cache = { 0 };
+	char key[KBDS_CACHE_KEY_LEN];
+
+	if (!kbds || !kbds->conn || !kbds->val_handle) {
+		return -EINVAL;
+	}
+	if (!IS_ENABLED(CONFIG_SETTINGS)) {
+		return -ENOTSUP;
+	}
+	if (!kbds->db_hash_valid) {
+		return -ENODATA;
+	}
+	if (kbds->cached) {
+		return 0;
+	}
+
+	memcpy(cache.db_hash, kbds->db_hash, sizeof(cache.db_hash));
+	cache.val_handle = kbds->val_handle;
+	cache.ccc_handle = kbds->ccc_handle;
+	cache.evt_handle = kbds->evt_handle;
+	cache.evt_ccc_handle = kbds->evt_ccc_handle;
+	cache.properties = kbds->properties;
+
+	cache_key(bt_conn_get_dst(kbds->conn), key);
+
+	return settings_save_one(key, &cache, sizeof(cache));
+}
+
 int bt_kbds_subscribe_keystates(struct bt_kbds_client *kbds,
 				   bt_kbds_notify_cb func)
 {
@@ -322,24 +915,66 @@ int bt_kbds_subscribe_keystates(struct bt_kbds_client *kbds,
 	}
 
 	kbds->notify_cb = func;
+	kbds->notify_seq.valid = false;
 
 	kbds->notify_params.notify = notify_process;
+	kbds->notify_params.subscribe = subscribe_done;
 	kbds->notify_params.value = BT_GATT_CCC_NOTIFY;
 	kbds->notify_params.value_handle = kbds->val_handle;
 	kbds->notify_params.ccc_handle = kbds->ccc_handle;
 	atomic_set_bit(kbds->notify_params.flags,
 		       BT_GATT_SUBSCRIBE_FLAG_VOLATILE);
 
-	printk("Subscribe: val: %u, ccc: %u \n",
+	LOG_DBG("Subscribe: val: %u, ccc: %u",
 		kbds->notify_params.value_handle,
 		kbds->notify_params.ccc_handle);
 	err = bt_gatt_subscribe(kbds->conn, &kbds->notify_params);
 	if (err) {
-		printk("Report notification subscribe error: %d.\n", err);
+		LOG_ERR("Report notification subscribe error: %d.", err);
 		kbds->notify_cb = NULL;
 		return err;
 	}
-	printk("Report subscribed.\n");
+	LOG_DBG("Report subscribed.");
+	return err;
+}
+
+
+int bt_kbds_subscribe_key_events(struct bt_kbds_client *kbds,
+				 bt_kbds_key_evt_cb func)
+{
+	int err;
+
+	if (!kbds || !func) {
+		return -EINVAL;
+	}
+	if (!kbds->conn) {
+		return -EINVAL;
+	}
+	if (!bt_kbds_key_events_supported(kbds)) {
+		return -ENOTSUP;
+	}
+	if (kbds->evt_cb) {
+		return -EALREADY;
+	}
+
+	kbds->evt_cb = func;
+	kbds->evt_seq.valid = false;
+
+	kbds->evt_notify_params.notify = evt_notify_process;
+	kbds->evt_notify_params.subscribe = evt_subscribe_done;
+	kbds->evt_notify_params.value = BT_GATT_CCC_NOTIFY;
+	kbds->evt_notify_params.value_handle = kbds->evt_handle;
+	kbds->evt_notify_params.ccc_handle = kbds->evt_ccc_handle;
+	atomic_set_bit(kbds->evt_notify_params.flags,
+		       BT_GATT_SUBSCRIBE_FLAG_VOLATILE);
+
+	err = bt_gatt_subscribe(kbds->conn, &kbds->evt_notify_params);
+	if (err) {
+		LOG_ERR("Key event subscribe error: %d.", err);
+		kbds->evt_cb = NULL;
+		return err;
+	}
+	LOG_DBG("Key events subscribed.");
 	return err;
 }
 
@@ -362,6 +997,13 @@ int bt_kbds_unsubscribe_keystates(struct bt_kbds_client *kbds)
 }
 
 
+void bt_kbds_client_stats_get(const struct bt_kbds_client *kbds,
+			      struct bt_kbds_client_stats *stats)
+{
+	*stats = kbds->stats;
+}
+
+
 struct bt_conn *bt_kbds_conn(const struct bt_kbds_client *kbds)
 {
 	return kbds->conn;
@@ -396,13 +1038,19 @@ int bt_kbds_read_keystates(struct bt_kbds_client *kbds, bt_kbds_read_cb func)
 }
 
 
-int bt_kbds_get_last_keystates(struct bt_kbds_client *kbds)
+int bt_kbds_get_last_keystates(struct bt_kbds_client *kbds,
+			       struct keyset *keystates)
 {
-	if (!kbds) {
+	if (!kbds || !keystates) {
 		return -EINVAL;
 	}
+	if (!kbds->keystates_valid) {
+		return -ENODATA;
+	}
+
+	*keystates = kbds->keystates;
 
-	return kbds->keystates;
+	return 0;
 }
 
 
@@ -438,3 +1086,82 @@ void bt_kbds_stop_per_read_keystates(struct bt_kbds_client *kbds)
 	 */
 	k_work_cancel_delayable(&kbds->periodic_read.read_work);
 }
+
+
+struct bt_kbds_client *bt_kbds_client_get(struct bt_conn *conn)
+{
+	struct bt_kbds_client *kbds;
+
+	if (!conn) {
+		return NULL;
+	}
+
+	kbds = bt_kbds_client_find(conn);
+	if (kbds) {
+		return kbds;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(pool); i++) {
+		if (!pool_conns[i]) {
+			pool_conns[i] = bt_conn_ref(conn);
+			bt_kbds_client_init(&pool[i]);
+			return &pool[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+struct bt_kbds_client *bt_kbds_client_find(struct bt_conn *conn)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(pool); i++) {
+		if (conn && pool_conns[i] == conn) {
+			return &pool[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+struct bt_kbds_client *bt_kbds_client_find_module(uint8_t module_id)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(pool); i++) {
+		if (pool_conns[i] && pool[i].module_id == module_id) {
+			return &pool[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+void bt_kbds_client_release(struct bt_kbds_client *kbds)
+{
+	size_t i = kbds - pool;
+
+	if (i >= ARRAY_SIZE(pool) || !pool_conns[i]) {
+		return;
+	}
+
+	bt_kbds_stop_per_read_keystates(kbds);
+	kbds_reinit(kbds);
+	atomic_clear_bit(&cache_load_pending, i);
+	bt_conn_unref(pool_conns[i]);
+	pool_conns[i] = NULL;
+}
+
+
+size_t bt_kbds_client_count(void)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(pool); i++) {
+		if (pool_conns[i]) {
+			count++;
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_KEYSET_H_
+#define KB_KEYSET_H_
+
+/**@file
+ * @defgroup kb_keyset Key set API
+ * @{
+ * @brief Fixed width set of key positions.
+ *
+ * One bit per key of a CONFIG_KB_MATRIX_ROWS x CONFIG_KB_MATRIX_COLS
+ * matrix, stored in 32 bit words. All operations work a word at a time.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <string.h>
+#include <zephyr/types.h>
+#include <zephyr/sys/util.h>
+
+/** @brief Number of keys in a key set. */
+#define KEYSET_KEYS  (CONFIG_KB_MATRIX_ROWS * CONFIG_KB_MATRIX_COLS)
+/** @brief Number of 32 bit words in a key set. */
+#define KEYSET_WORDS DIV_ROUND_UP(KEYSET_KEYS, 32)
+/** @brief Number of bytes of a key set in little endian byte order. */
+#define KEYSET_BYTES DIV_ROUND_UP(KEYSET_KEYS, 8)
+
+/** @brief Set of key positions, bit n of word n / 32 is key n. */
+struct keyset {
+	uint32_t word[KEYSET_WORDS];
+};
+
+/** @brief Iterate over the keys in a set.
+ *
+ * @param set Key set to iterate over.
+ * @param key Name of the int loop variable holding the key position.
+ */
+#define KEYSET_FOREACH(set, key)                                     \
+	for (int key = keyset_next(set, 0); key >= 0;                \
+	     key = keyset_next(set, key + 1))
+
+/** @brief Remove all keys from a set. */
+static inline void keyset_clear(struct keyset *set)
+{
+	memset(set, 0, sizeof(*set));
+}
+
+/** @brief Check whether a key is in a set. */
+static inline bool keyset_test(const struct keyset *set, unsigned int key)
+{
+	return set->word[key / 32] & BIT(key % 32);
+}
+
+/** @brief Add a key to or remove it from a set. */
+static inline void keyset_write(struct keyset *set, unsigned int key,
+				bool val)
+{
+	WRITE_BIT(set->word[key / 32], key % 32, val);
+}
+
+/** @brief Store the keys that are in exactly one of two sets. */
+static inline void keyset_xor(struct keyset *res, const struct keyset *a,
+			      const struct keyset *b)
+{
+	for (size_t i = 0; i < KEYSET_WORDS; i++) {
+		res->word[i] = a->word[i] ^ b->word[i];
+	}
+}
+
+/** @brief Check whether a set is empty. */
+static inline bool keyset_is_empty(const struct keyset *set)
+{
+	uint32_t any = 0;
+
+	for (size_t i = 0; i < KEYSET_WORDS; i++) {
+		any |= set->word[i];
+	}
+
+	return !any;
+}
+
+/** @brief Check whether two sets hold the same keys. */
+static inline bool keyset_equal(const struct keyset *a,
+				const struct keyset *b)
+{
+	return !memcmp(a, b, sizeof(*a));
+}
+
+/** @brief Count the keys in a set. */
+static inline unsigned int keyset_count(const struct keyset *set)
+{
+	unsigned int cnt = 0;
+
+	for (size_t i = 0; i < KEYSET_WORDS; i++) {
+		cnt += __builtin_popcount(set->word[i]);
+	}
+
+	return cnt;
+}
+
+/** @brief Find the first key in a set at or after a position.
+ *
+ * @param set  Key set.
+ * @param from First position to look at.
+ *
+ * @return Key position, or -1 if there is none.
+ */
+static inline int keyset_next(const struct keyset *set, unsigned int from)
+{
+	for (size_t i = from / 32; i < KEYSET_WORDS; i++) {
+		uint32_t word = set->word[i];
+
+		if (i == from / 32) {
+			word &= ~BIT_MASK(from % 32);
+		}
+		if (word) {
+			return i * 32 + __builtin_ctz(word);
+		}
+	}
+
+	return -1;
+}
+
+/** @brief Encode a set as KEYSET_BYTES little endian bytes. */
+static inline void keyset_to_bytes(const struct keyset *set, uint8_t *buf)
+{
+	for (size_t i = 0; i < KEYSET_BYTES; i++) {
+		buf[i] = set->word[i / 4] >> (8 * (i % 4));
+	}
+}
+
+/** @brief Decode a set from little endian bytes.
+ *
+ * A shorter encoding leaves the remaining keys released, keys beyond
+ * KEYSET_KEYS in a longer one are dropped.
+ *
+ * @param set Key set to fill.
+ * @param buf Encoded set.
+ * @param len Length of the encoded set.
+ */
+static inline void keyset_from_bytes(struct keyset *set, const uint8_t *buf,
+				     size_t len)
+{
+	keyset_clear(set);
+
+	for (size_t i = 0; i < MIN(len, KEYSET_BYTES); i++) {
+		set->word[i / 4] |= (uint32_t)buf[i] << (8 * (i % 4));
+	}
+	if (KEYSET_KEYS % 32) {
+		set->word[KEYSET_WORDS - 1] &= BIT_MASK(KEYSET_KEYS % 32);
+	}
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_KEYSET_H_ */
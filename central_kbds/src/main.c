@@ -29,6 +29,7 @@
 
 #include "kbds_client.h"
 #include "kbds.h"
+#include "split_link.h"
 
 /**
  * Button to read the battery value
@@ -38,11 +39,13 @@
 #define KBDS_READ_VALUE_INTERVAL (10 * MSEC_PER_SEC)
 
 
-static struct bt_conn *default_conn;
-static struct bt_kbds_client kbds;
+/* Connection being established, before it gets a KBDS client. */
+static struct bt_conn *connecting;
 
 static void notify_keystates_cb(struct bt_kbds_client *kbds,
-				    uint32_t keystates);
+				const struct keyset *keystates);
+static void key_evt_cb(struct bt_kbds_client *kbds,
+		       const struct bt_kbds_key_evt *evt);
 
 static void scan_filter_match(struct bt_scan_device_info *device_info,
 			      struct bt_scan_filter_match *filter_match,
@@ -56,15 +59,32 @@ static void scan_filter_match(struct bt_scan_device_info *device_info,
 		addr, connectable ? "yes" : "no");
 }
 
+static void scan_restart(void)
+{
+	int err;
+
+	if (connecting ||
+	    bt_kbds_client_count() >= CONFIG_BT_KBDS_CLIENT_COUNT) {
+		return;
+	}
+
+	/* This demo doesn't require active scan */
+	err = bt_scan_start(BT_SCAN_TYPE_SCAN_ACTIVE);
+	if (err && err != -EALREADY) {
+		printk("Scanning failed to start (err %d)\n", err);
+	}
+}
+
 static void scan_connecting_error(struct bt_scan_device_info *device_info)
 {
 	printk("Connecting failed\n");
+	scan_restart();
 }
 
 static void scan_connecting(struct bt_scan_device_info *device_info,
 			    struct bt_conn *conn)
 {
-	default_conn = bt_conn_ref(conn);
+	connecting = bt_conn_ref(conn);
 }
 
 static void scan_filter_no_match(struct bt_scan_device_info *device_info,
@@ -85,8 +105,9 @@ static void scan_filter_no_match(struct bt_scan_device_info *device_info,
 					device_info->conn_param, &conn);
 
 		if (!err) {
-			default_conn = bt_conn_ref(conn);
-			bt_conn_unref(conn);
+			connecting = conn;
+		} else {
+			scan_restart();
 		}
 	}
 }
@@ -94,22 +115,54 @@ static void scan_filter_no_match(struct bt_scan_device_info *device_info,
 BT_SCAN_CB_INIT(scan_cb, scan_filter_match, scan_filter_no_match,
 		scan_connecting_error, scan_connecting);
 
+static void split_link_updated(struct bt_conn *conn, uint16_t interval,
+			       uint16_t latency, uint16_t timeout)
+{
+	printk("Split link updated: interval %u, latency %u, timeout %u\n",
+	       interval, latency, timeout);
+}
+
+static void split_link_rejected(struct bt_conn *conn,
+				const struct bt_le_conn_param *param, int err)
+{
+	printk("Split link parameters rejected: interval %u, latency %u "
+	       "(err %d)\n", param->interval_min, param->latency, err);
+}
+
+static const struct split_link_cb split_link_callbacks = {
+	.updated  = split_link_updated,
+	.rejected = split_link_rejected,
+};
+
 static void discovery_completed_cb(struct bt_gatt_dm *dm,
 				   void *context)
 {
+	struct bt_kbds_client *kbds = bt_kbds_client_find(
+		bt_gatt_dm_conn_get(dm));
 	int err;
 
 	printk("The discovery procedure succeeded\n");
 
 	bt_gatt_dm_data_print(dm);
 
-	err = bt_kbds_handles_assign(dm, &kbds);
+	err = bt_kbds_handles_assign(dm, kbds);
 	if (err) {
 		printk("Could not init KBDS client object, error: %d\n", err);
 	}
 
-	if (bt_kbds_notify_supported(&kbds)) {
-		err = bt_kbds_subscribe_keystates(&kbds,
+	err = split_link_start(bt_gatt_dm_conn_get(dm));
+	if (err) {
+		printk("Split link start failed (err %d)\n", err);
+	}
+
+	if (bt_kbds_key_events_supported(kbds)) {
+		err = bt_kbds_subscribe_key_events(kbds, key_evt_cb);
+		if (err) {
+			printk("Cannot subscribe to KBDS key events "
+				"(err: %d)\n", err);
+		}
+	} else if (bt_kbds_notify_supported(kbds)) {
+		err = bt_kbds_subscribe_keystates(kbds,
 						     notify_keystates_cb);
 		if (err) {
 			printk("Cannot subscribe to KBDS value notification "
@@ -118,7 +171,7 @@ static void discovery_completed_cb(struct bt_gatt_dm *dm,
 		}
 	} else {
 		err = bt_kbds_start_per_read_keystates(
-			&kbds, KBDS_READ_VALUE_INTERVAL, notify_keystates_cb);
+			kbds, KBDS_READ_VALUE_INTERVAL, notify_keystates_cb);
 		if (err) {
 			printk("Could not start periodic read of KBDS value\n");
 		}
@@ -154,7 +207,7 @@ static void gatt_discover(struct bt_conn *conn)
 {
 	int err;
 
-	if (conn != default_conn) {
+	if (!bt_kbds_client_find(conn)) {
 		return;
 	}
 
@@ -172,25 +225,28 @@ static void connected(struct bt_conn *conn, uint8_t conn_err)
 
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
+	if (conn == connecting) {
+		bt_conn_unref(connecting);
+		connecting = NULL;
+	}
+
 	if (conn_err) {
 		printk("Failed to connect to %s (%u)\n", addr, conn_err);
-		if (conn == default_conn) {
-			bt_conn_unref(default_conn);
-			default_conn = NULL;
-
-			/* This demo doesn't require active scan */
-			err = bt_scan_start(BT_SCAN_TYPE_SCAN_ACTIVE);
-			if (err) {
-				printk("Scanning failed to start (err %d)\n",
-				       err);
-			}
-		}
-
+		scan_restart();
 		return;
 	}
 
 	printk("Connected: %s\n", addr);
 
+	if (!bt_kbds_client_get(conn)) {
+		printk("No free KBDS client for %s\n", addr);
+		bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		return;
+	}
+	printk("%u of %u modules connected\n", bt_kbds_client_count(),
+	       CONFIG_BT_KBDS_CLIENT_COUNT);
+	scan_restart();
+
 	err = bt_conn_set_security(conn, BT_SECURITY_L1);
 	if (err) {
 		printk("Failed to set security: %d\n", err);
@@ -203,24 +259,25 @@ static void connected(struct bt_conn *conn, uint8_t conn_err)
 static void disconnected(struct bt_conn *conn, uint8_t reason)
 {
 	char addr[BT_ADDR_LE_STR_LEN];
-	int err;
+	struct bt_kbds_client_stats stats;
+	struct bt_kbds_client *kbds;
 
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
 	printk("Disconnected: %s (reason %u)\n", addr, reason);
 
-	if (default_conn != conn) {
+	kbds = bt_kbds_client_find(conn);
+	if (!kbds) {
 		return;
 	}
 
-	bt_conn_unref(default_conn);
-	default_conn = NULL;
+	bt_kbds_client_stats_get(kbds, &stats);
+	printk("KBDS module %u link: lost %u, stale %u, resyncs %u\n",
+	       bt_kbds_module_id(kbds), stats.lost, stats.stale,
+	       stats.resyncs);
 
-	/* This demo doesn't require active scan */
-	err = bt_scan_start(BT_SCAN_TYPE_SCAN_ACTIVE);
-	if (err) {
-		printk("Scanning failed to start (err %d)\n", err);
-	}
+	bt_kbds_client_release(kbds);
+	scan_restart();
 }
 
 static void security_changed(struct bt_conn *conn, bt_security_t level,
@@ -253,7 +310,7 @@ static void scan_init(void)
 	struct bt_scan_init_param scan_init = {
 		.connect_if_match = 1,
 		.scan_param = NULL,
-		.conn_param = BT_LE_CONN_PARAM_DEFAULT
+		.conn_param = SPLIT_LINK_CONN_PARAM
 	};
 
 	bt_scan_init(&scan_init);
@@ -273,25 +330,41 @@ static void scan_init(void)
 }
 
 static void notify_keystates_cb(struct bt_kbds_client *kbds,
-				    uint32_t keystates)
+				const struct keyset *keystates)
 {
 	char addr[BT_ADDR_LE_STR_LEN];
 
 	bt_addr_le_to_str(bt_conn_get_dst(bt_kbds_conn(kbds)),
 			  addr, sizeof(addr));
-	if (keystates == BT_KBDS_VAL_INVALID) {
+	if (!keystates) {
 		printk("[%s] Battery notification aborted\n", addr);
 	} else {
-		//printk("[%s] Battery notification: %"PRIu8"%%\n",
-		//       addr, keystates);
-		printk("[%s] Battery notification: %x \n",
-		       addr, keystates);
+		printk("[%s] Module %u notification: %u keys pressed\n",
+		       addr, bt_kbds_module_id(kbds),
+		       keyset_count(keystates));
+	}
+}
+
+static void key_evt_cb(struct bt_kbds_client *kbds,
+		       const struct bt_kbds_key_evt *evt)
+{
+	struct keyset keystates;
+
+	if (bt_kbds_get_last_keystates(kbds, &keystates)) {
+		keyset_clear(&keystates);
 	}
+
+	printk("Module %u key %u %s, age %u us, %d us ago, "
+	       "%u keys pressed\n", bt_kbds_module_id(kbds), evt->position, evt->pressed ? "pressed" : "released",
+	       evt->age * BT_KBDS_EVT_TIME_UNIT_US,
+	       (int32_t)(bt_kbds_time_get() - evt->time) *
+	       BT_KBDS_EVT_TIME_UNIT_US,
+	       keyset_count(&keystates));
 }
 
 static void read_keystates_cb(struct bt_kbds_client *kbds,
-				  uint32_t keystates,
-				  int err)
+			      const struct keyset *keystates,
+			      int err)
 {
 	char addr[BT_ADDR_LE_STR_LEN];
 
@@ -302,20 +375,31 @@ static void read_keystates_cb(struct bt_kbds_client *kbds,
 		return;
 	}
 
-	printk("[%s] Battery read: %x\n", addr, keystates);
+	printk("[%s] Module %u read: %u keys pressed\n", addr,
+	       bt_kbds_module_id(kbds), keyset_count(keystates));
 }
 
 
-static void button_readval(void)
+static void readval(struct bt_conn *conn, void *data)
 {
+	struct bt_kbds_client *kbds = bt_kbds_client_find(conn);
 	int err;
 
-	printk("Reading KBDS value:\n");
-	err = bt_kbds_read_keystates(&kbds, read_keystates_cb);
+	if (!kbds) {
+		return;
+	}
+
+	err = bt_kbds_read_keystates(kbds, read_keystates_cb);
 	if (err) {
 		printk("KBDS read call error: %d\n", err);
 	}
 }
+
+static void button_readval(void)
+{
+	printk("Reading KBDS values:\n");
+	bt_conn_foreach(BT_CONN_TYPE_LE, readval, NULL);
+}
 /*/
 static void button_handler(uint32_t button_state, uint32_t has_changed)
 {
@@ -373,7 +457,7 @@ void main(void)
 
 	printk("Starting Bluetooth Central KBDS example\n");
 
-	bt_kbds_client_init(&kbds);
+	split_link_init(&split_link_callbacks);
 
 	err = bt_enable(NULL);
 	if (err) {
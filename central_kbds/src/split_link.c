@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Connection parameter manager for the split link
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "split_link.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(split_link, CONFIG_KB_SPLIT_LINK_LOG_LEVEL);
+
+static const struct bt_le_conn_param active_param =
+	BT_LE_CONN_PARAM_INIT(CONFIG_KB_SPLIT_LINK_INTERVAL,
+			      CONFIG_KB_SPLIT_LINK_INTERVAL, 0,
+			      CONFIG_KB_SPLIT_LINK_TIMEOUT);
+
+/* Peripheral latency asked for on the links of the peripheral role. */
+static uint16_t peripheral_latency;
+
+/* State of one split link. */
+struct split_link {
+	struct bt_conn *conn;
+	struct bt_le_conn_param requested;
+	struct split_link_info info;
+	bool peripheral;
+
+	struct k_work param_work;
+	struct k_work speed_work;
+	struct k_work_delayable timeout_work;
+	struct bt_gatt_exchange_params exchange_params;
+};
+
+static const struct split_link_cb *link_cb;
+static struct split_link links[CONFIG_KB_SPLIT_LINK_MAX];
+
+/* Find the context of a connection, or a free one for NULL. */
+static struct split_link *link_find(struct bt_conn *conn)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(links); i++) {
+		if (links[i].conn == conn) {
+			return &links[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void param_rejected(struct split_link *link, int err)
+{
+	if (link_cb && link_cb->rejected) {
+		link_cb->rejected(link->conn, &link->requested, err);
+	}
+}
+
+static void param_work_fn(struct k_work *work)
+{
+	struct split_link *link = CONTAINER_OF(work, struct split_link,
+					       param_work);
+	int err;
+
+	if (!link->conn) {
+		return;
+	}
+
+	link->requested = active_param;
+	if (link->peripheral) {
+		link->requested.latency = peripheral_latency;
+	}
+
+	err = bt_conn_le_param_update(link->conn, &link->requested);
+	if (err == -EALREADY) {
+		/* Already running with these parameters. */
+		return;
+	}
+	if (err) {
+		LOG_WRN("Split link parameter request failed (err %d)", err);
+		param_rejected(link, err);
+		return;
+	}
+
+	k_work_reschedule(&link->timeout_work,
+			  K_MSEC(CONFIG_KB_SPLIT_LINK_UPDATE_TIMEOUT_MS));
+}
+
+static void mtu_exchanged(struct bt_conn *conn, uint8_t err,
+			  struct bt_gatt_exchange_params *params)
+{
+	if (err) {
+		LOG_WRN("Split link MTU exchange failed (err %u)", err);
+	}
+}
+
+static void speed_work_fn(struct k_work *work)
+{
+	struct split_link *link = CONTAINER_OF(work, struct split_link,
+					       speed_work);
+	int err;
+
+	if (!link->conn) {
+		return;
+	}
+
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+	err = bt_conn_le_phy_update(link->conn, BT_CONN_LE_PHY_PARAM_2M);
+	if (err) {
+		LOG_WRN("Split link PHY update failed (err %d)", err);
+	}
+#endif
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+	err = bt_conn_le_data_len_update(link->conn,
+					 BT_LE_DATA_LEN_PARAM_MAX);
+	if (err) {
+		LOG_WRN("Split link data length update failed (err %d)", err);
+	}
+#endif
+	link->exchange_params.func = mtu_exchanged;
+	err = bt_gatt_exchange_mtu(link->conn, &link->exchange_params);
+	if (err && err != -EALREADY) {
+		LOG_WRN("Split link MTU exchange failed (err %d)", err);
+	}
+}
+
+static void timeout_work_fn(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct split_link *link = CONTAINER_OF(dwork, struct split_link,
+					       timeout_work);
+
+	LOG_WRN("Split link parameter request timed out");
+	param_rejected(link, -ETIMEDOUT);
+}
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval,
+			     uint16_t latency, uint16_t timeout)
+{
+	struct split_link *link = link_find(conn);
+
+	if (!link) {
+		return;
+	}
+
+	LOG_INF("Split link: interval %u.%02u ms, latency %u, timeout %u ms",
+	        interval * 125 / 100, interval * 125 % 100, latency,
+	        timeout * 10);
+
+	link->info.interval = interval;
+	link->info.latency = latency;
+
+	if (k_work_delayable_is_pending(&link->timeout_work)) {
+		k_work_cancel_delayable(&link->timeout_work);
+		if (interval < link->requested.interval_min ||
+		    interval > link->requested.interval_max ||
+		    latency != link->requested.latency) {
+			param_rejected(link, -EINVAL);
+		}
+	}
+
+	if (link_cb && link_cb->updated) {
+		link_cb->updated(conn, interval, latency, timeout);
+	}
+}
+
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+static void le_phy_updated(struct bt_conn *conn,
+			   struct bt_conn_le_phy_info *param)
+{
+	struct split_link *link = link_find(conn);
+
+	if (!link) {
+		return;
+	}
+
+	LOG_INF("Split link PHY: tx %u, rx %u", param->tx_phy,
+	        param->rx_phy);
+
+	link->info.tx_phy = param->tx_phy;
+	link->info.rx_phy = param->rx_phy;
+}
+#endif
+
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+static void le_data_len_updated(struct bt_conn *conn,
+				struct bt_conn_le_data_len_info *info)
+{
+	struct split_link *link = link_find(conn);
+
+	if (!link) {
+		return;
+	}
+
+	LOG_INF("Split link data length: tx %u bytes, rx %u bytes",
+	        info->tx_max_len, info->rx_max_len);
+
+	link->info.tx_len = info->tx_max_len;
+	link->info.rx_len = info->rx_max_len;
+}
+#endif
+
+static void att_mtu_updated(struct bt_conn *conn, uint16_t tx, uint16_t rx)
+{
+	struct split_link *link = link_find(conn);
+
+	if (!link) {
+		return;
+	}
+
+	LOG_INF("Split link MTU: %u bytes", MIN(tx, rx));
+
+	link->info.mtu = MIN(tx, rx);
+}
+
+static struct bt_gatt_cb split_link_gatt_callbacks = {
+	.att_mtu_updated = att_mtu_updated,
+};
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	struct split_link *link = link_find(conn);
+
+	if (!link) {
+		return;
+	}
+
+	k_work_cancel_delayable(&link->timeout_work);
+	bt_conn_unref(link->conn);
+	link->conn = NULL;
+}
+
+BT_CONN_CB_DEFINE(split_link_conn_callbacks) = {
+	.disconnected     = disconnected,
+	.le_param_updated = le_param_updated,
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+	.le_phy_updated = le_phy_updated,
+#endif
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+	.le_data_len_updated = le_data_len_updated,
+#endif
+};
+
+int split_link_init(const struct split_link_cb *cb)
+{
+	link_cb = cb;
+
+	for (size_t i = 0; i < ARRAY_SIZE(links); i++) {
+		k_work_init(&links[i].param_work, param_work_fn);
+		k_work_init(&links[i].speed_work, speed_work_fn);
+		k_work_init_delayable(&links[i].timeout_work,
+				      timeout_work_fn);
+	}
+
+	bt_gatt_cb_register(&split_link_gatt_callbacks);
+
+	return 0;
+}
+
+int split_link_start(struct bt_conn *conn)
+{
+	struct split_link *link = link_find(conn);
+	struct bt_conn_info info;
+	int err;
+
+	err = bt_conn_get_info(conn, &info);
+	if (err) {
+		return err;
+	}
+
+	if (!link) {
+		link = link_find(NULL);
+		if (!link) {
+			return -ENOMEM;
+		}
+
+		link->conn = bt_conn_ref(conn);
+		link->info = (struct split_link_info) {
+			.interval = info.le.interval,
+			.latency = info.le.latency,
+			.tx_phy = BT_GAP_LE_PHY_1M,
+			.rx_phy = BT_GAP_LE_PHY_1M,
+			.tx_len = 27,
+			.rx_len = 27,
+			.mtu = bt_gatt_get_mtu(conn),
+		};
+	}
+	link->peripheral = (info.role == BT_CONN_ROLE_PERIPHERAL);
+
+	k_work_submit(&link->param_work);
+	if (!link->peripheral) {
+		/* The peripheral accepts whatever the central asks for. */
+		k_work_submit(&link->speed_work);
+	}
+
+	return 0;
+}
+
+int split_link_info_get(struct bt_conn *conn, struct split_link_info *info)
+{
+	struct split_link *link = link_find(conn);
+
+	if (!link) {
+		return -ENOTCONN;
+	}
+
+	*info = link->info;
+
+	return 0;
+}
+
+int split_link_latency_set(uint16_t latency)
+{
+	/* The supervision timeout must cover two intervals of skipped
+	 * events.
+	 */
+	if (CONFIG_KB_SPLIT_LINK_TIMEOUT * 4 <=
+	    (1 + latency) * CONFIG_KB_SPLIT_LINK_INTERVAL) {
+		return -EINVAL;
+	}
+
+	peripheral_latency = latency;
+
+	for (size_t i = 0; i < ARRAY_SIZE(links); i++) {
+		if (links[i].conn && links[i].peripheral) {
+			k_work_submit(&links[i].param_work);
+		}
+	}
+
+	return 0;
+}
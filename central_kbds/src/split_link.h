@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_SPLIT_LINK_H_
+#define KB_SPLIT_LINK_H_
+
+/**@file
+ * @defgroup kb_split_link Split link API
+ * @{
+ * @brief Connection parameter manager for the link between the halves.
+ *
+ * The link runs at CONFIG_KB_SPLIT_LINK_INTERVAL with no peripheral
+ * latency. The peripheral half can ask for a peripheral latency with
+ * split_link_latency_set() while its keys are idle, so it can skip
+ * connection events with nothing to send.
+ *
+ * Up to CONFIG_KB_SPLIT_LINK_MAX links are managed at once, each with its
+ * own requests and timers, so the central half can serve several modules.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/conn.h>
+
+/** @brief Connection parameters of an active split link. */
+#define SPLIT_LINK_CONN_PARAM                                     \
+	BT_LE_CONN_PARAM(CONFIG_KB_SPLIT_LINK_INTERVAL,           \
+			 CONFIG_KB_SPLIT_LINK_INTERVAL, 0,        \
+			 CONFIG_KB_SPLIT_LINK_TIMEOUT)
+
+/** @brief Negotiated split link parameters. */
+struct split_link_info {
+	/** Connection interval [1.25 ms]. */
+	uint16_t interval;
+	/** Peripheral latency [connection events]. */
+	uint16_t latency;
+	/** TX and RX PHY, BT_GAP_LE_PHY_*. */
+	uint8_t tx_phy;
+	uint8_t rx_phy;
+	/** Maximum TX and RX link layer payload [bytes]. */
+	uint16_t tx_len;
+	uint16_t rx_len;
+	/** ATT MTU [bytes]. */
+	uint16_t mtu;
+};
+
+/** @brief Split link callbacks. */
+struct split_link_cb {
+	/** @brief Connection parameters have been updated.
+	 *
+	 * @param conn     Split link connection.
+	 * @param interval Connection interval [1.25 ms].
+	 * @param latency  Peripheral latency [connection events].
+	 * @param timeout  Supervision timeout [10 ms].
+	 */
+	void (*updated)(struct bt_conn *conn, uint16_t interval,
+			uint16_t latency, uint16_t timeout);
+	/** @brief A parameter request was not granted.
+	 *
+	 * @param conn  Split link connection.
+	 * @param param Requested parameters.
+	 * @param err   -ETIMEDOUT if the parameters did not change in time,
+	 *              -EINVAL if the peer picked other values, or the
+	 *              error of the request.
+	 */
+	void (*rejected)(struct bt_conn *conn,
+			 const struct bt_le_conn_param *param, int err);
+};
+
+/** @brief Initialize the split link manager.
+ *
+ * @param cb Callbacks. Can be NULL.
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int split_link_init(const struct split_link_cb *cb);
+
+/** @brief Start managing a split link connection.
+ *
+ * Requests the connection parameters, on the peripheral half with the
+ * latency of the last split_link_latency_set(). On the central half it
+ * also asks for the 2M PHY, the longest data length and the largest ATT
+ * MTU. The connection is released when it disconnects.
+ *
+ * @param conn Split link connection.
+ *
+ * @retval 0 If the operation was successful.
+ * @retval -ENOMEM If CONFIG_KB_SPLIT_LINK_MAX links are managed already.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int split_link_start(struct bt_conn *conn);
+
+/** @brief Get the negotiated split link parameters.
+ *
+ * @param conn Split link connection.
+ * @param info Filled with the current parameters.
+ *
+ * @retval 0 If the operation was successful.
+ * @retval -ENOTCONN If the connection is not a managed split link.
+ */
+int split_link_info_get(struct bt_conn *conn, struct split_link_info *info);
+
+/** @brief Set the peripheral latency of the peripheral half.
+ *
+ * Requests the latency on every link of the peripheral role, and on the
+ * links started later. Links of the central role are not changed. Must
+ * be called from the system workqueue.
+ *
+ * @param latency Connection events the peripheral may skip, 0 for none.
+ *
+ * @retval 0 If the operation was successful.
+ * @retval -EINVAL If the supervision timeout does not cover two
+ *                 intervals of skipped events.
+ */
+int split_link_latency_set(uint16_t latency);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_SPLIT_LINK_H_ */
@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2018 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+"""Generate the keymap lookup tables from a keymap description.
+
+Every (layer, side, position) entry of the description becomes an action
+with a precomputed type, so the firmware never parses key codes at run
+time. See keymap.yml for the entry syntax.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+import yaml
+
+SIDES = ('left', 'right')
+MAX_SIDES = 255
+MAX_LAYERS = 32
+MAX_POSITIONS = 128
+
+KEY_RE = re.compile(r'^#define\s+KEY_(\w+)\s+(0x[0-9a-fA-F]+|\d+)\b', re.M)
+LAYER_RE = re.compile(r'^MO\((\d+)\)$')
+
+HEADER = '''/*
+ * Generated by gen_keymap.py from {src}. Do not edit.
+ */
+'''
+
+
+class KeymapError(Exception):
+    pass
+
+
+def parse_keys(path):
+    """Return the key codes and modifier masks defined in keys.h."""
+    with open(path) as f:
+        text = f.read()
+
+    codes = {}
+    mods = {}
+    for name, value in KEY_RE.findall(text):
+        if name.startswith('MOD_'):
+            mods[name[len('MOD_'):]] = int(value, 0)
+        else:
+            codes[name] = int(value, 0)
+
+    return codes, mods
+
+
+def parse_entry(entry, codes, mods, layers):
+    """Turn one keymap entry into a (type, code, mods) action."""
+    entry = str(entry).strip()
+
+    if entry == 'NONE':
+        return ('KEYMAP_ACT_NONE', 0, 0)
+    if entry == '___':
+        return ('KEYMAP_ACT_TRANS', 0, 0)
+
+    m = LAYER_RE.match(entry)
+    if m:
+        layer = int(m.group(1))
+        if not 0 < layer < layers:
+            raise KeymapError(f'{entry}: no layer {layer}')
+        return ('KEYMAP_ACT_LAYER', layer, 0)
+
+    *mod_names, key = entry.split('+')
+    mask = 0
+    for name in mod_names:
+        if name not in mods:
+            raise KeymapError(f'{entry}: unknown modifier {name}')
+        mask |= mods[name]
+
+    if key in mods:
+        if mod_names:
+            raise KeymapError(f'{entry}: modifiers cannot be combined '
+                              'with a modifier')
+        return ('KEYMAP_ACT_MOD', 0, mods[key])
+    if key not in codes:
+        raise KeymapError(f'{entry}: unknown key {key}')
+
+    return ('KEYMAP_ACT_KEY', codes[key], mask)
+
+
+def parse_keymap(path, codes, mods):
+    with open(path) as f:
+        desc = yaml.safe_load(f)
+
+    rows = desc['rows']
+    cols = desc['cols']
+    layers = desc['layers']
+    tri_layer = desc.get('tri_layer')
+    sides = desc.get('sides', list(SIDES))
+
+    if not 0 < rows * cols <= MAX_POSITIONS:
+        raise KeymapError(f'{rows}x{cols} positions, at most '
+                          f'{MAX_POSITIONS} fit a key event')
+    if tuple(sides[:len(SIDES)]) != SIDES or len(set(sides)) != len(sides):
+        raise KeymapError(f'sides {sides}: expected {", ".join(SIDES)} '
+                          'first, then unique module names')
+    if len(sides) > MAX_SIDES:
+        raise KeymapError(f'{len(sides)} sides, at most {MAX_SIDES} '
+                          'module IDs are available')
+    if not 0 < len(layers) <= MAX_LAYERS:
+        raise KeymapError(f'{len(layers)} layers, at most {MAX_LAYERS} '
+                          'are supported')
+    if tri_layer is not None:
+        if len(tri_layer) != 3 or \
+           any(not 0 < l < len(layers) for l in tri_layer):
+            raise KeymapError(f'tri_layer {tri_layer}: expected three '
+                              'layers other than the base layer')
+
+    names = [layer.get('name', str(i)) for i, layer in enumerate(layers)]
+    table = []
+    for i, (name, layer) in enumerate(zip(names, layers)):
+        grids = []
+        for side in sides:
+            grid = layer.get(side)
+            if grid is None or len(grid) != rows or \
+               any(len(row) != cols for row in grid):
+                raise KeymapError(f'layer {name}: {side} side is not '
+                                  f'{rows}x{cols}')
+            actions = []
+            for r, row in enumerate(grid):
+                for c, entry in enumerate(row):
+                    try:
+                        action = parse_entry(entry, codes, mods,
+                                             len(layers))
+                    except KeymapError as e:
+                        raise KeymapError(f'layer {name}, {side} row {r} '
+                                          f'column {c}: {e}') from None
+                    if i == 0 and action[0] == 'KEYMAP_ACT_TRANS':
+                        raise KeymapError(f'layer {name}: the base layer '
+                                          'cannot be transparent')
+                    actions.append(action)
+            grids.append(actions)
+        table.append(grids)
+
+    return rows, cols, names, tri_layer, sides, table
+
+
+def write_header(path, src, rows, cols, names, tri_layer, sides):
+    with open(path, 'w') as f:
+        f.write(HEADER.format(src=src))
+        f.write('\n#ifndef KEYMAP_GEN_H_\n#define KEYMAP_GEN_H_\n\n')
+        f.write(f'#define KEYMAP_LAYERS    {len(names)}\n')
+        f.write(f'#define KEYMAP_SIDES     {len(sides)}\n')
+        f.write(f'#define KEYMAP_ROWS      {rows}\n')
+        f.write(f'#define KEYMAP_COLS      {cols}\n')
+        f.write('#define KEYMAP_POSITIONS (KEYMAP_ROWS * KEYMAP_COLS)\n')
+        if tri_layer is not None:
+            f.write('\n')
+            for key, layer in zip(('LOWER', 'RAISE', 'ADJUST'), tri_layer):
+                f.write(f'#define KEYMAP_TRI_LAYER_{key:<6} {layer}\n')
+        if len(sides) > len(SIDES):
+            f.write('\n/* Module IDs of the extra modules. */\n')
+            for i, side in enumerate(sides[len(SIDES):], len(SIDES)):
+                f.write(f'#define KEYMAP_SIDE_{side.upper()} {i}\n')
+        f.write('\n#endif /* KEYMAP_GEN_H_ */\n')
+
+
+def write_source(path, src, names, sides, table):
+    with open(path, 'w') as f:
+        f.write(HEADER.format(src=src))
+        f.write('\n#include <zephyr/kernel.h>\n\n#include "keymap.h"\n\n')
+        f.write('BUILD_ASSERT(KEYMAP_ROWS == CONFIG_KB_MATRIX_ROWS &&\n'
+                '\t     KEYMAP_COLS == CONFIG_KB_MATRIX_COLS,\n'
+                '\t     "Keymap does not match the key matrix");\n')
+        f.write('BUILD_ASSERT(KEYMAP_POSITIONS <= 128,\n'
+                '\t     "Key events carry 7 bit positions");\n')
+        f.write('BUILD_ASSERT(KEYMAP_LAYERS <= 32,\n'
+                '\t     "Layer mask is 32 bits");\n\n')
+        f.write('const struct keymap_action\n'
+                '\tkeymap_table[KEYMAP_LAYERS][KEYMAP_SIDES]'
+                '[KEYMAP_POSITIONS] = {\n')
+        for name, grids in zip(names, table):
+            f.write(f'\t/* {name} */\n\t{{\n')
+            for side, actions in zip(sides, grids):
+                f.write(f'\t\t/* {side} */\n\t\t{{\n')
+                for type_, code, mods in actions:
+                    f.write(f'\t\t\t{{ {type_}, 0x{code:02x}, '
+                            f'0x{mods:02x} }},\n')
+                f.write('\t\t},\n')
+            f.write('\t},\n')
+        f.write('};\n\n')
+        f.write('BUILD_ASSERT(ARRAY_SIZE(keymap_table) == KEYMAP_LAYERS);\n')
+        f.write('BUILD_ASSERT(ARRAY_SIZE(keymap_table[0][0]) == '
+                'KEYMAP_POSITIONS);\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--keymap', required=True,
+                        help='keymap description (YAML)')
+    parser.add_argument('--keys', required=True,
+                        help='header with the KEY_* definitions')
+    parser.add_argument('--output-dir', required=True,
+                        help='directory for keymap_gen.h and keymap_gen.c')
+    args = parser.parse_args()
+
+    src = os.path.basename(args.keymap)
+    try:
+        codes, mods = parse_keys(args.keys)
+        rows, cols, names, tri_layer, sides, table = \
+            parse_keymap(args.keymap, codes, mods)
+    except (KeymapError, KeyError) as e:
+        sys.exit(f'{args.keymap}: {e}')
+
+    os.makedirs(args.output_dir, exist_ok=True)
+    write_header(os.path.join(args.output_dir, 'keymap_gen.h'), src,
+                 rows, cols, names, tri_layer, sides)
+    write_source(os.path.join(args.output_dir, 'keymap_gen.c'), src,
+                 names, sides, table)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2018 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+"""Tests of gen_keymap.py. Run with: pytest scripts/tests"""
+
+import os
+import subprocess
+import sys
+
+import pytest
+import yaml
+
+SCRIPTS = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+APP = os.path.dirname(SCRIPTS)
+sys.path.insert(0, SCRIPTS)
+
+import gen_keymap  # noqa: E402
+from gen_keymap import KeymapError  # noqa: E402
+
+KEYS_H = os.path.join(APP, 'src', 'keys.h')
+KEYMAP_YML = os.path.join(APP, 'keymap.yml')
+
+
+@pytest.fixture(scope='module')
+def keys():
+    return gen_keymap.parse_keys(KEYS_H)
+
+
+def keymap_write(tmp_path, desc):
+    path = tmp_path / 'keymap.yml'
+    path.write_text(yaml.safe_dump(desc))
+    return str(path)
+
+
+def small_keymap(**kw):
+    """A 1x2 keymap with a base and a second layer."""
+    desc = {
+        'rows': 1,
+        'cols': 2,
+        'layers': [
+            {'name': 'base', 'left': [['A', 'MO(1)']],
+             'right': [['B', 'LSHIFT']]},
+            {'name': 'fn', 'left': [['___', 'NONE']],
+             'right': [['LSHIFT+1', '___']]},
+        ],
+    }
+    desc.update(kw)
+    return desc
+
+
+def test_parse_keys(keys):
+    codes, mods = keys
+    assert codes['A'] == 0x04
+    assert codes['1'] == 0x1e
+    assert codes['SPACE'] == 0x2c
+    assert mods['LCTRL'] == 0x01
+    assert mods['LSHIFT'] == 0x02
+    assert mods['RMETA'] == 0x80
+    assert 'MOD_LSHIFT' not in codes
+
+
+@pytest.mark.parametrize('entry, action', [
+    ('NONE', ('KEYMAP_ACT_NONE', 0, 0)),
+    ('___', ('KEYMAP_ACT_TRANS', 0, 0)),
+    ('MO(3)', ('KEYMAP_ACT_LAYER', 3, 0)),
+    ('A', ('KEYMAP_ACT_KEY', 0x04, 0)),
+    ('LSHIFT+1', ('KEYMAP_ACT_KEY', 0x1e, 0x02)),
+    ('LCTRL+LALT+DELETE', ('KEYMAP_ACT_KEY', 0x4c, 0x05)),
+    ('RALT', ('KEYMAP_ACT_MOD', 0, 0x40)),
+    # YAML reads a bare digit as a number.
+    (1, ('KEYMAP_ACT_KEY', 0x1e, 0)),
+])
+def test_parse_entry(keys, entry, action):
+    codes, mods = keys
+    assert gen_keymap.parse_entry(entry, codes, mods, 4) == action
+
+
+@pytest.mark.parametrize('entry, error', [
+    ('NOPE', 'unknown key NOPE'),
+    ('HYPER+A', 'unknown modifier HYPER'),
+    ('LSHIFT+LCTRL', 'cannot be combined'),
+    ('MO(0)', 'no layer 0'),
+    ('MO(4)', 'no layer 4'),
+])
+def test_parse_entry_error(keys, entry, error):
+    codes, mods = keys
+    with pytest.raises(KeymapError, match=error):
+        gen_keymap.parse_entry(entry, codes, mods, 4)
+
+
+def test_parse_keymap(keys):
+    rows, cols, names, tri_layer, sides, table = \
+        gen_keymap.parse_keymap(KEYMAP_YML, *keys)
+
+    assert (rows, cols) == (4, 6)
+    assert names == ['base', 'lower', 'raise', 'adjust']
+    assert tri_layer == [1, 2, 3]
+    assert sides == ['left', 'right']
+    assert len(table) == len(names)
+    for grids in table:
+        assert len(grids) == len(sides)
+        for actions in grids:
+            assert len(actions) == rows * cols
+
+    # Positions count along the rows.
+    assert table[0][0][0] == ('KEYMAP_ACT_KEY', 0x2b, 0)      # TAB
+    assert table[0][0][6] == ('KEYMAP_ACT_MOD', 0, 0x01)      # LCTRL
+    assert table[0][0][22] == ('KEYMAP_ACT_LAYER', 1, 0)      # MO(1)
+    assert table[2][0][1] == ('KEYMAP_ACT_KEY', 0x1e, 0x02)   # LSHIFT+1
+    assert table[1][1][23] == ('KEYMAP_ACT_TRANS', 0, 0)
+
+
+@pytest.mark.parametrize('desc, error', [
+    (small_keymap(rows=0), 'positions'),
+    (small_keymap(rows=16, cols=9), 'positions'),
+    (small_keymap(sides=['right', 'left']), 'expected left, right'),
+    (small_keymap(sides=['left', 'right', 'left']), 'unique'),
+    (small_keymap(tri_layer=[1, 1]), 'tri_layer'),
+    (small_keymap(tri_layer=[0, 1, 1]), 'tri_layer'),
+    (small_keymap(layers=[]), '0 layers'),
+    (small_keymap(layers=[{'left': [['___', 'A']],
+                           'right': [['A', 'B']]}]),
+     'base layer cannot be transparent'),
+    (small_keymap(layers=[{'left': [['A']], 'right': [['A', 'B']]}]),
+     'left side is not 1x2'),
+    (small_keymap(sides=['left', 'right', 'numpad']),
+     'numpad side is not 1x2'),
+    (small_keymap(layers=[{'left': [['A', 'MO(1)']],
+                           'right': [['A', 'B']]}]),
+     'layer 0, left row 0 column 1: MO\\(1\\): no layer 1'),
+])
+def test_parse_keymap_error(tmp_path, keys, desc, error):
+    path = keymap_write(tmp_path, desc)
+    with pytest.raises(KeymapError, match=error):
+        gen_keymap.parse_keymap(path, *keys)
+
+
+def run(keymap, out):
+    return subprocess.run([sys.executable,
+                           os.path.join(SCRIPTS, 'gen_keymap.py'),
+                           '--keymap', keymap, '--keys', KEYS_H,
+                           '--output-dir', str(out)],
+                          capture_output=True, text=True)
+
+
+def test_generate(tmp_path):
+    desc = small_keymap(sides=['left', 'right', 'numpad'], tri_layer=None)
+    for layer in desc['layers']:
+        layer['numpad'] = [['NONE', 'NONE']]
+    del desc['tri_layer']
+    out = tmp_path / 'gen'
+
+    res = run(keymap_write(tmp_path, desc), out)
+    assert res.returncode == 0, res.stderr
+
+    header = (out / 'keymap_gen.h').read_text()
+    assert '#define KEYMAP_LAYERS    2\n' in header
+    assert '#define KEYMAP_SIDES     3\n' in header
+    assert '#define KEYMAP_ROWS      1\n' in header
+    assert '#define KEYMAP_COLS      2\n' in header
+    assert '#define KEYMAP_SIDE_NUMPAD 2\n' in header
+    assert 'KEYMAP_TRI_LAYER' not in header
+
+    source = (out / 'keymap_gen.c').read_text()
+    assert source.count('{ KEYMAP_ACT_') == 2 * 3 * 2
+    assert '{ KEYMAP_ACT_KEY, 0x04, 0x00 },\n' in source
+    assert '{ KEYMAP_ACT_LAYER, 0x01, 0x00 },\n' in source
+    assert '{ KEYMAP_ACT_MOD, 0x00, 0x02 },\n' in source
+    assert '{ KEYMAP_ACT_KEY, 0x1e, 0x02 },\n' in source
+
+
+def test_generate_shipped(tmp_path):
+    res = run(KEYMAP_YML, tmp_path)
+    assert res.returncode == 0, res.stderr
+
+    header = (tmp_path / 'keymap_gen.h').read_text()
+    assert '#define KEYMAP_TRI_LAYER_LOWER  1\n' in header
+    assert '#define KEYMAP_TRI_LAYER_ADJUST 3\n' in header
+
+
+def test_generate_error(tmp_path):
+    desc = small_keymap()
+    desc['layers'][1]['right'][0][0] = 'LSHIFT+NOPE'
+    out = tmp_path / 'gen'
+
+    res = run(keymap_write(tmp_path, desc), out)
+    assert res.returncode != 0
+    assert 'layer fn, right row 0 column 0' in res.stderr
+    assert not out.exists()
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Background work queue
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+
+#include "bg_work.h"
+
+static K_THREAD_STACK_DEFINE(bg_work_stack, CONFIG_KB_BG_WORK_STACK_SIZE);
+static struct k_work_q bg_work_q;
+
+int bg_work_submit(struct k_work *work)
+{
+	return k_work_submit_to_queue(&bg_work_q, work);
+}
+
+static int bg_work_init(const struct device *dev)
+{
+	const struct k_work_queue_config cfg = {
+		.name = "bg_work",
+	};
+
+	ARG_UNUSED(dev);
+
+	k_work_queue_start(&bg_work_q, bg_work_stack,
+			   K_THREAD_STACK_SIZEOF(bg_work_stack),
+			   CONFIG_KB_BG_WORK_PRIORITY, &cfg);
+
+	return 0;
+}
+
+SYS_INIT(bg_work_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
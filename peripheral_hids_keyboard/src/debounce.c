@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Bit-parallel key debouncing
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+
+#include "debounce.h"
+
+#ifdef CONFIG_KB_DEBOUNCE_EAGER
+/* The edge scan counts as one, the key is ignored for the scans after
+ * it.
+ */
+#define CNT_DONE (CONFIG_KB_DEBOUNCE_SCANS + 1)
+#else
+#define CNT_DONE CONFIG_KB_DEBOUNCE_SCANS
+#endif
+
+BUILD_ASSERT(CNT_DONE < BIT(DEBOUNCE_CNT_BITS),
+	     "Debounce counter too small");
+
+/* Add one to the counters of the keys in mask, in key word w. */
+static void cnt_inc(struct debounce *db, size_t w, uint32_t mask)
+{
+	uint32_t carry = mask;
+
+	for (int i = 0; i < DEBOUNCE_CNT_BITS; i++) {
+		uint32_t bit = db->cnt[i][w];
+
+		db->cnt[i][w] = bit ^ carry;
+		carry &= bit;
+	}
+}
+
+/* Keep only the counters of the keys in mask, in key word w. */
+static void cnt_keep(struct debounce *db, size_t w, uint32_t mask)
+{
+	for (int i = 0; i < DEBOUNCE_CNT_BITS; i++) {
+		db->cnt[i][w] &= mask;
+	}
+}
+
+/* Keys of word w whose counter has reached CNT_DONE. */
+static uint32_t cnt_done(const struct debounce *db, size_t w)
+{
+	uint32_t eq = UINT32_MAX;
+
+	for (int i = 0; i < DEBOUNCE_CNT_BITS; i++) {
+		eq &= (CNT_DONE & BIT(i)) ?
+		      db->cnt[i][w] : ~db->cnt[i][w];
+	}
+
+	return eq;
+}
+
+/* Keys of word w whose counter is not zero. */
+static uint32_t cnt_busy(const struct debounce *db, size_t w)
+{
+	uint32_t busy = 0;
+
+	for (int i = 0; i < DEBOUNCE_CNT_BITS; i++) {
+		busy |= db->cnt[i][w];
+	}
+
+	return busy;
+}
+
+void debounce_init(struct debounce *db)
+{
+	memset(db, 0, sizeof(*db));
+}
+
+#ifdef CONFIG_KB_DEBOUNCE_EAGER
+const struct keyset *debounce_update(struct debounce *db,
+				     const struct keyset *raw)
+{
+	for (size_t w = 0; w < KEYSET_WORDS; w++) {
+		uint32_t locked = cnt_busy(db, w);
+		uint32_t edge = (raw->word[w] ^ db->state.word[w]) & ~locked;
+
+		/* Report the edge now and lock the key out for the next
+		 * scans.
+		 */
+		db->state.word[w] ^= edge;
+		cnt_inc(db, w, locked | edge);
+		cnt_keep(db, w, ~cnt_done(db, w));
+	}
+
+	return &db->state;
+}
+#else
+const struct keyset *debounce_update(struct debounce *db,
+				     const struct keyset *raw)
+{
+	for (size_t w = 0; w < KEYSET_WORDS; w++) {
+		uint32_t diff = raw->word[w] ^ db->state.word[w];
+		uint32_t done;
+
+		/* A key that bounces back restarts its count. */
+		cnt_keep(db, w, diff);
+		cnt_inc(db, w, diff);
+
+		done = cnt_done(db, w) & diff;
+		db->state.word[w] ^= done;
+		cnt_keep(db, w, ~done);
+	}
+
+	return &db->state;
+}
+#endif /* CONFIG_KB_DEBOUNCE_EAGER */
+
+bool debounce_is_settled(const struct debounce *db)
+{
+	for (size_t w = 0; w < KEYSET_WORDS; w++) {
+		if (cnt_busy(db, w)) {
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Key event merge buffer
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/sys/util.h>
+
+#include "evt_merge.h"
+
+/* Key events waiting to be applied, oldest first by the time they
+ * happened on the keyboard.
+ */
+static struct hid_evt merge_buf[2 * CONFIG_KB_HID_EVT_QUEUE_SIZE];
+static size_t merge_cnt;
+static uint8_t local;
+static evt_merge_handler_t merge_handler;
+
+void evt_merge_init(uint8_t local_side, evt_merge_handler_t handler)
+{
+	local = local_side;
+	merge_handler = handler;
+	merge_cnt = 0;
+}
+
+void evt_merge_insert(const struct hid_evt *evt)
+{
+	size_t i;
+
+	if (merge_cnt == ARRAY_SIZE(merge_buf)) {
+		/* Full, stop waiting for the oldest event. */
+		merge_handler(&merge_buf[0]);
+		merge_cnt--;
+		memmove(merge_buf, &merge_buf[1],
+			merge_cnt * sizeof(merge_buf[0]));
+	}
+
+	/* Events of the same time keep their arrival order. */
+	for (i = merge_cnt; i > 0; i--) {
+		if ((int32_t)(evt->time - merge_buf[i - 1].time) >= 0) {
+			break;
+		}
+		merge_buf[i] = merge_buf[i - 1];
+	}
+	merge_buf[i] = *evt;
+	merge_cnt++;
+}
+
+int32_t evt_merge_release(uint32_t now, uint32_t window, bool hold_all)
+{
+	int32_t wait = 0;
+	size_t cnt;
+
+	for (cnt = 0; cnt < merge_cnt; cnt++) {
+		const struct hid_evt *evt = &merge_buf[cnt];
+
+		/* Module events arrive in order and local events right
+		 * away, so with one module only a local event can be
+		 * overtaken by an older one.
+		 */
+		wait = window - (int32_t)(now - evt->time);
+		if ((hold_all || evt->side == local) && wait > 0) {
+			break;
+		}
+		merge_handler(evt);
+	}
+
+	merge_cnt -= cnt;
+	memmove(merge_buf, &merge_buf[cnt], merge_cnt * sizeof(merge_buf[0]));
+
+	return merge_cnt ? wait : 0;
+}
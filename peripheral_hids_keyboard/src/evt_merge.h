@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_EVT_MERGE_H_
+#define KB_EVT_MERGE_H_
+
+/**@file
+ * @defgroup kb_evt_merge Key event merge API
+ * @{
+ * @brief Orders the key events of all sides by the time they happened.
+ *
+ * Key events of the modules reach this half up to a connection interval
+ * late, so an event of this half is held for a merge window in case an
+ * older module event is still on its way. With several modules, their
+ * events are held as well, as the events of one module can overtake the
+ * older events of another. Events are applied oldest first.
+ *
+ * Used by the HID thread only.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+
+/** @brief Key change of any side. */
+struct hid_evt {
+	/** Time of the change on this half's clock, bt_kbds_time_get(). */
+	uint32_t time;
+	/** Key position. */
+	uint8_t position;
+	/** Keymap side, the module ID of the sender. */
+	uint8_t side;
+	/** True for a press, false for a release. */
+	bool pressed;
+};
+
+/** @brief Callback type for applying a key event.
+ *
+ * @param evt Key event that is due.
+ */
+typedef void (*evt_merge_handler_t)(const struct hid_evt *evt);
+
+/** @brief Initialize the merge buffer.
+ *
+ * @param local_side Keymap side of this half, its events arrive right
+ *                   away.
+ * @param handler    Called for every event, in time order.
+ */
+void evt_merge_init(uint8_t local_side, evt_merge_handler_t handler);
+
+/** @brief Add a key event.
+ *
+ * Events of the same time keep their order. A full buffer stops waiting
+ * for its oldest event and applies it.
+ *
+ * @param evt Key event.
+ */
+void evt_merge_insert(const struct hid_evt *evt);
+
+/** @brief Apply the key events that are due.
+ *
+ * @param now      Current time, on the clock of the event times.
+ * @param window   Merge window, in the units of the event times. 0
+ *                 applies every event right away.
+ * @param hold_all True to hold the module events as well, when several
+ *                 modules are connected.
+ *
+ * @return Time the oldest of the remaining events still has to wait, or 0
+ *         if no event is left.
+ */
+int32_t evt_merge_release(uint32_t now, uint32_t window, bool hold_all);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_EVT_MERGE_H_ */
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief HID keyboard report encoding
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <string.h>
+#include <zephyr/sys/math_extras.h>
+#include <zephyr/sys/util.h>
+
+#include "hid_report.h"
+
+/* Current report map construction requires exactly 8 buttons */
+BUILD_ASSERT((KEY_CTRL_CODE_MAX - KEY_CTRL_CODE_MIN) + 1 == 8);
+
+#define SCAN_CODE_POS 2
+
+/** @brief Change key code to ctrl code mask
+ *
+ *  Function changes the key code to the mask in the control code
+ *  field inside the raport.
+ *  Returns 0 if key code is not a control key.
+ *
+ *  @param key Key code
+ *
+ *  @return Mask of the control key or 0.
+ */
+static uint8_t button_ctrl_code(uint8_t key)
+{
+	if (KEY_CTRL_CODE_MIN <= key && key <= KEY_CTRL_CODE_MAX) {
+		return (uint8_t)(1U << (key - KEY_CTRL_CODE_MIN));
+	}
+	return 0;
+}
+
+int hid_report_key_write(struct keyboard_state *state, uint8_t key,
+			 bool pressed)
+{
+	uint8_t ctrl_mask = button_ctrl_code(key);
+
+	if (ctrl_mask) {
+		if (pressed) {
+			state->ctrl_keys_state |= ctrl_mask;
+		} else {
+			state->ctrl_keys_state &= ~ctrl_mask;
+		}
+		return 0;
+	}
+	if (key == 0) {
+		return 0;
+	}
+	if (key > KEY_BITMAP_USAGE_MAX) {
+		return -EINVAL;
+	}
+
+	WRITE_BIT(state->keys_bitmap[key / 8], key % 8, pressed);
+	return 0;
+}
+
+void hid_report_key_array_fill(const struct keyboard_state *state,
+			       uint8_t usage_max, uint8_t *keys)
+{
+	size_t cnt = 0;
+
+	memset(keys, 0, KEY_PRESS_MAX);
+
+	for (size_t i = 0; i < KEY_BITMAP_LEN && i <= usage_max / 8; i++) {
+		uint8_t bits = state->keys_bitmap[i];
+
+		if (i == usage_max / 8) {
+			bits &= BIT_MASK(usage_max % 8 + 1);
+		}
+
+		while (bits) {
+			if (cnt == KEY_PRESS_MAX) {
+				memset(keys, KEY_ERR_ROLLOVER, KEY_PRESS_MAX);
+				return;
+			}
+			keys[cnt++] = i * 8 + u32_count_trailing_zeros(bits);
+			bits &= bits - 1;
+		}
+	}
+}
+
+size_t hid_report_encode(const struct keyboard_state *state, bool boot_mode,
+			 uint8_t *data)
+{
+	data[0] = state->ctrl_keys_state;
+	data[1] = 0;
+
+	/* The boot report layout is fixed, with usages up to KEY_CODE_MAX. */
+	if (boot_mode) {
+		hid_report_key_array_fill(state, KEY_CODE_MAX,
+					  &data[SCAN_CODE_POS]);
+		return BOOT_REPORT_KEYS_LEN;
+	}
+
+#if defined(CONFIG_KB_HID_NKRO)
+	memcpy(&data[SCAN_CODE_POS], state->keys_bitmap, KEY_BITMAP_LEN);
+#else
+	hid_report_key_array_fill(state, KEY_BITMAP_USAGE_MAX,
+				  &data[SCAN_CODE_POS]);
+#endif
+
+	return INPUT_REPORT_KEYS_MAX_LEN;
+}
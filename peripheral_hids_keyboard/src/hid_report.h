@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_HID_REPORT_H_
+#define KB_HID_REPORT_H_
+
+/**@file
+ * @defgroup kb_hid_report HID keyboard report API
+ * @{
+ * @brief Keyboard state and its input report encodings.
+ *
+ * The held keys are kept as a bitmap over usages 0 to
+ * KEY_BITMAP_USAGE_MAX, so setting or clearing a key is one bit
+ * operation. With CONFIG_KB_HID_NKRO the report mode input report carries
+ * the bitmap itself. The boot report, and the report mode one without
+ * NKRO, list up to KEY_PRESS_MAX keys.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Note: The configuration below is the same as BOOT mode configuration
+ * This simplifies the code as the BOOT mode is the same as REPORT mode.
+ * Changing this configuration would require separate implementation of
+ * BOOT mode report generation.
+ */
+#define KEY_CTRL_CODE_MIN 224 /* Control key codes - required 8 of them */
+#define KEY_CTRL_CODE_MAX 231 /* Control key codes - required 8 of them */
+#define KEY_CODE_MIN      0   /* Normal key codes */
+#define KEY_CODE_MAX      101 /* Normal key codes */
+#define KEY_PRESS_MAX     6   /* Maximum number of non-control keys
+			       * in a 6KRO report
+			       */
+#define KEY_ERR_ROLLOVER  0x01 /* Reported in every slot when more than
+				* KEY_PRESS_MAX keys are held
+				*/
+
+/* Last usage of the NKRO key bitmap. Keeps the report within the payload
+ * of a default 23 byte ATT MTU.
+ */
+#define KEY_BITMAP_USAGE_MAX 0x7F
+#define KEY_BITMAP_LEN       ((KEY_BITMAP_USAGE_MAX + 1) / 8)
+
+/* Number of bytes in the boot report
+ *
+ * 1B - control keys
+ * 1B - reserved
+ * rest - non-control keys
+ */
+#define BOOT_REPORT_KEYS_LEN (1 + 1 + KEY_PRESS_MAX)
+
+/* Number of bytes in key report
+ *
+ * 1B - control keys
+ * 1B - reserved
+ * rest - key bitmap (NKRO) or non-control keys (6KRO)
+ */
+#if defined(CONFIG_KB_HID_NKRO)
+#define INPUT_REPORT_KEYS_MAX_LEN (1 + 1 + KEY_BITMAP_LEN)
+#else
+#define INPUT_REPORT_KEYS_MAX_LEN BOOT_REPORT_KEYS_LEN
+#endif
+
+/** @brief Keys held on the keyboard. */
+struct keyboard_state {
+	uint8_t ctrl_keys_state; /* Current keys state */
+	uint8_t keys_bitmap[KEY_BITMAP_LEN];
+};
+
+/** @brief Set or clear a key in the keyboard state.
+ *
+ * Control key usages set their bit of the control byte. Usage 0 means no
+ * key and is ignored.
+ *
+ * @param state   Keyboard state.
+ * @param key     Key code.
+ * @param pressed True to set the key, false to clear it.
+ *
+ * @retval 0       If the operation was successful.
+ * @retval -EINVAL If the key cannot be reported.
+ */
+int hid_report_key_write(struct keyboard_state *state, uint8_t key,
+			 bool pressed);
+
+/** @brief Fill a 6KRO key array from the key bitmap.
+ *
+ * Keys are listed in usage order. If more than KEY_PRESS_MAX keys are
+ * held every slot reports ErrorRollOver, as the HID specification asks.
+ * Keys above the last usage of the array are left out, the host would
+ * discard them.
+ *
+ * @param state     Keyboard state.
+ * @param usage_max Last usage the array declares.
+ * @param keys      KEY_PRESS_MAX bytes to fill.
+ */
+void hid_report_key_array_fill(const struct keyboard_state *state,
+			       uint8_t usage_max, uint8_t *keys);
+
+/** @brief Encode the keyboard state as an input report.
+ *
+ * @param state     Keyboard state.
+ * @param boot_mode True for the boot report, false for the report mode
+ *                  one.
+ * @param data      Buffer of at least
+ *                  MAX(INPUT_REPORT_KEYS_MAX_LEN, BOOT_REPORT_KEYS_LEN)
+ *                  bytes.
+ *
+ * @return Length of the report.
+ */
+size_t hid_report_encode(const struct keyboard_state *state, bool boot_mode,
+			 uint8_t *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_HID_REPORT_H_ */
@@ -12,9 +12,9 @@
 #include <stddef.h>
 #include <string.h>
 #include <errno.h>
-#include <zephyr/sys/printk.h>
 #include <zephyr/sys/byteorder.h>
 #include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
 
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/hci.h>
@@ -24,21 +24,75 @@
 
 //#include <bluetooth/services/kbds.h>
 #include "kbds.h"
+#include "trace.h"
 
 #include <zephyr/logging/log.h>
 #define CONFIG_BT_KBDS_POLL_BUTTON
-//LOG_MODULE_REGISTER(bt_kbds, CONFIG_BT_KBDS_LOG_LEVEL);
+LOG_MODULE_REGISTER(bt_kbds, CONFIG_BT_KBDS_LOG_LEVEL);
+
+BUILD_ASSERT(KEYSET_KEYS <= BT_KBDS_EVT_POS_MASK + 1,
+	     "Key positions do not fit a key event");
+BUILD_ASSERT(CONFIG_BT_KBDS_MODULE_ID != BT_KBDS_MODULE_INVALID,
+	     "Module ID is reserved");
+
+/* Index of the Key Event Characteristic value in the service. */
+#define KBDS_EVT_ATTR_IDX 5
+
+/* Retry time of a notification that found no TX buffer. Buffers can be
+ * taken by other traffic, so a sent key event may not free one.
+ */
+#define EVT_RETRY_MS 1
+
+/* Queued key event. */
+struct kbds_evt {
+	/* Key position and BT_KBDS_EVT_PRESSED. */
+	uint8_t pos_flags;
+	/* Sequence number. */
+	uint8_t seq;
+	/* Time of the event, bt_kbds_time_get(). */
+	uint32_t time;
+};
+
+K_MSGQ_DEFINE(kbds_evt_queue, sizeof(struct kbds_evt),
+	      CONFIG_BT_KBDS_EVT_QUEUE_SIZE, 4);
 
 static uint32_t                   notify_enabled;
-static uint32_t                   keystate;
+static uint32_t                   evt_notify_enabled;
+static struct keyset              keystate;
+static uint8_t                    keystate_seq;
+static uint8_t                    evt_seq;
 static struct bt_kbds_cb       kbds_cb;
 
+/* Events taken from the queue that are not sent yet. */
+static struct kbds_evt            evt_pending[CONFIG_BT_KBDS_EVT_BATCH_MAX];
+static size_t                     evt_pending_cnt;
+static struct k_work_delayable    evt_work;
+/* Numbers and queues key events, so every number taken is in the queue
+ * or counted as lost.
+ */
+static struct k_spinlock          evt_lock;
+/* Key events were dropped. Unless a later event tells the peer by the
+ * gap in the numbers, an event notification without events does.
+ */
+static atomic_t                   evt_lost;
+
 static void kbdslc_ccc_cfg_changed(const struct bt_gatt_attr *attr,
 				  uint16_t value)
 {
 	notify_enabled = (value == BT_GATT_CCC_NOTIFY);
 }
 
+static void kbds_evt_ccc_cfg_changed(const struct bt_gatt_attr *attr,
+				     uint16_t value)
+{
+	evt_notify_enabled = (value == BT_GATT_CCC_NOTIFY);
+	if (!evt_notify_enabled) {
+		k_msgq_purge(&kbds_evt_queue);
+		evt_pending_cnt = 0;
+		atomic_clear(&evt_lost);
+	}
+}
+
 
 #ifdef CONFIG_BT_KBDS_POLL_BUTTON
 static ssize_t read_button(struct bt_conn *conn,
@@ -47,15 +101,17 @@ static ssize_t read_button(struct bt_conn *conn,
 			  uint16_t len,
 			  uint16_t offset)
 {
-	const char *value = attr->user_data;
+	uint8_t value[BT_KBDS_MODULE_LEN + BT_KBDS_KEYSTATE_LEN];
 
-	//LOG_DBG("Attribute read, handle: %u, conn: %p", attr->handle,
-		//(void *)conn);
+	LOG_DBG("Attribute read, handle: %u, conn: %p", attr->handle,
+		(void *)conn);
 
 	if (kbds_cb.button_cb) {
-		keystate = kbds_cb.button_cb();
+		kbds_cb.button_cb(&keystate);
+		value[0] = CONFIG_BT_KBDS_MODULE_ID;
+		keyset_to_bytes(&keystate, &value[BT_KBDS_MODULE_LEN]);
 		return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
-					 sizeof(*value));
+					 sizeof(value));
 	}
 
 	return 0;
@@ -77,24 +133,212 @@ BT_GATT_PRIMARY_SERVICE(BT_UUID_KBDS),
 #endif
 	BT_GATT_CCC(kbdslc_ccc_cfg_changed,
 		    BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	BT_GATT_CHARACTERISTIC(BT_UUID_KBDS_EVENT, BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(kbds_evt_ccc_cfg_changed,
+		    BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
 );
 
+static void evt_sent(struct bt_conn *conn, void *user_data)
+{
+	if (k_msgq_num_used_get(&kbds_evt_queue) || evt_pending_cnt ||
+	    atomic_get(&evt_lost)) {
+		k_work_reschedule(&evt_work, K_NO_WAIT);
+	}
+}
+
+static void conn_mtu_min(struct bt_conn *conn, void *data)
+{
+	uint16_t *mtu = data;
+
+	*mtu = MIN(*mtu, bt_gatt_get_mtu(conn));
+}
+
+/* Number of key events that fit one notification on every link. */
+static size_t evt_batch_max(void)
+{
+	uint16_t mtu = UINT16_MAX;
+	size_t max;
+
+	bt_conn_foreach(BT_CONN_TYPE_LE, conn_mtu_min, &mtu);
+	max = (mtu - 3 - BT_KBDS_EVT_HDR_LEN) / BT_KBDS_EVT_LEN;
+
+	return CLAMP(max, 1, ARRAY_SIZE(evt_pending));
+}
+
+/* Send the number of the next key event once all queued events are
+ * sent, so the peer resyncs right away instead of on its next event.
+ */
+static void evt_lost_send(void)
+{
+	uint8_t data[BT_KBDS_EVT_HDR_LEN];
+	struct bt_gatt_notify_params params = { 0 };
+	k_spinlock_key_t key;
+	int err;
+
+	key = k_spin_lock(&evt_lock);
+	if (!atomic_get(&evt_lost) ||
+	    k_msgq_num_used_get(&kbds_evt_queue)) {
+		k_spin_unlock(&evt_lock, key);
+		return;
+	}
+	atomic_clear(&evt_lost);
+	data[0] = evt_seq;
+	k_spin_unlock(&evt_lock, key);
+
+	data[BT_KBDS_SEQ_LEN] = CONFIG_BT_KBDS_MODULE_ID;
+	sys_put_le32(bt_kbds_time_get(),
+		     &data[BT_KBDS_SEQ_LEN + BT_KBDS_MODULE_LEN]);
+
+	params.attr = &kbds_svc.attrs[KBDS_EVT_ATTR_IDX];
+	params.data = data;
+	params.len = sizeof(data);
+	params.func = evt_sent;
+
+	err = bt_gatt_notify_cb(NULL, &params);
+	if (err) {
+		atomic_set(&evt_lost, true);
+	}
+	if (err == -ENOMEM) {
+		k_work_schedule(&evt_work, K_MSEC(EVT_RETRY_MS));
+	} else if (err) {
+		/* The next key event shows the gap instead. */
+		LOG_ERR("Lost key event notification failed (err %d)", err);
+	}
+}
+
+static void evt_send_fn(struct k_work *work)
+{
+	uint8_t data[BT_KBDS_EVT_HDR_LEN +
+		     CONFIG_BT_KBDS_EVT_BATCH_MAX * BT_KBDS_EVT_LEN];
+	struct bt_gatt_notify_params params = { 0 };
+	uint32_t now = bt_kbds_time_get();
+	uint8_t *evt_data = data;
+	size_t max = evt_batch_max();
+	size_t cnt = 1;
+	int err;
+
+	while (evt_pending_cnt < ARRAY_SIZE(evt_pending) &&
+	       !k_msgq_get(&kbds_evt_queue, &evt_pending[evt_pending_cnt],
+			   K_NO_WAIT)) {
+		evt_pending_cnt++;
+	}
+
+	if (!evt_pending_cnt) {
+		evt_lost_send();
+		return;
+	}
+
+	/* Events in one notification must have consecutive numbers. */
+	while (cnt < MIN(evt_pending_cnt, max) &&
+	       evt_pending[cnt].seq == (uint8_t)(evt_pending[0].seq + cnt)) {
+		cnt++;
+	}
+
+	*evt_data++ = evt_pending[0].seq;
+	*evt_data++ = CONFIG_BT_KBDS_MODULE_ID;
+	sys_put_le32(now, evt_data);
+	evt_data += sizeof(uint32_t);
+	for (size_t i = 0; i < cnt; i++) {
+		uint32_t age = now - evt_pending[i].time;
+
+		*evt_data++ = evt_pending[i].pos_flags;
+		sys_put_le16(MIN(age, UINT16_MAX), evt_data);
+		evt_data += sizeof(uint16_t);
+	}
+
+	params.attr = &kbds_svc.attrs[KBDS_EVT_ATTR_IDX];
+	params.data = data;
+	params.len = evt_data - data;
+	params.func = evt_sent;
+
+	err = bt_gatt_notify_cb(NULL, &params);
+	if (err == -ENOMEM) {
+		/* Out of buffers, retry after a while or as soon as a key
+		 * event notification has been sent.
+		 */
+		k_work_schedule(&evt_work, K_MSEC(EVT_RETRY_MS));
+		return;
+	}
+	if (err) {
+		LOG_ERR("Key event notification failed (err %d)", err);
+		atomic_set(&evt_lost, true);
+	} else {
+		for (size_t i = 0; i < cnt; i++) {
+			trace_key(TRACE_KBDS_NOTIFY, CONFIG_BT_KBDS_MODULE_ID,
+				  evt_pending[i].pos_flags &
+				  BT_KBDS_EVT_POS_MASK);
+		}
+	}
+
+	evt_pending_cnt -= cnt;
+	memmove(evt_pending, &evt_pending[cnt],
+		evt_pending_cnt * sizeof(evt_pending[0]));
+	if (evt_pending_cnt || k_msgq_num_used_get(&kbds_evt_queue) ||
+	    atomic_get(&evt_lost)) {
+		k_work_reschedule(&evt_work, K_NO_WAIT);
+	}
+}
+
 int bt_kbds_init(struct bt_kbds_cb *callbacks)
 {
 	if (callbacks) {
 		kbds_cb.button_cb = callbacks->button_cb;
 	}
 
+	k_work_init_delayable(&evt_work, evt_send_fn);
+
 	return 0;
 }
 
-int bt_kbds_send_keystate(uint32_t keystate)
+int bt_kbds_send_keystate(const struct keyset *keystate)
 {
+	uint8_t data[BT_KBDS_SEQ_LEN + BT_KBDS_MODULE_LEN +
+		     BT_KBDS_KEYSTATE_LEN];
+
 	if (!notify_enabled) {
 		return -EACCES;
 	}
 
+	data[0] = keystate_seq++;
+	data[BT_KBDS_SEQ_LEN] = CONFIG_BT_KBDS_MODULE_ID;
+	keyset_to_bytes(keystate,
+			&data[BT_KBDS_SEQ_LEN + BT_KBDS_MODULE_LEN]);
+
 	return bt_gatt_notify(NULL, &kbds_svc.attrs[2],
-			      &keystate,
-			      sizeof(keystate));
+			      data,
+			      sizeof(data));
+}
+
+int bt_kbds_send_key_event(uint8_t position, bool pressed)
+{
+	struct kbds_evt evt = {
+		.pos_flags = (position & BT_KBDS_EVT_POS_MASK) |
+			     (pressed ? BT_KBDS_EVT_PRESSED : 0),
+		.time = bt_kbds_time_get(),
+	};
+	k_spinlock_key_t key;
+	int err;
+
+	if (!evt_notify_enabled) {
+		return -EACCES;
+	}
+
+	/* A dropped event keeps its number, the peer sees the gap. */
+	key = k_spin_lock(&evt_lock);
+	evt.seq = evt_seq++;
+	err = k_msgq_put(&kbds_evt_queue, &evt, K_NO_WAIT);
+	if (err) {
+		atomic_set(&evt_lost, true);
+	}
+	k_spin_unlock(&evt_lock, key);
+
+	if (err) {
+		/* The queue is full, so the send work is pending already. */
+		return -ENOMEM;
+	}
+
+	k_work_reschedule(&evt_work, K_NO_WAIT);
+
+	return 0;
 }
@@ -22,53 +22,106 @@
 
 #include "kbds.h"
 
-/**
- * @brief Value that shows that the battery level is invalid.
- *
- * This value is stored in the KBDS Client object when the battery level
- * information is unknown.
- *
- * The same value is used to mark the fact that a notification has been
- * aborted (see @ref bt_kbds_notify_cb).
- */
-#define BT_KBDS_VAL_INVALID (255)
-
-/**
- * @brief Maximum allowed value for battery level.
- *
- * Any value above that limit is treated as invalid.
- */
-#define BT_KBDS_VAL_MAX (100)
-
 struct bt_kbds_client;
 
+/** @brief Size of the GATT database hash of the server. */
+#define BT_KBDS_DB_HASH_LEN 16
+
 /**
  * @brief Value notification callback.
  *
  * This function is called every time the server sends a notification
  * for a changed value.
  *
- * @param kbds           KBDS Client object.
- * @param keystates The notified battery level value, or
- *                      @ref BT_KBDS_VAL_INVALID if the notification
- *                      was interrupted by the server
- *                      (NULL received from the stack).
+ * @param kbds      KBDS Client object.
+ * @param keystates The notified key state, or NULL if the notification
+ *                  was interrupted by the server (NULL received from the
+ *                  stack).
  */
 typedef void (*bt_kbds_notify_cb)(struct bt_kbds_client *kbds,
-				 uint32_t keystates);
+				  const struct keyset *keystates);
 
 /**
  * @brief Read complete callback.
  *
  * This function is called when the read operation finishes.
  *
- * @param kbds           KBDS Client object.
- * @param keystates The battery level value that was read.
- * @param err           ATT error code or 0.
+ * @param kbds      KBDS Client object.
+ * @param keystates The key state that was read, or NULL on error.
+ * @param err       ATT error code or 0.
  */
 typedef void (*bt_kbds_read_cb)(struct bt_kbds_client *kbds,
-			       uint32_t keystates,
-			       int err);
+				const struct keyset *keystates,
+				int err);
+
+/**
+ * @brief Key event notification callback.
+ *
+ * This function is called once for every key event, in the order in which
+ * the server reported them. The time of the event is converted to the
+ * client clock. Events generated by a resync read are timed when the read
+ * completes.
+ *
+ * @param kbds KBDS Client object.
+ * @param evt  The key event.
+ */
+typedef void (*bt_kbds_key_evt_cb)(struct bt_kbds_client *kbds,
+				   const struct bt_kbds_key_evt *evt);
+
+/**
+ * @brief Cached handle lookup callback.
+ *
+ * @param kbds KBDS Client object.
+ * @param err  0 if the handles were assigned from the cache.
+ *             -ENOENT if no handles are cached for the server.
+ *             -ESTALE if the database of the server changed since, or a
+ *             subscription with the cached handles failed. This can
+ *             follow a call with 0, once per connection.
+ *             -ENOTSUP if the server has no database hash.
+ *             Otherwise, a (negative) error code of the hash read.
+ *             Run discovery on any error.
+ */
+typedef void (*bt_kbds_cache_cb)(struct bt_kbds_client *kbds, int err);
+
+/** @brief Sequence number tracking of one notification stream. */
+struct bt_kbds_seq {
+	/** Next expected sequence number. */
+	uint8_t next;
+	/** False until the first notification after subscribing. */
+	bool valid;
+};
+
+/** @brief Estimate of the server clock.
+ *
+ * Every Key Event notification gives one sample of the offset from the
+ * server clock to the client clock: receive time minus send time. Link
+ * delays only ever add to a sample, so the smallest one seen recently is
+ * the best estimate. Samples are kept as the minimum of the current and
+ * the previous window of CONFIG_BT_KBDS_CLOCK_WINDOW_MS, so the estimate
+ * follows the drift between the two clocks.
+ */
+struct bt_kbds_clock {
+	/** Offset estimate, added to server times. */
+	uint32_t offset;
+	/** Smallest offset seen in the current window. */
+	uint32_t win_min;
+	/** Smallest offset seen in the previous window. */
+	uint32_t prev_min;
+	/** Client time the current window started at. */
+	uint32_t win_start;
+	/** False until the first sample. */
+	bool valid;
+};
+
+/** @brief KBDS Client link statistics. */
+struct bt_kbds_client_stats {
+	/** Notifications or key events that never arrived. */
+	uint32_t lost;
+	/** Notifications dropped because they arrived out of order. */
+	uint32_t stale;
+	/** Full key state reads done to recover from a loss. */
+	uint32_t resyncs;
+};
 
 /* @brief Battery Service Client characteristic periodic read. */
 struct bt_kbds_periodic_read {
@@ -88,20 +141,56 @@ struct bt_kbds_client {
 	struct bt_gatt_subscribe_params notify_params;
 	/** Read parameters. */
 	struct bt_gatt_read_params read_params;
+	/** Resync read parameters. */
+	struct bt_gatt_read_params resync_params;
 	/** Read characteristic value timing. Used when characteristic do not
 	 *  have a CCCD descriptor.
 	 */
 	struct bt_kbds_periodic_read periodic_read;
+	/** Key event notification parameters. */
+	struct bt_gatt_subscribe_params evt_notify_params;
+	/** Database hash read parameters. */
+	struct bt_gatt_read_params hash_params;
+	/** Cached handle lookup callback. */
+	bt_kbds_cache_cb cache_cb;
 	/** Notification callback. */
 	bt_kbds_notify_cb notify_cb;
+	/** Key event callback. */
+	bt_kbds_key_evt_cb evt_cb;
 	/** Read value callback. */
 	bt_kbds_read_cb read_cb;
 	/** Handle of the Battery Level Characteristic. */
 	uint16_t val_handle;
 	/** Handle of the CCCD of the Battery Level Characteristic. */
 	uint16_t ccc_handle;
-	/** Current battery value. */
-	uint32_t keystates;
+	/** Handle of the Key Event Characteristic, 0 if not supported. */
+	uint16_t evt_handle;
+	/** Handle of the CCCD of the Key Event Characteristic. */
+	uint16_t evt_ccc_handle;
+	/** Button notification sequence. */
+	struct bt_kbds_seq notify_seq;
+	/** Key event sequence. */
+	struct bt_kbds_seq evt_seq;
+	/** Server clock estimate. */
+	struct bt_kbds_clock clock;
+	/** Link statistics. */
+	struct bt_kbds_client_stats stats;
+	/** Resync read in progress. */
+	bool resync_pending;
+	/** Database hash of the server. */
+	uint8_t db_hash[BT_KBDS_DB_HASH_LEN];
+	/** The database hash has been read on this connection. */
+	bool db_hash_valid;
+	/** The handles were assigned from the cache. */
+	bool cached;
+	/** Stale cached handles have been reported on this connection. */
+	bool cache_stale_reported;
+	/** Module ID of the server, BT_KBDS_MODULE_INVALID until known. */
+	uint8_t module_id;
+	/** Current key state. */
+	struct keyset keystates;
+	/** False while the key state is unknown. */
+	bool keystates_valid;
 	/** Properties of the service. */
 	uint8_t properties;
 	/** Notification supported. */
@@ -138,6 +227,46 @@ void bt_kbds_client_init(struct bt_kbds_client *kbds);
 int bt_kbds_handles_assign(struct bt_gatt_dm *dm,
 			  struct bt_kbds_client *kbds);
 
+/**
+ * @brief Assign handles from the cache to the KBDS Client instance.
+ *
+ * Reads the GATT database hash of the server and compares it with the
+ * hash stored along with the handles by @ref bt_kbds_handles_store. If it
+ * matches, the handles are assigned without a discovery, saving several
+ * ATT round trips on every reconnect. The result is reported to @p func,
+ * from the background work queue once the cache has been looked up, or
+ * from the Bluetooth RX thread if the hash cannot be read.
+ * The connection is assigned in any case, so @ref bt_kbds_conn gives the
+ * connection to discover if the cache cannot be used.
+ *
+ * @param kbds KBDS Client object from @ref bt_kbds_client_get.
+ * @param conn Connection object.
+ * @param func Callback function handler.
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ * @retval -ENOTSUP If settings are not enabled.
+ */
+int bt_kbds_handles_cached_assign(struct bt_kbds_client *kbds,
+				  struct bt_conn *conn,
+				  bt_kbds_cache_cb func);
+
+/**
+ * @brief Store the discovered handles in the cache.
+ *
+ * Call after @ref bt_kbds_handles_assign. The handles are stored in
+ * settings per server address, together with the database hash read by
+ * @ref bt_kbds_handles_cached_assign on the same connection.
+ *
+ * @param kbds KBDS Client object.
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ * @retval -ENODATA If the database hash of the server is not known.
+ * @retval -ENOTSUP If settings are not enabled.
+ */
+int bt_kbds_handles_store(struct bt_kbds_client *kbds);
+
 /**
  * @brief Subscribe to the battery level value change notification.
  *
@@ -162,6 +291,23 @@ int bt_kbds_subscribe_keystates(struct bt_kbds_client *kbds,
  */
 int bt_kbds_unsubscribe_keystates(struct bt_kbds_client *kbds);
 
+/**
+ * @brief Subscribe to key event notifications.
+ *
+ * The key state kept in the KBDS Client object is updated from the events,
+ * so @ref bt_kbds_get_last_keystates stays valid.
+ *
+ * @param kbds KBDS Client object.
+ * @param func Callback function handler, called once per key event.
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ * @retval -ENOTSUP Special error code used if the connected server
+ *         does not have the Key Event Characteristic.
+ */
+int bt_kbds_subscribe_key_events(struct bt_kbds_client *kbds,
+				 bt_kbds_key_evt_cb func);
+
 /**
  * @brief Get the connection object that is used with a given KBDS Client.
  *
@@ -186,17 +332,33 @@ struct bt_conn *bt_kbds_conn(const struct bt_kbds_client *kbds);
 int bt_kbds_read_keystates(struct bt_kbds_client *kbds, bt_kbds_read_cb func);
 
 /**
- * @brief Get the last known battery level.
+ * @brief Get the last known key state.
  *
- * This function returns the last known battery level value.
- * The battery level is stored when a notification or read response is
- * received.
+ * The key state is stored when a notification, key event or read response
+ * is received.
  *
- * @param kbds KBDS Client object.
+ * @param kbds      KBDS Client object.
+ * @param keystates Filled with the last known key state.
+ *
+ * @retval 0 If the operation was successful.
+ * @retval -ENODATA If the key state is not known yet.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int bt_kbds_get_last_keystates(struct bt_kbds_client *kbds,
+			       struct keyset *keystates);
+
+/**
+ * @brief Get the link statistics.
  *
- * @return Battery level or negative error code.
+ * A lost key event makes the client read the full key state and report
+ * the difference as key events, with an age of 0. The counters run
+ * from @ref bt_kbds_client_init.
+ *
+ * @param kbds  KBDS Client object.
+ * @param stats Filled with the current statistics.
  */
-int bt_kbds_get_last_keystates(struct bt_kbds_client *kbds);
+void bt_kbds_client_stats_get(const struct bt_kbds_client *kbds,
+			      struct bt_kbds_client_stats *stats);
 
 /**
  * @brief Check whether notification is supported by the service.
@@ -211,6 +373,34 @@ static inline bool bt_kbds_notify_supported(struct bt_kbds_client *kbds)
 	return kbds->notify;
 }
 
+/**
+ * @brief Check whether key events are supported by the service.
+ *
+ * @param kbds KBDS Client object.
+ *
+ * @retval true If the server has the Key Event Characteristic.
+ *              Otherwise, @c false is returned.
+ */
+static inline bool bt_kbds_key_events_supported(struct bt_kbds_client *kbds)
+{
+	return kbds->evt_handle != 0;
+}
+
+/**
+ * @brief Get the module ID of the server.
+ *
+ * The ID is sent with every Button value and notification, so it is
+ * known once the first one has been received.
+ *
+ * @param kbds KBDS Client object.
+ *
+ * @return Module ID, or BT_KBDS_MODULE_INVALID if not known yet.
+ */
+static inline uint8_t bt_kbds_module_id(const struct bt_kbds_client *kbds)
+{
+	return kbds->module_id;
+}
+
 /**
  * @brief Periodically read the battery level value from the device with
  *        specific time interval.
@@ -233,6 +423,55 @@ int bt_kbds_start_per_read_keystates(struct bt_kbds_client *kbds,
  */
 void bt_kbds_stop_per_read_keystates(struct bt_kbds_client *kbds);
 
+/**
+ * @brief Get the KBDS Client object of a connection.
+ *
+ * The module keeps CONFIG_BT_KBDS_CLIENT_COUNT objects, one per
+ * connected module. If the connection has none yet, a free object is
+ * initialized and allocated to it until @ref bt_kbds_client_release.
+ *
+ * @param conn Connection object.
+ *
+ * @return KBDS Client object, or NULL if all objects are in use.
+ */
+struct bt_kbds_client *bt_kbds_client_get(struct bt_conn *conn);
+
+/**
+ * @brief Find the KBDS Client object of a connection.
+ *
+ * @param conn Connection object.
+ *
+ * @return KBDS Client object, or NULL if none is allocated to @p conn.
+ */
+struct bt_kbds_client *bt_kbds_client_find(struct bt_conn *conn);
+
+/**
+ * @brief Find the KBDS Client object of a module.
+ *
+ * @param module_id Module ID of the server.
+ *
+ * @return KBDS Client object, or NULL if the module is not connected or
+ *         its ID is not known yet.
+ */
+struct bt_kbds_client *bt_kbds_client_find_module(uint8_t module_id);
+
+/**
+ * @brief Release a KBDS Client object.
+ *
+ * Call when its connection is gone. Stops the periodic read and frees
+ * the object for the next connection.
+ *
+ * @param kbds KBDS Client object from @ref bt_kbds_client_get.
+ */
+void bt_kbds_client_release(struct bt_kbds_client *kbds);
+
+/**
+ * @brief Get the number of allocated KBDS Client objects.
+ *
+ * @return Number of connections with a KBDS Client object.
+ */
+size_t bt_kbds_client_count(void);
+
 /**
  * @}
  */
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Keymap layer stack
+ */
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/math_extras.h>
+
+#include "keymap.h"
+
+static uint32_t layers_held;
+static uint32_t layers_active;
+
+/* Action of every position on the active layers. */
+static struct keymap_action resolved[KEYMAP_SIDES][KEYMAP_POSITIONS];
+
+static const struct keymap_action *action_find(enum keymap_side side,
+					       uint8_t position)
+{
+	uint32_t layers = layers_active;
+	const struct keymap_action *action;
+
+	/* The base layer is never transparent, so this always ends. */
+	do {
+		uint8_t layer = 31 - u32_count_leading_zeros(layers);
+
+		action = keymap_action_get(layer, side, position);
+		layers &= ~BIT(layer);
+	} while (action->type == KEYMAP_ACT_TRANS);
+
+	return action;
+}
+
+static void resolved_update(void)
+{
+	for (size_t side = 0; side < KEYMAP_SIDES; side++) {
+		for (size_t pos = 0; pos < KEYMAP_POSITIONS; pos++) {
+			resolved[side][pos] = *action_find(side, pos);
+		}
+	}
+}
+
+static void layers_update(void)
+{
+	uint32_t active = BIT(0) | layers_held;
+
+#if defined(KEYMAP_TRI_LAYER_ADJUST)
+	if ((active & BIT(KEYMAP_TRI_LAYER_LOWER)) &&
+	    (active & BIT(KEYMAP_TRI_LAYER_RAISE))) {
+		active |= BIT(KEYMAP_TRI_LAYER_ADJUST);
+	}
+#endif
+
+	if (active != layers_active) {
+		layers_active = active;
+		resolved_update();
+	}
+}
+
+void keymap_init(void)
+{
+	layers_held = 0;
+	layers_active = 0;
+	layers_update();
+}
+
+void keymap_layer_hold(uint8_t layer, bool held)
+{
+	if (layer >= KEYMAP_LAYERS) {
+		return;
+	}
+
+	WRITE_BIT(layers_held, layer, held);
+	layers_update();
+}
+
+uint32_t keymap_layers_get(void)
+{
+	return layers_active;
+}
+
+const struct keymap_action *keymap_action_resolve(enum keymap_side side,
+						  uint8_t position)
+{
+	return &resolved[side][position];
+}
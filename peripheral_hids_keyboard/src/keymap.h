@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_KEYMAP_H_
+#define KB_KEYMAP_H_
+
+/**@file
+ * @defgroup kb_keymap Keymap API
+ * @{
+ * @brief Keymap lookup tables and layer stack.
+ *
+ * The tables are generated at build time by scripts/gen_keymap.py from
+ * keymap.yml. Each entry holds the action of one position of one side on
+ * one layer. A side is a half of the keyboard or an extra module, indexed
+ * by its module ID; KEYMAP_SIDES comes from keymap.yml.
+ *
+ * Any number of layers can be active at once, tracked in a 32 bit mask
+ * with the base layer always set. Transparent entries take the action of
+ * the next active layer below. Whenever the mask changes the action of
+ * every position is resolved into a cache, so looking up a key costs the
+ * same however many layers are stacked.
+ *
+ * The layer functions are not reentrant and must be called from one
+ * thread.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <zephyr/types.h>
+
+#include "keymap_gen.h"
+
+/** @brief Halves of the keyboard, the second table index.
+ *
+ * Extra modules follow up to KEYMAP_SIDES.
+ */
+enum keymap_side {
+	KEYMAP_LEFT,
+	KEYMAP_RIGHT,
+};
+
+/** @brief Action types. */
+enum keymap_action_type {
+	/** No action. */
+	KEYMAP_ACT_NONE,
+	/** Key code, sent together with the modifiers. */
+	KEYMAP_ACT_KEY,
+	/** Modifier mask only. */
+	KEYMAP_ACT_MOD,
+	/** Layer held while the key is pressed, in the code field. */
+	KEYMAP_ACT_LAYER,
+	/** Action of the next active layer below. */
+	KEYMAP_ACT_TRANS,
+};
+
+/** @brief Action of a key. */
+struct keymap_action {
+	/** Action type, enum keymap_action_type. */
+	uint8_t type;
+	/** Key code or layer. */
+	uint8_t code;
+	/** Modifier mask, KEY_MOD_*. */
+	uint8_t mods;
+};
+
+/** @brief Actions indexed by layer, side and position. */
+extern const struct keymap_action
+	keymap_table[KEYMAP_LAYERS][KEYMAP_SIDES][KEYMAP_POSITIONS];
+
+/** @brief Look up the action of a key on one layer.
+ *
+ * @param layer    Layer, below KEYMAP_LAYERS.
+ * @param side     Side the key is on, below KEYMAP_SIDES.
+ * @param position Key position, below KEYMAP_POSITIONS.
+ *
+ * @return Action of the key, possibly KEYMAP_ACT_TRANS.
+ */
+static inline const struct keymap_action *
+keymap_action_get(uint8_t layer, enum keymap_side side, uint8_t position)
+{
+	return &keymap_table[layer][side][position];
+}
+
+/** @brief Initialize the layer stack with only the base layer active. */
+void keymap_init(void);
+
+/** @brief Hold or release a layer.
+ *
+ * With a tri-layer configured, holding both of its lower layers also
+ * activates the third one.
+ *
+ * @param layer Layer, below KEYMAP_LAYERS.
+ * @param held  True while the layer key is pressed.
+ */
+void keymap_layer_hold(uint8_t layer, bool held);
+
+/** @brief Get the active layers.
+ *
+ * @return Mask of the active layers, bit 0 is the base layer.
+ */
+uint32_t keymap_layers_get(void);
+
+/** @brief Get the action of a key on the active layers.
+ *
+ * @param side     Side the key is on, below KEYMAP_SIDES.
+ * @param position Key position, below KEYMAP_POSITIONS.
+ *
+ * @return Resolved action of the key, never KEYMAP_ACT_TRANS.
+ */
+const struct keymap_action *keymap_action_resolve(enum keymap_side side,
+						  uint8_t position);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_KEYMAP_H_ */
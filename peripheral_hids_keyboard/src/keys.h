@@ -289,92 +289,12 @@
 #define KEY_MEDIA_CALC 0xfb
 
 
-const uint8_t key_map_left[4][4][6] = {{{KEY_TAB, KEY_Q, KEY_W, KEY_E, KEY_R, KEY_T},
-                                        {KEY_MOD_LCTRL, KEY_A, KEY_S, KEY_D, KEY_F, KEY_G},
-                                        {KEY_MOD_LSHIFT, KEY_Z, KEY_X, KEY_C, KEY_V, KEY_B},
-                                        {KEY_NONE, KEY_NONE, KEY_NONE, KEY_MOD_LMETA, KEY_NONE, KEY_SPACE}}, 
-
-                                        {{KEY_TAB, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5},
-                                        {KEY_MOD_LCTRL, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE},
-                                        {KEY_MOD_LSHIFT, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE},
-                                        {KEY_NONE, KEY_NONE, KEY_NONE, KEY_MOD_LMETA, KEY_NONE, KEY_SPACE}}, 
-
-                                        {{KEY_TAB, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5},  
-                                        {KEY_MOD_LCTRL, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE},  
-                                        {KEY_MOD_LSHIFT, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE},  
-                                        {KEY_NONE, KEY_NONE, KEY_NONE, KEY_MOD_LMETA, KEY_NONE, KEY_SPACE}}, 
-
-                                        {{KEY_TAB, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE},  
-                                        {KEY_MOD_LCTRL, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE},  
-                                        {KEY_MOD_LSHIFT, KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5},  
-                                        {KEY_NONE, KEY_NONE, KEY_NONE, KEY_MOD_LMETA, KEY_NONE, KEY_SPACE}}, 
-                                        };
-
-const uint8_t key_map_right[4][4][6] = {{{KEY_Y, KEY_U, KEY_I, KEY_O, KEY_P, KEY_BACKSPACE},
-                                        {KEY_H, KEY_J, KEY_K, KEY_L, KEY_SEMICOLON, KEY_APOSTROPHE},
-                                        {KEY_N, KEY_M, KEY_COMMA, KEY_DOT, KEY_SLASH, KEY_ESC},
-                                        {KEY_ENTER, KEY_NONE, KEY_MOD_LALT, KEY_NONE, KEY_NONE, KEY_NONE}},
-
-                                        {{KEY_6, KEY_7, KEY_8, KEY_9, KEY_0, KEY_BACKSPACE},
-                                        {KEY_LEFT, KEY_DOWN, KEY_UP, KEY_RIGHT, KEY_NONE, KEY_GRAVE},
-                                        {KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_ESC},
-                                        {KEY_ENTER, KEY_NONE, KEY_MOD_LALT, KEY_NONE, KEY_NONE, KEY_NONE}}, 
-
-                                        {{KEY_6, KEY_7, KEY_8, KEY_9, KEY_0, KEY_BACKSPACE},
-                                        {KEY_MINUS, KEY_EQUAL, KEY_RIGHTBRACE, KEY_LEFTBRACE, KEY_BACKSLASH, KEY_NONE},
-                                        {KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_ESC},
-                                        {KEY_ENTER, KEY_NONE, KEY_MOD_LALT, KEY_NONE, KEY_NONE, KEY_NONE}}, 
-
-                                        {{KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_BACKSPACE},
-                                        {KEY_NONE, KEY_NONE, KEY_NONE, KEY_NONE, KEY_F11, KEY_F12},
-                                        {KEY_F6, KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_ESC},
-                                        {KEY_ENTER, KEY_NONE, KEY_MOD_LALT, KEY_NONE, KEY_NONE, KEY_NONE}}
-                                        };
-
-const uint8_t mod_chr[8] = {KEY_MOD_LCTRL,
-                                    KEY_MOD_LSHIFT,
-                                    KEY_MOD_LALT,
-                                    KEY_MOD_LMETA,
-                                    KEY_MOD_RCTRL,
-                                    KEY_MOD_RSHIFT,
-                                    KEY_MOD_RALT,
-                                    KEY_MOD_RMETA
-                                    };
-
 bool is_ith_bit_set(uint32_t number, int bit){
     if(bit >= 32){return false;}
     if(number & (1 << (bit))){return true;}
     return false;
 }
 
-bool is_mod_chr(bool l_or_r, int pos){//by postion in key map
-    if(l_or_r){//left
-        if(pos == 6 || pos == 12 || pos == 21){return true;}
-    }else{//right
-        if(pos == 20){return true;}
-    }
-    return false;
-}
-
-uint8_t get_mod_chr(uint8_t *chr){
-    for(int i=0; i<NUM_OF_MOD;i++){
-        if(*chr == mod_chr[i]){
-            return mod_chr[i];
-        }
-    }
-    return 0xFF;//Was not a mod chr
-}
-
-void set_or_clear_mod_byte(uint8_t *mod_byte, bool down, uint8_t *chr){
-    printk("mod byte b4 %x | ", *mod_byte);
-    if(down){
-        *mod_byte |= *chr;
-    }else{
-        *mod_byte &= ~(*chr);
-    } 
-    printk("after %x\n", *mod_byte);
-} 
-
 void temp_name(){
 
 }
@@ -13,6 +13,7 @@
 #include <errno.h>
 #include <zephyr/sys/printk.h>
 #include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/math_extras.h>
 #include <zephyr/kernel.h>
 #include <zephyr/drivers/gpio.h>
 #include <soc.h>
@@ -33,6 +34,14 @@
 #include <zephyr/bluetooth/services/dis.h>
 #include <dk_buttons_and_leds.h>
 #include "keys.h"
+#include "hid_report.h"
+#include "keymap.h"
+#include "matrix.h"
+#include "bg_work.h"
+#include "trace.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(kb_hid, CONFIG_KB_HID_LOG_LEVEL);
 
 #define DEVICE_NAME     CONFIG_BT_DEVICE_NAME
 #define DEVICE_NAME_LEN (sizeof(DEVICE_NAME) - 1)
@@ -49,8 +58,6 @@
 #define KEYS_MAX_LEN                    (INPUT_REPORT_KEYS_MAX_LEN - \
 					SCAN_CODE_POS)
 
-#define ADV_LED_BLINK_INTERVAL  20
-
 #ifndef dongle
 #define ADV_STATUS_LED DK_LED1
 #define CON_STATUS_LED DK_LED2
@@ -77,53 +84,171 @@ const static struct gpio_dt_spec led[NUM_OF_LED] = {GPIO_DT_SPEC_GET(DT_ALIAS(le
 #define BUT_ACCEPT_POS 0x08
 #define BUT_REJECT_POS 0x16
 
-/* HIDs queue elements. */
-#define HIDS_QUEUE_SIZE 10
+/* Retry time of a report that found no TX buffer while none of its
+ * connection's reports were in flight to complete and wake the HID thread.
+ */
+#define REPORT_RETRY_MS 1
+
+/* Wakes the HID thread. Given after every key event put and whenever a
+ * report notification completes.
+ */
+K_SEM_DEFINE(hid_evt_sem, 0, 1);
 
 /* ********************* */
 /* Buttons configuration */
 
-/* Note: The configuration below is the same as BOOT mode configuration
- * This simplifies the code as the BOOT mode is the same as REPORT mode.
- * Changing this configuration would require separate implementation of
- * BOOT mode report generation.
- */
-#define KEY_CTRL_CODE_MIN 224 /* Control key codes - required 8 of them */
-#define KEY_CTRL_CODE_MAX 231 /* Control key codes - required 8 of them */
-#define KEY_CODE_MIN      0   /* Normal key codes */
-#define KEY_CODE_MAX      101 /* Normal key codes */
-#define KEY_PRESS_MAX     6   /* Maximum number of non-control keys
-			       * pressed simultaneously
-			       */
-
-/* Number of bytes in key report
- *
- * 1B - control keys
- * 1B - reserved
- * rest - non-control keys
- */
-#define INPUT_REPORT_KEYS_MAX_LEN (1 + 1 + KEY_PRESS_MAX)
-
 //#define single_change
 
 #ifdef dev_mode
 #define KBDS_READ_VALUE_INTERVAL (10 * MSEC_PER_SEC)
 #include "kbds_client.h"
 #include "kbds.h"
+#include "split_link.h"
+#include "split_peer.h"
+#include "spsc_ring.h"
+#include "evt_merge.h"
 
-static struct bt_conn *default_conn;
-static struct bt_kbds_client kbds;
+/* Module connection being established, before it gets a KBDS client. */
+static struct bt_conn *connecting;
 
-uint32_t last_keystate_left = 0;
-uint32_t last_keystate_right = 0;
-uint32_t keystate_right = 0;
-uint32_t right_keystate_change = 0;
-uint8_t layer_selection = 0;
+/* Key state of every side, indexed by module ID. */
+struct keyset last_keystate[KEYMAP_SIDES];
 
 bool in_pairing_mode = true;
 
+/* Key events on their way to the HID thread, in arrival order. Each ring
+ * has a single producer: the Bluetooth RX thread for the modules, where
+ * bitmap notifications of modules without key events are turned into
+ * events as well, and the matrix thread for the matrix of this half.
+ * Neither producer ever blocks on the HID thread.
+ */
+SPSC_RING_DEFINE(module_evt_ring, struct hid_evt,
+		 CONFIG_KB_HID_EVT_QUEUE_SIZE);
+SPSC_RING_DEFINE(right_evt_ring, struct hid_evt,
+		 CONFIG_KB_HID_EVT_QUEUE_SIZE);
+/* Key state received from every module, indexed by module ID, and the
+ * part of it that made it into the module ring. They differ while the
+ * changes of events dropped on a full ring wait for a resync.
+ */
+static struct keyset module_keystate[KEYMAP_SIDES];
+static struct keyset module_keystate_rx[KEYMAP_SIDES];
+static struct k_spinlock module_keystate_lock;
+/* Sides that lost key events to a full ring. The HID thread resyncs them
+ * from their full key state once it has drained the rings.
+ */
+static atomic_t evt_resync;
+BUILD_ASSERT(KEYMAP_SIDES <= ATOMIC_BITS, "Too many sides to resync");
+/* Key state of every side as inserted into the merge buffer. */
+static struct keyset merged_keystate[KEYMAP_SIDES];
+
 static void notify_keystates_cb(struct bt_kbds_client *kbds,
-				    uint32_t keystates);
+				const struct keyset *keystates);
+
+/* Returns false if the event was dropped on a full ring. */
+static bool hid_evt_put(uint8_t side, uint8_t position, bool pressed,
+			uint32_t time)
+{
+	struct hid_evt evt = {
+		.time = time,
+		.position = position,
+		.side = side,
+		.pressed = pressed,
+	};
+
+	struct spsc_ring *ring = (side == KEYMAP_RIGHT) ? &right_evt_ring :
+							  &module_evt_ring;
+
+	if (!spsc_ring_put(ring, &evt)) {
+		LOG_WRN("Side %u key event dropped (%u overflows)", side,
+			spsc_ring_overflows(ring));
+		return false;
+	}
+
+	k_sem_give(&hid_evt_sem);
+	return true;
+}
+
+/* Only request it once the full key state has the lost change. */
+static void evt_resync_request(uint8_t side)
+{
+	atomic_set_bit(&evt_resync, side);
+	k_sem_give(&hid_evt_sem);
+}
+
+/* Keymap side of a module, or a negative error code if it has none. */
+static int kbds_side(const struct bt_kbds_client *kbds)
+{
+	uint8_t id = bt_kbds_module_id(kbds);
+
+	if (id >= KEYMAP_SIDES || id == KEYMAP_RIGHT) {
+		LOG_WRN("Module %u is not in the keymap", id);
+		return -EINVAL;
+	}
+
+	return id;
+}
+
+static void module_key_evt_put(uint8_t side, uint8_t position, bool pressed,
+			       uint32_t time)
+{
+	int32_t delay = bt_kbds_time_get() - time;
+	k_spinlock_key_t key;
+	bool queued;
+
+	trace_key_remote(side, position,
+			 MAX(delay, 0) * BT_KBDS_EVT_TIME_UNIT_US);
+	queued = hid_evt_put(side, position, pressed, time);
+
+	key = k_spin_lock(&module_keystate_lock);
+	keyset_write(&module_keystate[side], position, pressed);
+	if (queued) {
+		keyset_write(&module_keystate_rx[side], position, pressed);
+	}
+	k_spin_unlock(&module_keystate_lock, key);
+
+	if (!queued) {
+		evt_resync_request(side);
+	}
+}
+
+/* Bitmaps carry no event times, the changes are timed on arrival. */
+static void module_keystate_set(uint8_t side, const struct keyset *keystates)
+{
+	struct keyset has_changed;
+	uint32_t now = bt_kbds_time_get();
+	k_spinlock_key_t key;
+	bool lost;
+
+	/* Changes dropped before are sent again, as they were never put. */
+	key = k_spin_lock(&module_keystate_lock);
+	keyset_xor(&has_changed, keystates, &module_keystate_rx[side]);
+	k_spin_unlock(&module_keystate_lock, key);
+
+	KEYSET_FOREACH(&has_changed, i) {
+		module_key_evt_put(side, i, keyset_test(keystates, i), now);
+	}
+
+	/* A resync pending from a dropped change must not bring it back. */
+	key = k_spin_lock(&module_keystate_lock);
+	lost = !keyset_equal(&module_keystate[side], keystates);
+	module_keystate[side] = *keystates;
+	k_spin_unlock(&module_keystate_lock, key);
+
+	if (lost) {
+		evt_resync_request(side);
+	}
+}
+
+static void key_evt_cb(struct bt_kbds_client *kbds,
+		       const struct bt_kbds_key_evt *evt)
+{
+	int side = kbds_side(kbds);
+
+	if (side >= 0 && evt->position < KEYSET_KEYS) {
+		module_key_evt_put(side, evt->position, evt->pressed,
+				   evt->time);
+	}
+}
 
 static void scan_filter_match(struct bt_scan_device_info *device_info,
 			      struct bt_scan_filter_match *filter_match,
@@ -145,7 +270,7 @@ static void scan_connecting_error(struct bt_scan_device_info *device_info)
 static void scan_connecting(struct bt_scan_device_info *device_info,
 			    struct bt_conn *conn)
 {
-	default_conn = bt_conn_ref(conn);
+	connecting = bt_conn_ref(conn);
 }
 
 static void scan_filter_no_match(struct bt_scan_device_info *device_info,
@@ -166,8 +291,7 @@ static void scan_filter_no_match(struct bt_scan_device_info *device_info,
 					device_info->conn_param, &conn);
 
 		if (!err) {
-			default_conn = bt_conn_ref(conn);
-			bt_conn_unref(conn);
+			connecting = conn;
 		}
 	}
 }
@@ -175,51 +299,148 @@ static void scan_filter_no_match(struct bt_scan_device_info *device_info,
 BT_SCAN_CB_INIT(scan_cb, scan_filter_match, scan_filter_no_match,
 		scan_connecting_error, scan_connecting);
 
-static void read_keystates_cb(struct bt_kbds_client *kbds,
-				  uint32_t keystates,
-				  int err)
+/* Add the bonded modules that are not connected to the filter accept
+ * list. Returns how many were added.
+ */
+static size_t split_peers_accept(void)
 {
 	char addr[BT_ADDR_LE_STR_LEN];
+	struct bt_conn *conn;
+	bt_addr_le_t peer;
+	size_t cnt = 0;
 
-	bt_addr_le_to_str(bt_conn_get_dst(bt_kbds_conn(kbds)),
-			  addr, sizeof(addr));
+	for (size_t i = 0; i < CONFIG_KB_SPLIT_LINK_MAX; i++) {
+		if (split_peer_get(i, &peer)) {
+			continue;
+		}
+
+		conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, &peer);
+		if (conn) {
+			bt_conn_unref(conn);
+			continue;
+		}
+
+		bt_addr_le_to_str(&peer, addr, sizeof(addr));
+		if (bt_le_filter_accept_list_add(&peer)) {
+			printk("Split peer %s not accepted\n", addr);
+			continue;
+		}
+		printk("Connecting to split peer %s\n", addr);
+		cnt++;
+	}
+
+	return cnt;
+}
+
+/* Connect to the missing modules. Bonded modules are connected to
+ * straight from the filter accept list, answering their directed
+ * advertising without a scan. Once all of them are connected, scan for
+ * the KBDS UUID while there is room for more modules.
+ */
+static void split_connect(void)
+{
+	int err;
+
+	if (connecting) {
+		/* Called again once the connection is up. */
+		return;
+	}
+
+	bt_scan_stop();
+	bt_conn_create_auto_stop();
+
+	err = bt_le_filter_accept_list_clear();
+	if (!err && split_peers_accept()) {
+		err = bt_conn_le_create_auto(BT_CONN_LE_CREATE_CONN,
+					     SPLIT_LINK_CONN_PARAM);
+		if (!err) {
+			return;
+		}
+		printk("Auto connect failed (err %d)\n", err);
+	}
+
+	if (bt_kbds_client_count() >= CONFIG_BT_KBDS_CLIENT_COUNT) {
+		return;
+	}
+
+	/* This demo doesn't require active scan */
+	err = bt_scan_start(BT_SCAN_TYPE_SCAN_ACTIVE);
 	if (err) {
-		printk("[%s] Battery read ERROR: %d\n", addr, err);
+		printk("Scanning failed to start (err %d)\n", err);
 		return;
 	}
+	printk("scanning started\n");
+}
 
-	last_keystate_left = keystates;
+static void read_keystates_cb(struct bt_kbds_client *kbds,
+			      const struct keyset *keystates,
+			      int err)
+{
+	int side;
+
+	if (err) {
+		LOG_ERR("Module %u read error: %d", bt_kbds_module_id(kbds),
+			err);
+		return;
+	}
 
-	printk("[%s] Battery read: %x\n", addr, keystates);
+	side = kbds_side(kbds);
+	if (side >= 0) {
+		module_keystate_set(side, keystates);
+	}
+
+	LOG_DBG("Module %u read: %u keys pressed", bt_kbds_module_id(kbds),
+		keyset_count(keystates));
 }
 
-static void button_readval(void)
+static void button_readval(struct bt_kbds_client *kbds)
 {
 	int err;
 
-	printk("Reading KBDS value:\n");
-	err = bt_kbds_read_keystates(&kbds, read_keystates_cb);
+	LOG_DBG("Reading KBDS value");
+	err = bt_kbds_read_keystates(kbds, read_keystates_cb);
 	if (err) {
-		printk("KBDS read call error: %d\n", err);
+		LOG_ERR("KBDS read call error: %d", err);
 	}
 }
 
-static void discovery_completed_cb(struct bt_gatt_dm *dm,
-				   void *context)
+static void split_link_updated(struct bt_conn *conn, uint16_t interval,
+			       uint16_t latency, uint16_t timeout)
 {
-	int err;
+	LOG_INF("Split link updated: interval %u, latency %u, timeout %u",
+		interval, latency, timeout);
+}
 
-	printk("The discovery procedure succeeded\n");
+static void split_link_rejected(struct bt_conn *conn,
+				const struct bt_le_conn_param *param, int err)
+{
+	LOG_WRN("Split link parameters rejected: interval %u, latency %u "
+		"(err %d)", param->interval_min, param->latency, err);
+}
 
-	bt_gatt_dm_data_print(dm);
+static const struct split_link_cb split_link_callbacks = {
+	.updated  = split_link_updated,
+	.rejected = split_link_rejected,
+};
+
+/* Start receiving keys once the KBDS handles are known. */
+static void kbds_start(struct bt_kbds_client *kbds)
+{
+	int err;
 
-	err = bt_kbds_handles_assign(dm, &kbds);
+	err = split_link_start(bt_kbds_conn(kbds));
 	if (err) {
-		printk("Could not init KBDS client object, error: %d\n", err);
+		printk("Split link start failed (err %d)\n", err);
 	}
 
-	if (bt_kbds_notify_supported(&kbds)) {
-		err = bt_kbds_subscribe_keystates(&kbds,
+	if (bt_kbds_key_events_supported(kbds)) {
+		err = bt_kbds_subscribe_key_events(kbds, key_evt_cb);
+		if (err) {
+			printk("Cannot subscribe to KBDS key events "
+				"(err: %d)\n", err);
+		}
+	} else if (bt_kbds_notify_supported(kbds)) {
+		err = bt_kbds_subscribe_keystates(kbds,
 						     notify_keystates_cb);
 		if (err) {
 			printk("Cannot subscribe to KBDS value notification "
@@ -228,13 +449,62 @@ static void discovery_completed_cb(struct bt_gatt_dm *dm,
 		}
 	} else {
 		err = bt_kbds_start_per_read_keystates(
-			&kbds, KBDS_READ_VALUE_INTERVAL, notify_keystates_cb);
+			kbds, KBDS_READ_VALUE_INTERVAL, notify_keystates_cb);
 		if (err) {
 			printk("Could not start periodic read of KBDS value\n");
 		}
 	}
 
-	button_readval();
+	button_readval(kbds);
+
+	printk("Split link up after %u ms\n", split_peer_link_up());
+}
+
+static void kbds_cache_store(struct bt_conn *conn, void *data)
+{
+	struct bt_kbds_client *kbds = bt_kbds_client_find(conn);
+	int err;
+
+	if (!kbds) {
+		return;
+	}
+
+	/* Returns right away for handles taken from the cache, and with
+	 * -EINVAL for a module still in discovery.
+	 */
+	err = bt_kbds_handles_store(kbds);
+	if (err && err != -EINVAL) {
+		printk("KBDS handles not cached (err %d)\n", err);
+	}
+}
+
+static void kbds_cache_fn(struct k_work *work)
+{
+	bt_conn_foreach(BT_CONN_TYPE_LE, kbds_cache_store, NULL);
+}
+
+static K_WORK_DEFINE(kbds_cache_work, kbds_cache_fn);
+
+static void discovery_completed_cb(struct bt_gatt_dm *dm,
+				   void *context)
+{
+	struct bt_kbds_client *kbds = bt_kbds_client_find(
+		bt_gatt_dm_conn_get(dm));
+	int err;
+
+	printk("The discovery procedure succeeded\n");
+
+	bt_gatt_dm_data_print(dm);
+
+	err = bt_kbds_handles_assign(dm, kbds);
+	if (err) {
+		printk("Could not init KBDS client object, error: %d\n", err);
+	}
+
+	/* The flash write can take milliseconds, keep it off the RX thread. */
+	bg_work_submit(&kbds_cache_work);
+
+	kbds_start(kbds);
 
 	err = bt_gatt_dm_data_release(dm);
 	if (err) {
@@ -267,7 +537,7 @@ static void gatt_discover(struct bt_conn *conn)
 {
 	int err;
 
-	if (conn != default_conn) {
+	if (!bt_kbds_client_find(conn)) {
 		return;
 	}
 
@@ -278,11 +548,38 @@ static void gatt_discover(struct bt_conn *conn)
 	}
 }
 
-#endif
+static void kbds_cache_cb(struct bt_kbds_client *kbds, int err)
+{
+	if (!err) {
+		printk("KBDS handles taken from the cache\n");
+		kbds_start(kbds);
+		return;
+	}
+
+	printk("No usable cached KBDS handles (err %d)\n", err);
+	gatt_discover(bt_kbds_conn(kbds));
+}
+
+/* Subscribe with the cached handles if the server is unchanged, or run
+ * a full discovery.
+ */
+static void kbds_connect(struct bt_conn *conn)
+{
+	struct bt_kbds_client *kbds = bt_kbds_client_get(conn);
+
+	if (!kbds) {
+		printk("No free KBDS client, dropping the module\n");
+		bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		return;
+	}
+
+	if (bt_kbds_handles_cached_assign(kbds, conn, kbds_cache_cb)) {
+		gatt_discover(conn);
+	}
+}
 
+#endif
 
-/* Current report map construction requires exactly 8 buttons */
-BUILD_ASSERT((KEY_CTRL_CODE_MAX - KEY_CTRL_CODE_MIN) + 1 == 8);
 
 /* OUT report internal indexes.
  *
@@ -322,11 +619,6 @@ static const struct bt_data sd[] = {
 	BT_DATA(BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN),
 };
 
-static struct conn_mode {
-	struct bt_conn *conn;
-	bool in_boot_mode;
-} conn_mode[CONFIG_BT_HIDS_MAX_CLIENT_COUNT];
-
 static const uint8_t hello_world_str[] = {
 	0x0b,	/* Key h */
 	0x08,	/* Key e */
@@ -339,11 +631,55 @@ static const uint8_t hello_world_str[] = {
 static const uint8_t shift_key[] = { 225 };
 
 /* Current report status
+ *
+ * Non-control keys are kept as a bitmap indexed by usage, so any number of
+ * them can be held. 6KRO reports are derived from it when sent.
+ */
+static struct keyboard_state hid_keyboard_state;
+
+/* Reports of one host, sent oldest first. Only the HID thread resets,
+ * queues and sends, the send-complete callback only counts the completed
+ * ones. The in flight count is never reset, every notification completes
+ * even if its connection is lost.
+ */
+struct report_queue {
+	struct keyboard_state report[CONFIG_KB_HID_REPORT_QUEUE_SIZE];
+	/* Trace IDs of the queued reports. */
+	uint32_t trace[CONFIG_KB_HID_REPORT_QUEUE_SIZE];
+	uint8_t head;
+	uint8_t cnt;
+	/* Notifications handed to the stack and not completed yet. */
+	atomic_t in_flight;
+	/* Trace IDs of the notifications in flight, they complete in the
+	 * order they were sent.
+	 */
+	uint32_t trace_in_flight[CONFIG_KB_HID_REPORTS_IN_FLIGHT];
+	uint8_t trace_sent;
+	uint8_t trace_done;
+	/* Queued reports replaced by a newer one while the queue was full. */
+	uint32_t collapsed;
+	/* Reports the stack refused for good. */
+	uint32_t dropped;
+};
+
+static struct conn_mode {
+	struct bt_conn *conn;
+	/* Lost connection of the slot, only compared with. Its
+	 * notifications still in flight complete before those of a new
+	 * connection on the same object.
+	 */
+	struct bt_conn *lost;
+	bool in_boot_mode;
+	struct report_queue queue;
+} conn_mode[CONFIG_BT_HIDS_MAX_CLIENT_COUNT];
+
+BUILD_ASSERT(CONFIG_BT_HIDS_MAX_CLIENT_COUNT <= ATOMIC_BITS,
+	     "Too many hosts for the new host mask");
+
+/* Slots of hosts connected since the HID thread last looked. Their
+ * queues are not used until the HID thread has started them.
  */
-static struct keyboard_state {
-	uint8_t ctrl_keys_state; /* Current keys state */
-	uint8_t keys_state[KEY_PRESS_MAX];
-} hid_keyboard_state;
+static atomic_t hosts_new;
 
 static struct k_work pairing_work;
 struct pairing_data_mitm {
@@ -417,16 +753,11 @@ static void connected(struct bt_conn *conn, uint8_t err)
 	if (err) {
 		printk("Failed to connect to %s (%u)\n", addr, err);
 #ifdef dev_mode
-		if (conn == default_conn) {
-			bt_conn_unref(default_conn);
-			default_conn = NULL;
-
-			/* This demo doesn't require active scan */
-			bt_err = bt_scan_start(BT_SCAN_TYPE_SCAN_ACTIVE);
-			if (bt_err) {
-				printk("Scanning failed to start (err %d)\n",
-				       err);
-			}
+		if (conn == connecting) {
+			bt_conn_unref(connecting);
+			connecting = NULL;
+
+			split_connect();
 		}
 #endif
 		return;
@@ -444,12 +775,20 @@ static void connected(struct bt_conn *conn, uint8_t err)
 	if(info.role == BT_CONN_ROLE_CENTRAL){
 		//printk("we are connected and about to discover attributes on the connected gatt client!\n");
 		printk("This is concidered a Central connection\n");
-		bt_err = bt_conn_set_security(conn, BT_SECURITY_L1);
-		if (err) {
+		if (conn == connecting) {
+			bt_conn_unref(connecting);
+			connecting = NULL;
+		}
+		/* Bond with the module, or encrypt with the bond, so it
+		 * can be reconnected to directly.
+		 */
+		bt_err = bt_conn_set_security(conn, BT_SECURITY_L2);
+		if (bt_err) {
 			printk("Failed to set security: %d\n", bt_err);
-			gatt_discover(conn);
 		}
-		gatt_discover(conn);
+		kbds_connect(conn);
+		/* Look for the other modules. */
+		split_connect();
 	}
 	else{//info.role = BT_CONN_ROLE_PERIPHERAL
 
@@ -464,8 +803,13 @@ static void connected(struct bt_conn *conn, uint8_t err)
 
 	for (size_t i = 0; i < CONFIG_BT_HIDS_MAX_CLIENT_COUNT; i++) {
 		if (!conn_mode[i].conn) {
-			conn_mode[i].conn = conn;
+			/* The HID thread resets the queue and sends the
+			 * current state.
+			 */
+			atomic_set_bit(&hosts_new, i);
 			conn_mode[i].in_boot_mode = false;
+			conn_mode[i].conn = conn;
+			k_sem_give(&hid_evt_sem);
 			break;
 		}
 	}
@@ -484,6 +828,10 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 	char addr[BT_ADDR_LE_STR_LEN];
 #ifdef dev_mode
 	struct bt_conn_info info;
+	struct bt_kbds_client_stats stats;
+	struct bt_kbds_client *kbds;
+	struct keyset released;
+	int side;
 #endif
 
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
@@ -492,19 +840,30 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 #ifdef dev_mode
 	bt_conn_get_info(conn, &info);
 	if(info.role == BT_CONN_ROLE_CENTRAL){
-		if (default_conn != conn) {
+		kbds = bt_kbds_client_find(conn);
+		if (!kbds) {
 			printk("disconnected from a peripheral that wasn't the other kbd?\n");
 			return;
 		}
 		printk("this is the kbds_peripheral\n");
-		kbds.keystates = 0x00;
-		bt_conn_unref(default_conn);
-		default_conn = NULL;
-		/* This demo doesn't require active scan */
-		err = bt_scan_start(BT_SCAN_TYPE_SCAN_ACTIVE);
-		if (err) {
-			printk("Scanning failed to start (err %d)\n", err);
+		bt_kbds_client_stats_get(kbds, &stats);
+		printk("KBDS module %u link: lost %u, stale %u, resyncs %u\n",
+		       bt_kbds_module_id(kbds), stats.lost, stats.stale,
+		       stats.resyncs);
+		printk("HID event overflows: modules %u, right %u\n",
+		       spsc_ring_overflows(&module_evt_ring),
+		       spsc_ring_overflows(&right_evt_ring));
+		/* Release the keys still held on the module. */
+		if (bt_kbds_module_id(kbds) != BT_KBDS_MODULE_INVALID) {
+			side = kbds_side(kbds);
+			if (side >= 0) {
+				keyset_clear(&released);
+				module_keystate_set(side, &released);
+			}
 		}
+		bt_kbds_client_release(kbds);
+		split_peer_link_lost();
+		split_connect();
 	}
 	else{//info.role = BT_CONN_ROLE_PERIPHERAL
 #endif
@@ -517,6 +876,10 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 
 	for (size_t i = 0; i < CONFIG_BT_HIDS_MAX_CLIENT_COUNT; i++) {
 		if (conn_mode[i].conn == conn) {
+			printk("Host reports: collapsed %u, dropped %u\n",
+			       conn_mode[i].queue.collapsed,
+			       conn_mode[i].queue.dropped);
+			conn_mode[i].lost = conn;
 			conn_mode[i].conn = NULL;
 		} else {
 			if (conn_mode[i].conn) {
@@ -546,9 +909,36 @@ static void security_changed(struct bt_conn *conn, bt_security_t level,
 			     enum bt_security_err err)
 {
 	char addr[BT_ADDR_LE_STR_LEN];
+#ifdef dev_mode
+	int bt_err;
+#endif
 
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
+#ifdef dev_mode
+	if (bt_kbds_client_find(conn)) {
+		if (!err) {
+			printk("Split link security: %s level %u\n", addr,
+			       level);
+			bt_err = split_peer_set(bt_conn_get_dst(conn));
+			if (!bt_err) {
+				printk("Split peer is %s\n", addr);
+			} else if (bt_err == -ENOMEM) {
+				printk("No room to store split peer %s\n",
+				       addr);
+			}
+		} else if (err == BT_SECURITY_ERR_PIN_OR_KEY_MISSING) {
+			/* The module lost the bond, pair again. */
+			printk("Split peer %s lost the bond\n", addr);
+			bt_unpair(BT_ID_DEFAULT, bt_conn_get_dst(conn));
+		} else {
+			printk("Split link security failed: %s err %d\n",
+			       addr, err);
+		}
+		return;
+	}
+#endif
+
 	if (!err) {
 		printk("Security changed: %s level %u\n", addr, level);
 		in_pairing_mode = false;
@@ -556,9 +946,6 @@ static void security_changed(struct bt_conn *conn, bt_security_t level,
 		printk("Security failed: %s level %u err %d\n", addr, level,
 			err);
 	}
-#ifdef dev_mode
-	//gatt_discover(conn);
-#endif
 }
 
 
@@ -576,7 +963,7 @@ static void scan_init(void)
 	struct bt_scan_init_param scan_init = {
 		.connect_if_match = 1,
 		.scan_param = NULL,
-		.conn_param = BT_LE_CONN_PARAM_DEFAULT
+		.conn_param = SPLIT_LINK_CONN_PARAM
 	};
 
 	bt_scan_init(&scan_init);
@@ -595,100 +982,28 @@ static void scan_init(void)
 	}
 }
 
-void create_report(bool down, bool l_or_r, uint32_t position);
-
-void call_key_report(void){
-	static uint32_t has_changed = 0;
-	if(kbds.keystates != 0xff){
-		if(kbds.keystates == 0xff){
-			printk("ignored, illigal keystate: %x\n", kbds.keystates);
-			return;
-		}
-	has_changed = kbds.keystates ^ last_keystate_left;	
-	}
-	//first need to deal with layer select
-	layer_selection = 0;
-	
-	if(is_ith_bit_set(keystate_right,19) || is_ith_bit_set(last_keystate_right,19)){
-		layer_selection = 2;
-	}
-
-	if(kbds.keystates != 0xff){
-		if(is_ith_bit_set(kbds.keystates,22) && is_ith_bit_set(keystate_right,19) || 
-		is_ith_bit_set(last_keystate_left,22) && is_ith_bit_set(last_keystate_right,19)){
-			layer_selection = 3;
-		}
-		else if(is_ith_bit_set(kbds.keystates,22) || is_ith_bit_set(last_keystate_left,22)){
-			layer_selection = 1;
-		}
-	}
-
-	/*
-	else if(!is_ith_bit_set(kbds.keystates,22) || !is_ith_bit_set(last_keystate_left,22)){
-		layer_selection = 0;
-	}
-	*/
-
-	if(layer_selection != 0){
-		printk("layer_selection is %x\n", layer_selection);
-	}
+/* Action each key was pressed with, so it is released the same way even
+ * if the layer changed in between.
+ */
+static struct keymap_action pressed_action[KEYMAP_SIDES][KEYMAP_POSITIONS];
 
-	if(kbds.keystates != 0xff){
-		//checking left
-		for(uint32_t i=0; i<25; i++){
-			if(has_changed & (1 << (i-1) )){
-				printk("we got a change, it's position is %d!\n",i-1);
-				printk("This is the keystate %x\n", kbds.keystates);
-				if(kbds.keystates & (1 << (i-1))){
-					printk("press\n");
-					create_report(true, true, i-1);
-				}else{
-					printk("release\n\n");
-					create_report(false, true, i-1);
-				}
-			}
-		}
-		last_keystate_left = kbds.keystates;
-	}
-
-	//checking right
-	for(uint32_t i=0; i<25; i++){
-		if(right_keystate_change & (1 << (i-1) )){
-			printk("we got a change, it's position is %d!\n",i-1);
-			printk("This is the keystate %x\n", last_keystate_right);
-			if(last_keystate_right & (1 << (i-1))){
-				printk("press\n");
-				create_report(true, false, i-1);
-			}else{
-				printk("release\n\n");
-				create_report(false, false, i-1);
-			}
-		}
-	}
-	return;
-}
 
 static void notify_keystates_cb(struct bt_kbds_client *kbds,
-				    uint32_t keystates)
+				const struct keyset *keystates)
 {
-	char addr[BT_ADDR_LE_STR_LEN];
-	int err;
-	int j=0;
-	uint32_t has_changed = 0;
+	int side;
 
-	bt_addr_le_to_str(bt_conn_get_dst(bt_kbds_conn(kbds)),
-			  addr, sizeof(addr));
-	if (keystates == BT_KBDS_VAL_INVALID) {
-		printk("[%s] Battery notification aborted\n", addr);
-	} else {
-		//printk("[%s] Battery notification: %"PRIu8"%%\n",
-		//       addr, keystates);
-		printk("[%s] Battery notification: %x \n",
-		       addr, keystates);
-		if(conn_mode[0].conn){
-			printk("We are connected to a central and have recived a notification.\n");
-			//printk("%x \n",key_map_left[0][0][0]);
-		}
+	if (!keystates) {
+		LOG_INF("Module %u notification aborted",
+			bt_kbds_module_id(kbds));
+		return;
+	}
+
+	LOG_DBG("Module %u notification: %u keys pressed",
+		bt_kbds_module_id(kbds), keyset_count(keystates));
+	side = kbds_side(kbds);
+	if (side >= 0) {
+		module_keystate_set(side, keystates);
 	}
 }
 
@@ -806,14 +1121,26 @@ static void hid_init(void)
 		0x75, 0x08,       /* Report Size (8) */
 		0x81, 0x01,       /* Input (Constant) reserved byte(1) */
 
+#if defined(CONFIG_KB_HID_NKRO)
+		0x95, KEY_BITMAP_USAGE_MAX + 1, /* Report Count (128) */
+		0x75, 0x01,       /* Report Size (1) */
+		0x15, 0x00,       /* Logical Minimum (0) */
+		0x25, 0x01,       /* Logical Maximum (1) */
+		0x05, 0x07,       /* Usage Page (Key codes) */
+		0x19, 0x00,       /* Usage Minimum (0) */
+		0x29, KEY_BITMAP_USAGE_MAX, /* Usage Maximum (127) */
+		0x81, 0x02,       /* Input (Data, Variable, Absolute) */
+				  /* Key bitmap(16 bytes) */
+#else
 		0x95, 0x06,       /* Report Count (6) */
 		0x75, 0x08,       /* Report Size (8) */
 		0x15, 0x00,       /* Logical Minimum (0) */
-		0x25, 0x65,       /* Logical Maximum (101) */
+		0x25, KEY_BITMAP_USAGE_MAX, /* Logical Maximum (127) */
 		0x05, 0x07,       /* Usage Page (Key codes) */
 		0x19, 0x00,       /* Usage Minimum (0) */
-		0x29, 0x65,       /* Usage Maximum (101) */
+		0x29, KEY_BITMAP_USAGE_MAX, /* Usage Maximum (127) */
 		0x81, 0x00,       /* Input (Data, Array) Key array(6 bytes) */
+#endif
 
 		/* LED */
 #if OUTPUT_REP_KEYS_REF_ID
@@ -896,7 +1223,7 @@ static void auth_passkey_confirm(struct bt_conn *conn, unsigned int passkey)
 	 * be proccess from queue after handling the earlier ones.
 	 */
 	if (k_msgq_num_used_get(&mitm_queue) == 1) {
-		k_work_submit(&pairing_work);
+		bg_work_submit(&pairing_work);
 	}
 }
 
@@ -954,6 +1281,50 @@ static struct bt_conn_auth_info_cb conn_auth_info_callbacks = {
 };
 
 
+/* Slot a report notification on a connection object was sent from, the
+ * object may have been reused by a new connection since.
+ */
+static struct report_queue *sent_queue_find(struct bt_conn *conn)
+{
+	/* Notifications of a lost connection were sent, and complete,
+	 * before those of a new connection on the same object.
+	 */
+	for (size_t i = 0; i < CONFIG_BT_HIDS_MAX_CLIENT_COUNT; i++) {
+		if (conn_mode[i].lost == conn &&
+		    atomic_get(&conn_mode[i].queue.in_flight) > 0) {
+			return &conn_mode[i].queue;
+		}
+	}
+
+	for (size_t i = 0; i < CONFIG_BT_HIDS_MAX_CLIENT_COUNT; i++) {
+		if (conn_mode[i].conn == conn &&
+		    atomic_get(&conn_mode[i].queue.in_flight) > 0) {
+			return &conn_mode[i].queue;
+		}
+	}
+
+	return NULL;
+}
+
+/* Send-complete callback of every report notification. */
+static void key_report_sent(struct bt_conn *conn, void *user_data)
+{
+	struct report_queue *queue = sent_queue_find(conn);
+	uint32_t trace;
+
+	if (queue) {
+		/* Read the ID before the slot is free again. */
+		trace = queue->trace_in_flight[queue->trace_done];
+		queue->trace_done = (queue->trace_done + 1) %
+				    CONFIG_KB_HID_REPORTS_IN_FLIGHT;
+		atomic_dec(&queue->in_flight);
+		trace_report_sent(trace);
+	}
+
+	/* Room for the next report, wake the HID thread to send it. */
+	k_sem_give(&hid_evt_sem);
+}
+
 /** @brief Function process keyboard state and sends it
  *
  *  @param pstate     The state to be sent
@@ -966,120 +1337,165 @@ static int key_report_con_send(const struct keyboard_state *state,
 			bool boot_mode,
 			struct bt_conn *conn)
 {
-	int err = 0;
-	uint8_t  data[INPUT_REPORT_KEYS_MAX_LEN];
-	uint8_t *key_data;
-	const uint8_t *key_state;
-	size_t n;
+	uint8_t  data[MAX(INPUT_REPORT_KEYS_MAX_LEN, BOOT_REPORT_KEYS_LEN)];
+	size_t len = hid_report_encode(state, boot_mode, data);
+	bt_gatt_complete_func_t sent_cb = key_report_sent;
 
-	data[0] = state->ctrl_keys_state;
-	data[1] = 0;
-	key_data = &data[2];
-	key_state = state->keys_state;
-	
-	printk("%x %x | ",data[0], data[1]);
-	for (n = 0; n < KEY_PRESS_MAX; ++n) {
-		printk("%x ",*key_state);
-		*key_data++ = *key_state++;
-	}
-	printk("\n");
 	if (boot_mode) {
-		err = bt_hids_boot_kb_inp_rep_send(&hids_obj, conn, data,
-							sizeof(data), NULL);
-		printk("in boot mode apparently?\n");
-	} else {
-		err = bt_hids_inp_rep_send(&hids_obj, conn,
-						INPUT_REP_KEYS_IDX, data,
-						sizeof(data), NULL);
-		//printk("data sent \n");
+		return bt_hids_boot_kb_inp_rep_send(&hids_obj, conn, data, len,
+						    sent_cb);
 	}
-	
-	return err;
+
+	return bt_hids_inp_rep_send(&hids_obj, conn, INPUT_REP_KEYS_IDX, data,
+				    len, sent_cb);
 }
 
-/** @brief Function process and send keyboard state to all active connections
+/** @brief Queue a report for one host
  *
- * Function process global keyboard state and send it to all connected
- * clients.
+ *  If the queue is full the host is congested, and the newest queued
+ *  report is replaced: the host skips that intermediate state but still
+ *  gets every report queued before it and the latest state.
  *
- * @return 0 on success or negative error code.
+ *  @param queue Report queue of the host.
+ *  @param state Keyboard state to send.
+ *  @param trace Trace ID of the report.
  */
-static int key_report_send(void)
+static void report_queue_put(struct report_queue *queue,
+			     const struct keyboard_state *state,
+			     uint32_t trace)
 {
-	for (size_t i = 0; i < CONFIG_BT_HIDS_MAX_CLIENT_COUNT; i++) {
-		if (conn_mode[i].conn) {
-			int err;
-
-			err = key_report_con_send(&hid_keyboard_state,
-						  conn_mode[i].in_boot_mode,
-						  conn_mode[i].conn);
-			if (err) {
-				printk("Key report send error: %d\n", err);
-				return err;
-			}
-			printk("sent key_report\n");
-		}
+	size_t idx;
+
+	if (queue->cnt == CONFIG_KB_HID_REPORT_QUEUE_SIZE) {
+		idx = (queue->head + queue->cnt - 1) %
+		      CONFIG_KB_HID_REPORT_QUEUE_SIZE;
+		queue->collapsed++;
+		LOG_WRN("Report queue full, %u reports collapsed",
+			queue->collapsed);
+	} else {
+		idx = (queue->head + queue->cnt) %
+		      CONFIG_KB_HID_REPORT_QUEUE_SIZE;
+		queue->cnt++;
 	}
-	return 0;
+
+	queue->report[idx] = *state;
+	queue->trace[idx] = trace;
 }
 
-/** @brief Change key code to ctrl code mask
+/** @brief Send the queued reports of one host
  *
- *  Function changes the key code to the mask in the control code
- *  field inside the raport.
- *  Returns 0 if key code is not a control key.
+ *  Sends until KB_HID_REPORTS_IN_FLIGHT notifications are in flight, the
+ *  rest go out as the earlier ones complete. The thread never waits for a
+ *  TX buffer held by a congested host.
  *
- *  @param key Key code
+ *  @param mode Host slot.
+ *  @param conn Connection of the host.
  *
- *  @return Mask of the control key or 0.
+ *  @return 0 on success, -ENOMEM if a report waits for a TX buffer.
  */
-static uint8_t button_ctrl_code(uint8_t key)
+static int report_queue_send(struct conn_mode *mode, struct bt_conn *conn)
 {
-	if (KEY_CTRL_CODE_MIN <= key && key <= KEY_CTRL_CODE_MAX) {
-		return (uint8_t)(1U << (key - KEY_CTRL_CODE_MIN));
+	struct report_queue *queue = &mode->queue;
+	int err;
+
+	while (queue->cnt &&
+	       atomic_get(&queue->in_flight) < CONFIG_KB_HID_REPORTS_IN_FLIGHT) {
+		/* The notification may complete before the send returns. */
+		queue->trace_in_flight[queue->trace_sent] =
+			queue->trace[queue->head];
+		atomic_inc(&queue->in_flight);
+		err = key_report_con_send(&queue->report[queue->head],
+					  mode->in_boot_mode, conn);
+		if (!err) {
+			queue->trace_sent = (queue->trace_sent + 1) %
+					    CONFIG_KB_HID_REPORTS_IN_FLIGHT;
+		} else {
+			atomic_dec(&queue->in_flight);
+			if (err == -ENOMEM || err == -ENOBUFS) {
+				/* Try again once a buffer is free. */
+				return -ENOMEM;
+			}
+			queue->dropped++;
+			LOG_WRN("Key report send error: %d, %u dropped", err,
+				queue->dropped);
+		}
+
+		queue->head = (queue->head + 1) %
+			      CONFIG_KB_HID_REPORT_QUEUE_SIZE;
+		queue->cnt--;
 	}
+
 	return 0;
 }
 
-
-static int hid_kbd_state_key_set(uint8_t key)
+/* Connection of a host slot, NULL while it has none or the HID thread
+ * has not started it yet.
+ */
+static struct bt_conn *host_conn(size_t idx)
 {
-	//printk("In setting kbd state\n");
-	uint8_t ctrl_mask = button_ctrl_code(key);
+	struct bt_conn *conn = conn_mode[idx].conn;
 
-	if (ctrl_mask) {
-		hid_keyboard_state.ctrl_keys_state |= ctrl_mask;
-		printk("matches a control key\n");
-		return 0;
+	/* connected() flags a new host before it sets the connection. */
+	if (atomic_test_bit(&hosts_new, idx)) {
+		return NULL;
 	}
-	for (size_t i = 0; i < KEY_CTRL_CODE_MAX; ++i) {
-		if (hid_keyboard_state.keys_state[i] == 0) {
-			hid_keyboard_state.keys_state[i] = key;
-			return 0;
+
+	return conn;
+}
+
+/** @brief Send the queued reports of all hosts
+ *
+ *  A congested host does not hold up the others.
+ *
+ *  @return 0 on success, -ENOMEM if a report waits for a TX buffer.
+ */
+static int report_queues_send(void)
+{
+	struct bt_conn *conn;
+	int ret = 0;
+
+	for (size_t i = 0; i < CONFIG_BT_HIDS_MAX_CLIENT_COUNT; i++) {
+		conn = host_conn(i);
+		if (conn && report_queue_send(&conn_mode[i], conn)) {
+			ret = -ENOMEM;
 		}
 	}
-	/* All slots busy */
-	printk("we busy\n");
-	return -EBUSY;
-}
 
+	return ret;
+}
 
-static int hid_kbd_state_key_clear(uint8_t key)
+/** @brief Queue the keyboard state for all active connections
+ *
+ * Function queues the global keyboard state for every connected client.
+ * report_queues_send() sends it.
+ *
+ * @param trace Trace ID of the report.
+ *
+ * @return Number of clients the state was queued for.
+ */
+static size_t key_report_queue(uint32_t trace)
 {
-	uint8_t ctrl_mask = button_ctrl_code(key);
+	size_t cnt = 0;
 
-	if (ctrl_mask) {
-		hid_keyboard_state.ctrl_keys_state &= ~ctrl_mask;
-		return 0;
-	}
-	for (size_t i = 0; i < KEY_CTRL_CODE_MAX; ++i) {
-		if (hid_keyboard_state.keys_state[i] == key) {
-			hid_keyboard_state.keys_state[i] = 0;
-			return 0;
+	for (size_t i = 0; i < CONFIG_BT_HIDS_MAX_CLIENT_COUNT; i++) {
+		if (host_conn(i)) {
+			report_queue_put(&conn_mode[i].queue,
+					 &hid_keyboard_state, trace);
+			cnt++;
 		}
 	}
-	/* Key not found */
-	return -EINVAL;
+
+	return cnt;
+}
+
+static int hid_kbd_state_key_set(uint8_t key)
+{
+	return hid_report_key_write(&hid_keyboard_state, key, true);
+}
+
+static int hid_kbd_state_key_clear(uint8_t key)
+{
+	return hid_report_key_write(&hid_keyboard_state, key, false);
 }
 
 /** @brief Press a button and send report
@@ -1097,15 +1513,15 @@ static int hid_buttons_press(const uint8_t *keys, size_t cnt)
 
 		err = hid_kbd_state_key_set(*keys++);
 		if (err) {
-			printk("Cannot set selected key.\n");
+			LOG_ERR("Cannot set selected key.");
 			return err;
 		}
 	}
 #ifndef dev_mode
-	return key_report_send();
-#else
-	return 0;
+	/* The HID thread queues and sends the report. */
+	k_sem_give(&hid_evt_sem);
 #endif
+	return 0;
 }
 
 /** @brief Release the button and send report
@@ -1123,48 +1539,29 @@ static int hid_buttons_release(const uint8_t *keys, size_t cnt)
 
 		err = hid_kbd_state_key_clear(*keys++);
 		if (err) {
-			printk("Cannot clear selected key.\n");
+			LOG_ERR("Cannot clear selected key.");
 			return err;
 		}
 	}
 
 #ifndef dev_mode
-	return key_report_send();
+	/* The HID thread queues and sends the report. */
+	k_sem_give(&hid_evt_sem);
 #endif
+	return 0;
 }
 
 
 static void button_text_changed(bool down)
 {
 #ifdef single_change
+	static const uint8_t single_keys[] = {
+		KEY_H, KEY_E, KEY_L, KEY_L, KEY_O, KEY_ENTER
+	};
 	static int i = 0;
-	//static const uint8_t *chr = &key_map_left[0][1][1];
 	static const uint8_t *chr;
 	if(down){
-		switch (i)
-		{
-			case 0:
-				chr = &key_map_right[0][1][0];
-				break;
-			case 1:
-				chr = &key_map_left[0][0][3];
-				break;
-			case 2:
-				chr = &key_map_right[0][1][3];
-				break;
-			case 3:
-				chr = &key_map_right[0][1][3];
-				break;
-			case 4:
-				chr = &key_map_right[0][0][3];
-				break;
-			case 5:
-				chr = &key_map_right[0][3][0];
-				break;
-			default:
-				printk("didn't pick any case\n");
-				break;
-		}
+		chr = &single_keys[i];
 		if(i>=5){i=0;}
 		else{i++;}
 	}
@@ -1188,28 +1585,6 @@ static void button_text_changed(bool down)
 #endif
 }
 
-#ifdef dev_mode
-static void button_text_change(bool down, bool l_or_r, int i, int j, int k)
-{
-	static const uint8_t *chr;
-	if(l_or_r){
-		printk("Using left key map\n");
-		chr = &key_map_left[i][j][k];
-	}
-	else{
-		printk("Using right key map\n");
-		chr = &key_map_right[i][j][k];
-	}
-
-	if (down) {
-		hid_buttons_press(chr, 1);
-	} else {
-		hid_buttons_release(chr, 1);
-	}
-	return;
-}
-#endif
-
 static void button_shift_changed(bool down)
 {
 	if (down) {
@@ -1242,7 +1617,7 @@ static void num_comp_reply(bool accept)
 	bt_conn_unref(pairing_data.conn);
 
 	if (k_msgq_num_used_get(&mitm_queue)) {
-		k_work_submit(&pairing_work);
+		bg_work_submit(&pairing_work);
 	}
 }
 
@@ -1343,60 +1718,89 @@ uint32_t pairing_mode(uint32_t last_keystate_right, uint32_t right_keystate_chan
 #endif
 
 #ifdef dev_mode
-void create_report(bool down, bool l_or_r, uint32_t position){
-	#define LAYER_KEY_1 22
-	#define LAYER_KEY_2 19
-	uint8_t *(key_map[4][4][6]);
-	int j = 0, k = 0;
-
-	//need to mess with this logic to implement layer switching
-	if(l_or_r && (position == 22)){return;}
-	if(!l_or_r && (position == 19)){return;}
-
-	j = position / 6;
-	k = position % 6;
-	//hard coding the fix for the second layer shift problem  
-	if(layer_selection == 2 && (j == 0) && ((l_or_r && k > 0) || (!l_or_r && k < 5))){
-		set_or_clear_mod_byte(&hid_keyboard_state.ctrl_keys_state, down, &(key_map_left[0][2][0]));
-	}
-
-	printk("These are the indexes i: %d, j: %d, k: %d\n", layer_selection,j,k);
-	printk("This is what it should be sending %x \n", key_map_left[layer_selection][j][k]);
-	uint8_t *chr;
-	if(l_or_r){//left_key_map
-		//key_map = &key_map_left;
-		chr = &(key_map_left[layer_selection][j][k]);
-		if(is_mod_chr(l_or_r,position)){
-			set_or_clear_mod_byte(&hid_keyboard_state.ctrl_keys_state, down, &(key_map_left[layer_selection][j][k]));
-		}else{
-			button_text_change(down, l_or_r, layer_selection, j, k);
+/* Modifiers of all held key and modifier actions, from their modifier
+ * masks and from modifier key codes.
+ */
+static uint8_t held_mods(void)
+{
+	uint8_t mods = 0;
+
+	for (size_t side = 0; side < KEYMAP_SIDES; side++) {
+		for (size_t pos = 0; pos < KEYMAP_POSITIONS; pos++) {
+			const struct keymap_action *action =
+				&pressed_action[side][pos];
+
+			if (action->type != KEYMAP_ACT_KEY &&
+			    action->type != KEYMAP_ACT_MOD) {
+				continue;
+			}
+
+			mods |= action->mods;
+			if (action->code >= KEY_CTRL_CODE_MIN &&
+			    action->code <= KEY_CTRL_CODE_MAX) {
+				mods |= BIT(action->code - KEY_CTRL_CODE_MIN);
+			}
 		}
-	}else{//right_key_map
-		//key_map = &key_map_right;
-		chr = &(key_map_right[layer_selection][j][k]);
-		if(is_mod_chr(l_or_r,position)){
-			set_or_clear_mod_byte(&hid_keyboard_state.ctrl_keys_state, down, &(key_map_right[layer_selection][j][k]));
-		}else{
-			button_text_change(down, l_or_r, layer_selection, j, k);
+	}
+
+	return mods;
+}
+
+/* A released action must no longer be in pressed_action. */
+static void key_action_apply(const struct keymap_action *action, bool pressed)
+{
+	switch (action->type) {
+	case KEYMAP_ACT_KEY:
+	case KEYMAP_ACT_MOD:
+		/* Modifier actions have no key code, which is ignored. */
+		hid_report_key_write(&hid_keyboard_state, action->code,
+				     pressed);
+		if (pressed) {
+			hid_keyboard_state.ctrl_keys_state |= action->mods;
+		} else {
+			/* Keep the modifiers other held keys hold as well,
+			 * such as a Shift held under a shifted key.
+			 */
+			hid_keyboard_state.ctrl_keys_state = held_mods();
 		}
+		break;
+	case KEYMAP_ACT_LAYER:
+		keymap_layer_hold(action->code, pressed);
+		break;
+	default:
+		break;
 	}
+}
 
-	key_report_send();
-	return;
-} 
+/* Resolve a key change on the active layers and update the HID state. */
+static void keymap_key_changed(uint8_t side, uint8_t position, bool pressed)
+{
+	struct keymap_action *action;
 
-#define NUM_OF_ROW 4
-#define NUM_OF_COL 6
-#define NUM_OF_BUT 0
+	if (side >= KEYMAP_SIDES || position >= KEYMAP_POSITIONS) {
+		return;
+	}
+
+	action = &pressed_action[side][position];
+	if (pressed) {
+		*action = *keymap_action_resolve(side, position);
+		key_action_apply(action, true);
+	} else {
+		struct keymap_action released = *action;
+
+		action->type = KEYMAP_ACT_NONE;
+		key_action_apply(&released, false);
+	}
+}
 
 #ifndef dongle
-const static struct gpio_dt_spec row[NUM_OF_ROW] = {GPIO_DT_SPEC_GET(DT_ALIAS(pin12 ),gpios),//12	
+const static struct gpio_dt_spec row[MATRIX_ROWS] = {GPIO_DT_SPEC_GET(DT_ALIAS(pin12 ),gpios),//12	
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin11 ),gpios),	
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin4),gpios),	
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin3),gpios)//3
 													};
 
-const static struct gpio_dt_spec col[NUM_OF_COL] = {GPIO_DT_SPEC_GET(DT_ALIAS(pin22),gpios),	
+const static struct gpio_dt_spec col[MATRIX_COLS] = {GPIO_DT_SPEC_GET(DT_ALIAS(pin22),gpios),	
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin23),gpios),	
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin24),gpios),	
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin25),gpios),	
@@ -1404,13 +1808,13 @@ const static struct gpio_dt_spec col[NUM_OF_COL] = {GPIO_DT_SPEC_GET(DT_ALIAS(pi
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin27),gpios)	
 													};
 #else
-const static struct gpio_dt_spec row[NUM_OF_ROW] = {GPIO_DT_SPEC_GET(DT_ALIAS(pin2 ),gpios),	
+const static struct gpio_dt_spec row[MATRIX_ROWS] = {GPIO_DT_SPEC_GET(DT_ALIAS(pin2 ),gpios),	
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin29 ),gpios),	
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin31),gpios),	
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin9),gpios)
 													};
 
-const static struct gpio_dt_spec col[NUM_OF_COL] = {GPIO_DT_SPEC_GET(DT_ALIAS(pin13),gpios),//24
+const static struct gpio_dt_spec col[MATRIX_COLS] = {GPIO_DT_SPEC_GET(DT_ALIAS(pin13),gpios),//24
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin15),gpios),//22
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin17),gpios),//20
 													GPIO_DT_SPEC_GET(DT_ALIAS(pin20),gpios),//17	
@@ -1419,23 +1823,26 @@ const static struct gpio_dt_spec col[NUM_OF_COL] = {GPIO_DT_SPEC_GET(DT_ALIAS(pi
 													};
 #endif
 
+static void right_matrix_changed(const struct keyset *key_state,
+				 const struct keyset *has_changed)
+{
+	uint32_t now = bt_kbds_time_get();
+
+	KEYSET_FOREACH(has_changed, i) {
+		trace_key(TRACE_MATRIX, KEYMAP_RIGHT, i);
+		/* The matrix has stored the new state already. */
+		if (!hid_evt_put(KEYMAP_RIGHT, i, keyset_test(key_state, i),
+				 now)) {
+			evt_resync_request(KEYMAP_RIGHT);
+		}
+	}
+}
+
 int gpio_init(void){
     int err;
-    for(int i = 0; i<NUM_OF_ROW; i++){
-		err = gpio_pin_configure_dt(&row[i],GPIO_OUTPUT);
-        if(err){
-            printk("Couldn't configure row[%d]\n", i);
-        }
-		err = gpio_pin_set_dt(&row[i],0);
-        if(err){
-            printk("Couldn't set row[%d]\n", i);
-        }
-    }
-    for(int i = 0; i<NUM_OF_COL; i++){
-		err = gpio_pin_configure_dt(&col[i],GPIO_INPUT);
-        if(err){
-            printk("Couldn't configure col[%d]\n", i);
-        }
+	err = matrix_init(row, col, right_matrix_changed);
+    if(err){
+        printk("Couldn't init key matrix (err %d)\n", err);
     }
 #ifdef dongle
     for(int i = 0; i<NUM_OF_LED; i++){
@@ -1452,36 +1859,205 @@ int gpio_init(void){
     return err;
 }
 
-uint32_t get_keystate(uint32_t last_button_state, uint32_t *has_changed){
-	static uint32_t button_state;
-	button_state = 0;
-    //printk("getting right keystate \n");
+static void hid_evt_process(const struct hid_evt *evt)
+{
+	keyset_write(&last_keystate[evt->side], evt->position, evt->pressed);
+
+	if(in_pairing_mode){
+		/* The pairing buttons are within the first 32 keys. */
+		if(evt->side == KEYMAP_RIGHT && evt->position < 32){
+			pairing_mode(last_keystate[KEYMAP_RIGHT].word[0],
+				     BIT(evt->position));
+		}
+		return;
+	}
+
+	/* Keep the HID state current while no host is connected, so the
+	 * first report after connecting is right.
+	 */
+	keymap_key_changed(evt->side, evt->position, evt->pressed);
+	trace_key(TRACE_HID_APPLY, evt->side, evt->position);
+}
+
+static uint32_t merge_window(void)
+{
+	/* Without a module there is nothing to wait for. */
+	if (!bt_kbds_client_count()) {
+		return 0;
+	}
+
+	return CONFIG_KB_HID_MERGE_WINDOW_US / BT_KBDS_EVT_TIME_UNIT_US;
+}
+
+/* Events that put a key in the state it is in already are left out, as
+ * the ring still holds those of a change a resync has inserted.
+ */
+static void hid_evt_insert(const struct hid_evt *evt)
+{
+	struct keyset *merged = &merged_keystate[evt->side];
+
+	if (keyset_test(merged, evt->position) == evt->pressed) {
+		return;
+	}
+
+	keyset_write(merged, evt->position, evt->pressed);
+	evt_merge_insert(evt);
+}
+
+/* Insert the changes lost to a full ring, found by diffing the full key
+ * state of the side against what was inserted. They are timed now.
+ */
+static void evt_resync_apply(void)
+{
+	struct keyset keystate;
+	struct keyset has_changed;
+	k_spinlock_key_t key;
+
+	for (uint8_t side = 0; side < KEYMAP_SIDES; side++) {
+		if (!atomic_test_and_clear_bit(&evt_resync, side)) {
+			continue;
+		}
+
+		if (side == KEYMAP_RIGHT) {
+			matrix_get_keystate(&keystate);
+		} else {
+			/* The module ring has all of it after this. */
+			key = k_spin_lock(&module_keystate_lock);
+			keystate = module_keystate[side];
+			module_keystate_rx[side] = keystate;
+			k_spin_unlock(&module_keystate_lock, key);
+		}
+
+		keyset_xor(&has_changed, &keystate, &merged_keystate[side]);
+		LOG_INF("Side %u resynced, %u keys changed", side,
+			keyset_count(&has_changed));
+		KEYSET_FOREACH(&has_changed, i) {
+			struct hid_evt evt = {
+				.time = bt_kbds_time_get(),
+				.position = i,
+				.side = side,
+				.pressed = keyset_test(&keystate, i),
+			};
+
+			hid_evt_insert(&evt);
+		}
+	}
+}
+
+/* Apply the events that are due. Returns how long the oldest of the
+ * remaining events still has to wait.
+ */
+static k_timeout_t merge_release(void)
+{
+	int32_t wait = evt_merge_release(bt_kbds_time_get(), merge_window(),
+					 bt_kbds_client_count() > 1);
+
+	if (!wait) {
+		return K_FOREVER;
+	}
+
+	return K_USEC(wait * BT_KBDS_EVT_TIME_UNIT_US);
+}
+#endif /* dev_mode */
+
+/* Start the queue of a new host with the current state, which has keys
+ * held already if it joins or reconnects while they are.
+ */
+static void host_start(struct conn_mode *mode)
+{
+	struct report_queue *queue = &mode->queue;
+
+	/* Notifications of a lost connection may still be in flight. */
+	queue->head = 0;
+	queue->cnt = 0;
+	queue->collapsed = 0;
+	queue->dropped = 0;
+
+	report_queue_put(queue, &hid_keyboard_state, trace_report_build());
+}
 
-	for(int i = 0; i<NUM_OF_ROW; i++){
-		gpio_pin_set_dt(&row[i],1); //set pin to GND
-		for(int j = 0; j<NUM_OF_COL; j++){
-			button_state |= gpio_pin_get_dt(&col[j]) << (NUM_OF_BUT + (NUM_OF_ROW - 1 -i )*
-														NUM_OF_COL + (NUM_OF_COL-1 -j));
+/* Queue the keyboard state if it differs from the last report queued,
+ * start the new hosts, and send the queued reports the connections have
+ * room for.
+ */
+static int key_report_flush(void)
+{
+	static struct keyboard_state sent;
+	bool started = false;
+
+	if (memcmp(&sent, &hid_keyboard_state, sizeof(sent))) {
+		uint32_t trace = trace_report_build();
+
+		if (key_report_queue(trace)) {
+			sent = hid_keyboard_state;
+		} else {
+			trace_report_discard(trace);
+		}
+	}
+
+	for (size_t i = 0; i < CONFIG_BT_HIDS_MAX_CLIENT_COUNT; i++) {
+		if (atomic_test_and_clear_bit(&hosts_new, i)) {
+			host_start(&conn_mode[i]);
+			started = true;
 		}
-		gpio_pin_set_dt(&row[i],0); //set pin to VCC
+	}
+	/* Every host has the current state now. */
+	if (started) {
+		sent = hid_keyboard_state;
 	}
 
-	*has_changed = button_state ^ last_button_state;
-	//if you want to analyse the button_state, do it between these 2 operations of has_changed ^^
-	return button_state;
+	return report_queues_send();
 }
 
+/* Reports go out as soon as the key events of either half are due.
+ * Events that are due together are applied in the order they happened
+ * and sent as one report, so chords and modifier combos reach the host
+ * atomically.
+ */
+static void hid_thread_fn(void)
+{
+	k_timeout_t timeout = K_FOREVER;
+#ifdef dev_mode
+	struct hid_evt evt;
 #endif
 
+	for (;;) {
+		k_sem_take(&hid_evt_sem, timeout);
+		timeout = K_FOREVER;
+
+#ifdef dev_mode
+		/* The merge buffer orders the events of both rings. */
+		while (spsc_ring_get(&module_evt_ring, &evt)) {
+			hid_evt_insert(&evt);
+		}
+		while (spsc_ring_get(&right_evt_ring, &evt)) {
+			hid_evt_insert(&evt);
+		}
+		evt_resync_apply();
+
+		timeout = merge_release();
+#endif
+		if (key_report_flush() == -ENOMEM &&
+		    K_TIMEOUT_EQ(timeout, K_FOREVER)) {
+			timeout = K_MSEC(REPORT_RETRY_MS);
+		}
+	}
+}
+
+K_THREAD_DEFINE(hid_thread, CONFIG_KB_HID_THREAD_STACK_SIZE, hid_thread_fn,
+		NULL, NULL, NULL, CONFIG_KB_HID_THREAD_PRIORITY, 0, 0);
+
 void main(void)
 {
 	int err;
-	int blink_status = 0;
 
 	printk("Starting Bluetooth Peripheral HIDS keyboard example\n");
 
 #ifndef dev_mode
 	configure_gpio();
+#else
+	keymap_init();
+	evt_merge_init(KEYMAP_RIGHT, hid_evt_process);
 #endif
 	gpio_init();
 
@@ -1497,7 +2073,7 @@ void main(void)
 		return;
 	}
 #ifdef dev_mode
-	bt_kbds_client_init(&kbds);
+	split_link_init(&split_link_callbacks);
 #endif
 
 	err = bt_enable(NULL);
@@ -1518,38 +2094,12 @@ void main(void)
 
 #ifdef dev_mode
 	scan_init();
-
-	err = bt_scan_start(BT_SCAN_TYPE_SCAN_ACTIVE);
-	if (err) {
-		printk("Scanning failed to start (err %d)\n", err);
-		return;
-	}
-	printk("scanning started\n");
-
+	split_connect();
 #endif
 
 	k_work_init(&pairing_work, pairing_process);
 
-	for (;;) {
-		/*
-		if (is_adv) {
-			dk_set_led(ADV_STATUS_LED, (++blink_status) % 2);
-		} else {
-			dk_set_led_off(ADV_STATUS_LED);
-		}
-		*/
-		k_sleep(K_MSEC(ADV_LED_BLINK_INTERVAL));
-#ifdef dev_mode
-		if(conn_mode[0].conn && !in_pairing_mode){
-			call_key_report();
-			last_keystate_right = get_keystate(last_keystate_right, &right_keystate_change);
-			//gpio_pin_set_dt(&led[DEBUG_LED],0);
-		}else if(in_pairing_mode){
-			//gpio_pin_set_dt(&led[DEBUG_LED],1);
-			last_keystate_right = get_keystate(last_keystate_right, &right_keystate_change);
-			last_keystate_right = pairing_mode(last_keystate_right, right_keystate_change);
-		}
-#endif
-		/* Battery level simulation */
-	}
+	/* Key events are handled by the HID thread, nothing left to do
+	 * here.
+	 */
 }
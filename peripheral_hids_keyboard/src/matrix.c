@@ -0,0 +1,593 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Interrupt driven key matrix scanning
+ *
+ * Scans run on a cooperative thread of their own, woken by a periodic
+ * k_timer. The timer expires on absolute deadlines, so the time a scan
+ * takes or waits for the CPU does not add up to drift the scan period,
+ * and no work on the system workqueue delays a scan.
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#if defined(CONFIG_SHELL)
+#include <stdlib.h>
+#include <zephyr/shell/shell.h>
+#endif
+
+#include "matrix.h"
+#include "debounce.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(matrix, CONFIG_KB_MATRIX_LOG_LEVEL);
+
+enum state {
+	STATE_WAITING,
+	STATE_SCANNING,
+};
+
+static const struct gpio_dt_spec *row;
+static const struct gpio_dt_spec *col;
+static struct gpio_callback col_cb[MATRIX_COLS];
+static matrix_handler_t matrix_handler;
+
+static void scan_timer_expired(struct k_timer *timer);
+
+K_TIMER_DEFINE(scan_timer, scan_timer_expired, NULL);
+/* Given by the scan timer, wakes the scan thread. */
+K_SEM_DEFINE(scan_sem, 0, 1);
+
+static enum state state;
+static struct keyset keystate;
+static struct k_spinlock keystate_lock;
+static struct debounce debounce;
+static uint32_t last_activity;
+/* Scan timer period [ticks]. */
+static uint32_t scan_ticks;
+
+static struct k_spinlock stats_lock;
+static struct matrix_stats stats;
+static uint64_t period_sum_us;
+static uint64_t scan_sum_us;
+/* Cycles at the start of the previous scan of a burst, 0 for none. */
+static uint32_t last_scan;
+
+static int cols_interrupt_set(gpio_flags_t flags)
+{
+	int err;
+
+	for (int i = 0; i < MATRIX_COLS; i++) {
+		err = gpio_pin_interrupt_configure_dt(&col[i], flags);
+		if (err) {
+			LOG_ERR("Cannot configure col[%d] interrupt (err %d)",
+				i, err);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+#ifdef CONFIG_KB_MATRIX_PORT_IO
+/* GPIO port shared by one or more matrix pins. */
+struct matrix_port {
+	const struct device *dev;
+	/* Row pins on this port and their raw level with no row active. */
+	gpio_port_pins_t row_mask;
+	gpio_port_value_t row_idle;
+	/* Column pins on this port and the ones that are active low. */
+	gpio_port_pins_t col_mask;
+	gpio_port_value_t col_invert;
+};
+
+static struct matrix_port ports[MATRIX_ROWS + MATRIX_COLS];
+static uint8_t port_cnt;
+static uint8_t col_ports[MATRIX_COLS];
+static uint8_t col_port_cnt;
+
+/* Raw port level that drives only the given row active. */
+static struct {
+	uint8_t port;
+	gpio_port_value_t level;
+} row_map[MATRIX_ROWS];
+
+/* Bit remap table from port bits to matrix columns. */
+static struct {
+	uint8_t port;
+	gpio_port_pins_t pin;
+} col_map[MATRIX_COLS];
+
+static uint8_t port_get(const struct device *dev)
+{
+	for (uint8_t i = 0; i < port_cnt; i++) {
+		if (ports[i].dev == dev) {
+			return i;
+		}
+	}
+
+	ports[port_cnt].dev = dev;
+	return port_cnt++;
+}
+
+static void ports_init(void)
+{
+	for (int i = 0; i < MATRIX_ROWS; i++) {
+		uint8_t p = port_get(row[i].port);
+
+		ports[p].row_mask |= BIT(row[i].pin);
+		if (row[i].dt_flags & GPIO_ACTIVE_LOW) {
+			ports[p].row_idle |= BIT(row[i].pin);
+		}
+		row_map[i].port = p;
+	}
+
+	for (int i = 0; i < MATRIX_ROWS; i++) {
+		const struct matrix_port *rp = &ports[row_map[i].port];
+
+		row_map[i].level = rp->row_idle ^ BIT(row[i].pin);
+	}
+
+	for (int i = 0; i < MATRIX_COLS; i++) {
+		uint8_t p = port_get(col[i].port);
+
+		if (!ports[p].col_mask) {
+			col_ports[col_port_cnt++] = p;
+		}
+		ports[p].col_mask |= BIT(col[i].pin);
+		if (col[i].dt_flags & GPIO_ACTIVE_LOW) {
+			ports[p].col_invert |= BIT(col[i].pin);
+		}
+		col_map[i].port = p;
+		col_map[i].pin = BIT(col[i].pin);
+	}
+}
+
+static void rows_set(int value)
+{
+	for (uint8_t i = 0; i < port_cnt; i++) {
+		const struct matrix_port *p = &ports[i];
+
+		if (p->row_mask) {
+			gpio_port_set_masked_raw(p->dev, p->row_mask,
+						 value ? ~p->row_idle : p->row_idle);
+		}
+	}
+}
+
+static void cols_read(gpio_port_value_t *in)
+{
+	for (uint8_t i = 0; i < col_port_cnt; i++) {
+		const struct matrix_port *p = &ports[col_ports[i]];
+
+		gpio_port_get_raw(p->dev, &in[col_ports[i]]);
+		in[col_ports[i]] = (in[col_ports[i]] ^ p->col_invert) &
+				   p->col_mask;
+	}
+}
+
+static uint32_t cols_get(void)
+{
+	gpio_port_value_t in[ARRAY_SIZE(ports)];
+	uint32_t val = 0;
+
+	cols_read(in);
+	for (uint8_t i = 0; i < col_port_cnt; i++) {
+		val |= in[col_ports[i]];
+	}
+
+	return val;
+}
+
+static void scan(struct keyset *key_state)
+{
+	gpio_port_value_t in[ARRAY_SIZE(ports)];
+
+	keyset_clear(key_state);
+
+	for (int i = 0; i < MATRIX_ROWS; i++) {
+		const struct matrix_port *rp = &ports[row_map[i].port];
+		unsigned int pos = (MATRIX_ROWS - 1 - i) * MATRIX_COLS +
+				   (MATRIX_COLS - 1);
+
+		gpio_port_set_masked_raw(rp->dev, rp->row_mask,
+					 row_map[i].level);
+		if (CONFIG_KB_MATRIX_SETTLE_US) {
+			k_busy_wait(CONFIG_KB_MATRIX_SETTLE_US);
+		}
+		cols_read(in);
+
+		/* The next row write on the same port releases this one. */
+		if (i == MATRIX_ROWS - 1 ||
+		    row_map[i + 1].port != row_map[i].port) {
+			gpio_port_set_masked_raw(rp->dev, rp->row_mask,
+						 rp->row_idle);
+		}
+
+		for (int j = 0; j < MATRIX_COLS; j++) {
+			if (in[col_map[j].port] & col_map[j].pin) {
+				keyset_write(key_state, pos - j, true);
+			}
+		}
+	}
+}
+#else
+static void rows_set(int value)
+{
+	for (size_t i = 0; i < MATRIX_ROWS; i++) {
+		gpio_pin_set_dt(&row[i], value);
+	}
+}
+
+static uint32_t cols_get(void)
+{
+	uint32_t val = 0;
+
+	for (size_t i = 0; i < MATRIX_COLS; i++) {
+		val |= gpio_pin_get_dt(&col[i]);
+	}
+
+	return val;
+}
+
+static void scan(struct keyset *key_state)
+{
+	keyset_clear(key_state);
+
+	for (size_t i = 0; i < MATRIX_ROWS; i++) {
+		gpio_pin_set_dt(&row[i], 1); //set pin to GND
+		if (CONFIG_KB_MATRIX_SETTLE_US) {
+			k_busy_wait(CONFIG_KB_MATRIX_SETTLE_US);
+		}
+		for (size_t j = 0; j < MATRIX_COLS; j++) {
+			keyset_write(key_state,
+				     (MATRIX_ROWS - 1 - i) * MATRIX_COLS +
+				     (MATRIX_COLS - 1 - j),
+				     gpio_pin_get_dt(&col[j]) > 0);
+		}
+		gpio_pin_set_dt(&row[i], 0); //set pin to VCC
+	}
+}
+#endif /* CONFIG_KB_MATRIX_PORT_IO */
+
+static void scan_timer_expired(struct k_timer *timer)
+{
+	k_sem_give(&scan_sem);
+}
+
+/* Start a burst of periodic scans, the first one right away. */
+static void scanning_start(void)
+{
+	state = STATE_SCANNING;
+	k_timer_start(&scan_timer, K_NO_WAIT, K_TICKS(scan_ticks));
+}
+
+static void wait_for_press(void)
+{
+	/* Set first, so a trigger can no longer restart the timer. */
+	state = STATE_WAITING;
+	k_timer_stop(&scan_timer);
+	k_sem_reset(&scan_sem);
+	last_scan = 0;
+
+	/* Drive every row so that any key pulls its column active. */
+	rows_set(1);
+
+	if (cols_interrupt_set(GPIO_INT_EDGE_TO_ACTIVE)) {
+		return;
+	}
+
+	/* A key pressed before the interrupt was armed gives no edge. */
+	if (cols_get()) {
+		cols_interrupt_set(GPIO_INT_DISABLE);
+		rows_set(0);
+		scanning_start();
+	}
+}
+
+/* Time between the scans of a burst and time taken by each scan, from
+ * cycle stamps at the start and the end of the scan. The timer periods
+ * that passed without a scan count as overruns.
+ */
+static void stats_update(uint32_t start, uint32_t end, uint32_t expired)
+{
+	k_spinlock_key_t key = k_spin_lock(&stats_lock);
+	uint32_t scan = k_cyc_to_us_floor32(end - start);
+	uint32_t period;
+
+	if (!stats.scans || scan < stats.scan_min_us) {
+		stats.scan_min_us = scan;
+	}
+	stats.scan_max_us = MAX(stats.scan_max_us, scan);
+	scan_sum_us += scan;
+	stats.scans++;
+
+	if (expired > 1) {
+		stats.overruns += expired - 1;
+	}
+
+	if (last_scan) {
+		period = k_cyc_to_us_floor32(start - last_scan);
+		if (!stats.periods || period < stats.period_min_us) {
+			stats.period_min_us = period;
+		}
+		stats.period_max_us = MAX(stats.period_max_us, period);
+		period_sum_us += period;
+		stats.periods++;
+	}
+	/* 0 marks the start of a burst. */
+	last_scan = start ? start : 1;
+
+	k_spin_unlock(&stats_lock, key);
+}
+
+static void matrix_scan(void)
+{
+	struct keyset raw;
+	struct keyset has_changed;
+	const struct keyset *key_state;
+	uint32_t now = k_uptime_get_32();
+	k_spinlock_key_t key;
+	bool changed;
+	bool pressed;
+
+	scan(&raw);
+	key_state = debounce_update(&debounce, &raw);
+
+	key = k_spin_lock(&keystate_lock);
+	keyset_xor(&has_changed, key_state, &keystate);
+	keystate = *key_state;
+	k_spin_unlock(&keystate_lock, key);
+
+	changed = !keyset_is_empty(&has_changed);
+	pressed = !keyset_is_empty(key_state);
+
+	if (changed && matrix_handler) {
+		matrix_handler(key_state, &has_changed);
+	}
+
+	if (changed || pressed) {
+		last_activity = now;
+	}
+
+	if (IS_ENABLED(CONFIG_KB_MATRIX_INTERRUPT) && !pressed &&
+	    debounce_is_settled(&debounce) &&
+	    (now - last_activity) >= CONFIG_KB_MATRIX_IDLE_TIMEOUT_MS) {
+		wait_for_press();
+	}
+}
+
+static void matrix_thread_fn(void)
+{
+	for (;;) {
+		k_sem_take(&scan_sem, K_FOREVER);
+
+		/* A timer expiry may be left over from before the wait. */
+		if (state != STATE_SCANNING) {
+			continue;
+		}
+
+		uint32_t expired = k_timer_status_get(&scan_timer);
+		uint32_t start = k_cycle_get_32();
+
+		matrix_scan();
+		stats_update(start, k_cycle_get_32(), expired);
+	}
+}
+
+K_THREAD_DEFINE(matrix_thread, CONFIG_KB_MATRIX_THREAD_STACK_SIZE,
+		matrix_thread_fn, NULL, NULL, NULL,
+		CONFIG_KB_MATRIX_THREAD_PRIORITY, 0, 0);
+
+static void col_pressed(const struct device *port, struct gpio_callback *cb,
+			gpio_port_pins_t pins)
+{
+	if (state != STATE_WAITING) {
+		return;
+	}
+
+	cols_interrupt_set(GPIO_INT_DISABLE);
+	rows_set(0);
+	last_activity = k_uptime_get_32();
+	scanning_start();
+}
+
+int matrix_init(const struct gpio_dt_spec *rows, const struct gpio_dt_spec *cols,
+		matrix_handler_t handler)
+{
+	int err;
+
+	row = rows;
+	col = cols;
+	matrix_handler = handler;
+
+	for (int i = 0; i < MATRIX_ROWS; i++) {
+		err = gpio_pin_configure_dt(&row[i], GPIO_OUTPUT_INACTIVE);
+		if (err) {
+			LOG_ERR("Cannot configure row %d (err %d)", i, err);
+			return err;
+		}
+	}
+
+	for (int i = 0; i < MATRIX_COLS; i++) {
+		err = gpio_pin_configure_dt(&col[i], GPIO_INPUT);
+		if (err) {
+			LOG_ERR("Cannot configure col %d (err %d)", i, err);
+			return err;
+		}
+
+		gpio_init_callback(&col_cb[i], col_pressed, BIT(col[i].pin));
+		err = gpio_add_callback(col[i].port, &col_cb[i]);
+		if (err) {
+			LOG_ERR("Cannot add callback for col %d (err %d)", i,
+				err);
+			return err;
+		}
+	}
+
+#ifdef CONFIG_KB_MATRIX_PORT_IO
+	ports_init();
+#endif
+
+	debounce_init(&debounce);
+	scan_ticks = k_us_to_ticks_near32(USEC_PER_SEC /
+					  CONFIG_KB_MATRIX_SCAN_RATE_HZ);
+
+	last_activity = k_uptime_get_32();
+	scanning_start();
+
+	return 0;
+}
+
+void matrix_get_keystate(struct keyset *key_state)
+{
+	k_spinlock_key_t key = k_spin_lock(&keystate_lock);
+
+	*key_state = keystate;
+	k_spin_unlock(&keystate_lock, key);
+}
+
+int matrix_scan_rate_set(uint32_t rate_hz)
+{
+	if (rate_hz < MATRIX_SCAN_RATE_MIN_HZ ||
+	    rate_hz > MATRIX_SCAN_RATE_MAX_HZ) {
+		return -EINVAL;
+	}
+
+	scan_ticks = k_us_to_ticks_near32(USEC_PER_SEC / rate_hz);
+
+	/* Keep the scan thread from stopping the timer in between. A
+	 * burst that starts later takes the new period anyway.
+	 */
+	k_sched_lock();
+	if (state == STATE_SCANNING) {
+		k_timer_start(&scan_timer, K_TICKS(scan_ticks),
+			      K_TICKS(scan_ticks));
+	}
+	k_sched_unlock();
+
+	return 0;
+}
+
+uint32_t matrix_scan_rate_get(void)
+{
+	return USEC_PER_SEC / k_ticks_to_us_near32(scan_ticks);
+}
+
+void matrix_scan_trigger(uint32_t holdoff_us)
+{
+	k_spinlock_key_t key;
+	uint32_t holdoff = k_us_to_ticks_ceil32(holdoff_us) + scan_ticks;
+
+	if (state != STATE_SCANNING) {
+		return;
+	}
+
+	k_timer_start(&scan_timer, K_TICKS(holdoff), K_TICKS(scan_ticks));
+	k_sem_give(&scan_sem);
+
+	key = k_spin_lock(&stats_lock);
+	stats.triggers++;
+	k_spin_unlock(&stats_lock, key);
+}
+
+void matrix_stats_get(struct matrix_stats *out)
+{
+	k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+	*out = stats;
+	out->period_us = k_ticks_to_us_near32(scan_ticks);
+	out->period_avg_us = stats.periods ?
+			     (uint32_t)(period_sum_us / stats.periods) : 0;
+	out->scan_avg_us = stats.scans ?
+			   (uint32_t)(scan_sum_us / stats.scans) : 0;
+
+	k_spin_unlock(&stats_lock, key);
+}
+
+void matrix_stats_reset(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+	memset(&stats, 0, sizeof(stats));
+	period_sum_us = 0;
+	scan_sum_us = 0;
+	last_scan = 0;
+
+	k_spin_unlock(&stats_lock, key);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	struct matrix_stats st;
+
+	matrix_stats_get(&st);
+
+	shell_print(sh, "Rate %u Hz, period %u us", matrix_scan_rate_get(),
+		    st.period_us);
+	shell_print(sh, "Scans %u, overruns %u, triggered %u", st.scans,
+		    st.overruns, st.triggers);
+	if (st.periods) {
+		shell_print(sh, "Period: min %u avg %u max %u us, "
+			    "jitter %d/%d/%d us", st.period_min_us,
+			    st.period_avg_us, st.period_max_us,
+			    (int)(st.period_min_us - st.period_us),
+			    (int)(st.period_avg_us - st.period_us),
+			    (int)(st.period_max_us - st.period_us));
+	}
+	if (st.scans) {
+		shell_print(sh, "Scan: min %u avg %u max %u us",
+			    st.scan_min_us, st.scan_avg_us, st.scan_max_us);
+	}
+
+	return 0;
+}
+
+static int cmd_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	matrix_stats_reset();
+
+	return 0;
+}
+
+static int cmd_rate(const struct shell *sh, size_t argc, char **argv)
+{
+	int err;
+
+	if (argc < 2) {
+		shell_print(sh, "%u Hz", matrix_scan_rate_get());
+		return 0;
+	}
+
+	err = matrix_scan_rate_set(strtoul(argv[1], NULL, 10));
+	if (err) {
+		shell_error(sh, "Rate must be %u to %u Hz",
+			    MATRIX_SCAN_RATE_MIN_HZ, MATRIX_SCAN_RATE_MAX_HZ);
+		return err;
+	}
+
+	/* The old periods say nothing about the new rate. */
+	matrix_stats_reset();
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(matrix_cmds,
+	SHELL_CMD(stats, NULL, "Print the scan timing statistics", cmd_stats),
+	SHELL_CMD(reset, NULL, "Reset the scan timing statistics", cmd_reset),
+	SHELL_CMD_ARG(rate, NULL, "Get or set the scan rate [Hz]", cmd_rate,
+		      1, 1),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(matrix, &matrix_cmds, "Key matrix scanning", NULL);
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_SPSC_RING_H_
+#define KB_SPSC_RING_H_
+
+/**@file
+ * @defgroup kb_spsc_ring Single producer, single consumer ring API
+ * @{
+ * @brief Lock-free ring of fixed size elements between two threads.
+ *
+ * One thread puts, one other thread gets. The producer only writes the
+ * head and the consumer only writes the tail, so neither takes a lock or
+ * waits for the other. A full ring drops the new element and counts it.
+ *
+ * The ring does not wake the consumer, pair it with a semaphore or a
+ * poll signal for that.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <string.h>
+#include <zephyr/types.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+/** @brief Ring state. Use @ref SPSC_RING_DEFINE to create one. */
+struct spsc_ring {
+	/** Element storage. */
+	uint8_t *buf;
+	/** Size of an element [bytes]. */
+	size_t elem_size;
+	/** Number of elements, a power of two. */
+	uint32_t len;
+	/** Elements put so far, written by the producer only. */
+	atomic_t head;
+	/** Elements taken so far, written by the consumer only. */
+	atomic_t tail;
+	/** Elements dropped because the ring was full. */
+	atomic_t overflows;
+};
+
+/** @brief Statically define a ring.
+ *
+ * @param _name Name of the ring.
+ * @param _type Element type.
+ * @param _len  Number of elements, a power of two.
+ */
+#define SPSC_RING_DEFINE(_name, _type, _len)                                \
+	BUILD_ASSERT(IS_POWER_OF_TWO(_len),                                 \
+		     "Ring length must be a power of two");                  \
+	static _type _name##_buf[_len];                                      \
+	static struct spsc_ring _name = {                                    \
+		.buf = (uint8_t *)_name##_buf,                               \
+		.elem_size = sizeof(_type),                                  \
+		.len = (_len),                                               \
+	}
+
+/** @brief Put an element. Producer only.
+ *
+ * @param ring Ring.
+ * @param elem Element, copied into the ring.
+ *
+ * @retval true  If the element was put.
+ * @retval false If the ring was full, the element is dropped.
+ */
+static inline bool spsc_ring_put(struct spsc_ring *ring, const void *elem)
+{
+	uint32_t head = atomic_get(&ring->head);
+	uint32_t tail = atomic_get(&ring->tail);
+
+	if (head - tail == ring->len) {
+		atomic_inc(&ring->overflows);
+		return false;
+	}
+
+	memcpy(&ring->buf[(head & (ring->len - 1)) * ring->elem_size], elem,
+	       ring->elem_size);
+	/* Publish the element only once it is written. */
+	atomic_set(&ring->head, head + 1);
+
+	return true;
+}
+
+/** @brief Get the oldest element. Consumer only.
+ *
+ * @param ring Ring.
+ * @param elem Filled with the element.
+ *
+ * @retval true  If an element was taken.
+ * @retval false If the ring is empty.
+ */
+static inline bool spsc_ring_get(struct spsc_ring *ring, void *elem)
+{
+	uint32_t tail = atomic_get(&ring->tail);
+	uint32_t head = atomic_get(&ring->head);
+
+	if (head == tail) {
+		return false;
+	}
+
+	memcpy(elem, &ring->buf[(tail & (ring->len - 1)) * ring->elem_size],
+	       ring->elem_size);
+	/* Free the slot only once it is read. */
+	atomic_set(&ring->tail, tail + 1);
+
+	return true;
+}
+
+/** @brief Get the number of dropped elements.
+ *
+ * @param ring Ring.
+ *
+ * @return Elements dropped since boot because the ring was full.
+ */
+static inline uint32_t spsc_ring_overflows(struct spsc_ring *ring)
+{
+	return atomic_get(&ring->overflows);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_SPSC_RING_H_ */
@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Key latency trace
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/math_extras.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
+#include "trace.h"
+
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_KB_TRACE_BUF_SIZE),
+	     "Trace ring size must be a power of two");
+
+/* Log2 buckets of microseconds, the last one takes everything longer. */
+#define HIST_BUCKETS 16
+/* Histogram of the total time from the key change to the sent report. */
+#define HIST_TOTAL   TRACE_STAGES
+
+/* Key on its way to the host. */
+struct trace_open {
+	/* Cycles at the key change, on this half's clock. */
+	uint32_t origin;
+	/* Cycles at the last stage. */
+	uint32_t cycles;
+	/* Report the key was built into. */
+	uint32_t report;
+	uint8_t stage;
+	uint8_t side;
+	uint8_t position;
+	bool used;
+};
+
+struct trace_hist {
+	uint32_t bucket[HIST_BUCKETS];
+	uint32_t count;
+	uint32_t max_us;
+	uint64_t sum_us;
+};
+
+static const char *const stage_names[] = {
+	[TRACE_MATRIX]       = "matrix",
+	[TRACE_KBDS_NOTIFY]  = "notify",
+	[TRACE_REMOTE_RX]    = "remote_rx",
+	[TRACE_HID_APPLY]    = "apply",
+	[TRACE_REPORT_BUILD] = "build",
+	[TRACE_REPORT_SENT]  = "sent",
+	[HIST_TOTAL]         = "total",
+};
+
+static struct k_spinlock lock;
+static struct trace_record records[CONFIG_KB_TRACE_BUF_SIZE];
+static uint32_t record_cnt;
+static struct trace_open keys_open[CONFIG_KB_TRACE_OPEN_MAX];
+static struct trace_hist hist[TRACE_STAGES + 1];
+static uint32_t report_cnt;
+
+static void hist_add(size_t idx, uint32_t us)
+{
+	struct trace_hist *h = &hist[idx];
+	size_t bucket = us ? 32 - u32_count_leading_zeros(us) : 0;
+
+	h->bucket[MIN(bucket, HIST_BUCKETS - 1)]++;
+	h->count++;
+	h->sum_us += us;
+	h->max_us = MAX(h->max_us, us);
+}
+
+static void record_add(uint32_t cycles, enum trace_stage stage, uint8_t side,
+		       uint8_t position)
+{
+	struct trace_record *r;
+
+	r = &records[record_cnt++ & (CONFIG_KB_TRACE_BUF_SIZE - 1)];
+	r->cycles = cycles;
+	r->stage = stage;
+	r->side = side;
+	r->position = position;
+	r->reserved = 0;
+}
+
+static struct trace_open *open_find(uint8_t side, uint8_t position)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(keys_open); i++) {
+		if (keys_open[i].used && keys_open[i].side == side &&
+		    keys_open[i].position == position) {
+			return &keys_open[i];
+		}
+	}
+
+	return NULL;
+}
+
+static struct trace_open *open_oldest(void)
+{
+	struct trace_open *oldest = &keys_open[0];
+
+	for (size_t i = 1; i < ARRAY_SIZE(keys_open); i++) {
+		struct trace_open *o = &keys_open[i];
+
+		if ((int32_t)(o->origin - oldest->origin) < 0) {
+			oldest = o;
+		}
+	}
+
+	return oldest;
+}
+
+/* Start tracking a key, dropping the oldest key if all slots are taken. */
+static struct trace_open *open_start(uint8_t side, uint8_t position,
+				     uint32_t origin)
+{
+	struct trace_open *o = open_find(side, position);
+
+	for (size_t i = 0; !o && i < ARRAY_SIZE(keys_open); i++) {
+		if (!keys_open[i].used) {
+			o = &keys_open[i];
+		}
+	}
+	if (!o) {
+		o = open_oldest();
+	}
+
+	o->origin = origin;
+	o->side = side;
+	o->position = position;
+	o->used = true;
+
+	return o;
+}
+
+/* Stamp a stage of a tracked key. */
+static void open_stamp(struct trace_open *o, enum trace_stage stage,
+		       uint32_t now)
+{
+	hist_add(stage, k_cyc_to_us_floor32(now - o->cycles));
+	o->cycles = now;
+	o->stage = stage;
+	record_add(now, stage, o->side, o->position);
+}
+
+void trace_key(enum trace_stage stage, uint8_t side, uint8_t position)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	uint32_t now = k_cycle_get_32();
+	struct trace_open *o;
+
+	if (stage == TRACE_MATRIX) {
+		o = open_start(side, position, now);
+		o->cycles = now;
+		o->stage = stage;
+		record_add(now, stage, side, position);
+	} else {
+		o = open_find(side, position);
+		if (o) {
+			open_stamp(o, stage, now);
+			if (stage == TRACE_KBDS_NOTIFY) {
+				o->used = false;
+			}
+		}
+	}
+
+	k_spin_unlock(&lock, key);
+}
+
+void trace_key_remote(uint8_t side, uint8_t position, uint32_t delay_us)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	uint32_t now = k_cycle_get_32();
+	struct trace_open *o;
+
+	o = open_start(side, position, now - k_us_to_cyc_floor32(delay_us));
+	o->cycles = now;
+	o->stage = TRACE_REMOTE_RX;
+	hist_add(TRACE_REMOTE_RX, delay_us);
+	record_add(now, TRACE_REMOTE_RX, side, position);
+
+	k_spin_unlock(&lock, key);
+}
+
+uint32_t trace_report_build(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	uint32_t now = k_cycle_get_32();
+	uint32_t report = ++report_cnt;
+
+	for (size_t i = 0; i < ARRAY_SIZE(keys_open); i++) {
+		struct trace_open *o = &keys_open[i];
+
+		if (o->used && o->stage == TRACE_HID_APPLY) {
+			open_stamp(o, TRACE_REPORT_BUILD, now);
+			o->report = report;
+		}
+	}
+
+	k_spin_unlock(&lock, key);
+
+	return report;
+}
+
+/* Whether a key built into a report is in the given report or an older
+ * one, the report IDs may wrap.
+ */
+static bool open_in_report(const struct trace_open *o, uint32_t report)
+{
+	return o->used && o->stage == TRACE_REPORT_BUILD &&
+	       (int32_t)(o->report - report) <= 0;
+}
+
+void trace_report_sent(uint32_t report)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	uint32_t now = k_cycle_get_32();
+
+	for (size_t i = 0; i < ARRAY_SIZE(keys_open); i++) {
+		struct trace_open *o = &keys_open[i];
+
+		if (open_in_report(o, report)) {
+			open_stamp(o, TRACE_REPORT_SENT, now);
+			hist_add(HIST_TOTAL,
+				 k_cyc_to_us_floor32(now - o->origin));
+			o->used = false;
+		}
+	}
+
+	k_spin_unlock(&lock, key);
+}
+
+void trace_report_discard(uint32_t report)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	for (size_t i = 0; i < ARRAY_SIZE(keys_open); i++) {
+		if (keys_open[i].used && keys_open[i].report == report &&
+		    keys_open[i].stage == TRACE_REPORT_BUILD) {
+			keys_open[i].used = false;
+		}
+	}
+
+	k_spin_unlock(&lock, key);
+}
+
+void trace_dump(void)
+{
+	uint32_t end = record_cnt;
+	uint32_t start = end > CONFIG_KB_TRACE_BUF_SIZE ?
+			 end - CONFIG_KB_TRACE_BUF_SIZE : 0;
+
+	printk("Trace: %u records, %u cycles/s\n", end - start,
+	       sys_clock_hw_cycles_per_sec());
+
+	for (uint32_t i = start; i < end; i++) {
+		k_spinlock_key_t key = k_spin_lock(&lock);
+		struct trace_record r;
+
+		/* Skip what was overwritten while printing. */
+		if (record_cnt - i > CONFIG_KB_TRACE_BUF_SIZE) {
+			k_spin_unlock(&lock, key);
+			continue;
+		}
+		r = records[i & (CONFIG_KB_TRACE_BUF_SIZE - 1)];
+		k_spin_unlock(&lock, key);
+
+		printk("%10u %-9s side %u key %u\n", r.cycles,
+		       stage_names[r.stage], r.side, r.position);
+	}
+}
+
+void trace_hist_print(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(hist); i++) {
+		k_spinlock_key_t key = k_spin_lock(&lock);
+		struct trace_hist h = hist[i];
+
+		k_spin_unlock(&lock, key);
+
+		if (!h.count) {
+			continue;
+		}
+
+		printk("%s: %u events, avg %u us, max %u us\n",
+		       stage_names[i], h.count, (uint32_t)(h.sum_us / h.count),
+		       h.max_us);
+		for (size_t b = 0; b < HIST_BUCKETS - 1; b++) {
+			if (h.bucket[b]) {
+				printk("  < %6u us: %u\n", BIT(b),
+				       h.bucket[b]);
+			}
+		}
+		if (h.bucket[HIST_BUCKETS - 1]) {
+			printk("  >= %5u us: %u\n", BIT(HIST_BUCKETS - 2),
+			       h.bucket[HIST_BUCKETS - 1]);
+		}
+	}
+}
+
+void trace_clear(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	/* Report IDs keep counting, reports may still be in flight. */
+	record_cnt = 0;
+	memset(keys_open, 0, sizeof(keys_open));
+	memset(hist, 0, sizeof(hist));
+
+	k_spin_unlock(&lock, key);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_dump(const struct shell *sh, size_t argc, char **argv)
+{
+	trace_dump();
+
+	return 0;
+}
+
+static int cmd_hist(const struct shell *sh, size_t argc, char **argv)
+{
+	trace_hist_print();
+
+	return 0;
+}
+
+static int cmd_clear(const struct shell *sh, size_t argc, char **argv)
+{
+	trace_clear();
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(trace_cmds,
+	SHELL_CMD(dump, NULL, "Print the trace records", cmd_dump),
+	SHELL_CMD(hist, NULL, "Print the latency histograms", cmd_hist),
+	SHELL_CMD(clear, NULL, "Clear records and histograms", cmd_clear),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(trace, &trace_cmds, "Key latency trace", NULL);
+#endif
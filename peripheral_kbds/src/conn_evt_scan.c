@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Connection event aligned matrix scan
+ */
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/irq.h>
+#include <mpsl_radio_notification.h>
+
+#include "conn_evt_scan.h"
+#include "matrix.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(conn_evt_scan, CONFIG_KB_CONN_EVT_SCAN_LOG_LEVEL);
+
+/* Software interrupt not used by the controller or MPSL. */
+#define NOTIFY_IRQn    SWI1_EGU1_IRQn
+#define NOTIFY_IRQ_PRI 4
+
+#if defined(CONFIG_KB_CONN_EVT_SCAN_MARGIN_420US)
+#define NOTIFY_DISTANCE MPSL_RADIO_NOTIFICATION_DISTANCE_420US
+#elif defined(CONFIG_KB_CONN_EVT_SCAN_MARGIN_1740US)
+#define NOTIFY_DISTANCE MPSL_RADIO_NOTIFICATION_DISTANCE_1740US
+#else
+#define NOTIFY_DISTANCE MPSL_RADIO_NOTIFICATION_DISTANCE_800US
+#endif
+
+/* Connection interval of the split link [us]. */
+static uint32_t interval_us = CONFIG_KB_SPLIT_LINK_INTERVAL * 1250;
+
+static void radio_notify_isr(const void *arg)
+{
+	/* Fires before every radio event, also while advertising. */
+	matrix_scan_trigger(interval_us);
+}
+
+int conn_evt_scan_init(void)
+{
+	int err;
+
+	IRQ_CONNECT(NOTIFY_IRQn, NOTIFY_IRQ_PRI, radio_notify_isr, NULL, 0);
+	irq_enable(NOTIFY_IRQn);
+
+	err = mpsl_radio_notification_cfg_set(
+		MPSL_RADIO_NOTIFICATION_TYPE_INT_ON_ACTIVE, NOTIFY_DISTANCE,
+		NOTIFY_IRQn);
+	if (err) {
+		LOG_ERR("Radio notification not enabled (err %d)", err);
+		irq_disable(NOTIFY_IRQn);
+		return err;
+	}
+
+	return 0;
+}
+
+void conn_evt_scan_interval_set(uint16_t interval)
+{
+	interval_us = interval * 1250;
+}
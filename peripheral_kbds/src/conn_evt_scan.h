@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_CONN_EVT_SCAN_H_
+#define KB_CONN_EVT_SCAN_H_
+
+/**@file
+ * @defgroup kb_conn_evt_scan Connection event aligned scan API
+ * @{
+ * @brief Matrix scans timed to the connection events of the split link.
+ *
+ * The MPSL radio notification interrupt fires a fixed margin,
+ * CONFIG_KB_CONN_EVT_SCAN_MARGIN_*, before every radio event and starts
+ * a matrix scan. A key change is then queued right before the connection
+ * event that carries it, instead of waiting in the controller for half
+ * an interval on average. While keys are scanned, the scans follow the
+ * connection events and the scan timer only fills in for skipped ones.
+ *
+ * With CONFIG_KB_CONN_EVT_SCAN disabled all functions are empty and
+ * nothing is compiled in.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+
+#if defined(CONFIG_KB_CONN_EVT_SCAN)
+
+/** @brief Enable the radio notification interrupt.
+ *
+ * Call after matrix_init() and bt_enable().
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int conn_evt_scan_init(void);
+
+/** @brief Set the connection interval of the split link.
+ *
+ * The scan timer holds off for one interval after each aligned scan.
+ *
+ * @param interval Connection interval [1.25 ms].
+ */
+void conn_evt_scan_interval_set(uint16_t interval);
+
+#else
+
+static inline int conn_evt_scan_init(void)
+{
+	return 0;
+}
+static inline void conn_evt_scan_interval_set(uint16_t interval) {}
+
+#endif /* CONFIG_KB_CONN_EVT_SCAN */
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_CONN_EVT_SCAN_H_ */
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_DEBOUNCE_H_
+#define KB_DEBOUNCE_H_
+
+/**@file
+ * @defgroup kb_debounce Key debounce API
+ * @{
+ * @brief Per-key debouncing of raw matrix scans.
+ *
+ * Every key has its own scan counter. The counters are stored bit-sliced:
+ * bit n of cnt[k][w] is bit k of the counter of key 32 * w + n, so 32 keys
+ * are updated together with a few word operations per scan.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+
+#include "keyset.h"
+
+/** @brief Number of counter bits per key. */
+#define DEBOUNCE_CNT_BITS 4
+
+/** @brief Debounce state of a key matrix. */
+struct debounce {
+	/** Debounced key state. */
+	struct keyset state;
+	/** Bit-sliced per-key scan counters, by counter bit and key word. */
+	uint32_t cnt[DEBOUNCE_CNT_BITS][KEYSET_WORDS];
+};
+
+/** @brief Reset the debounce state to all keys released.
+ *
+ * @param db Debounce state.
+ */
+void debounce_init(struct debounce *db);
+
+/** @brief Feed one raw scan into the debouncer.
+ *
+ * With CONFIG_KB_DEBOUNCE_EAGER a key change is reported on its first edge
+ * and the key is then ignored for the next CONFIG_KB_DEBOUNCE_SCANS scans.
+ * With CONFIG_KB_DEBOUNCE_DEFERRED a key change is reported once the raw
+ * value has been stable for CONFIG_KB_DEBOUNCE_SCANS scans.
+ *
+ * @param db  Debounce state.
+ * @param raw Raw key state of this scan.
+ *
+ * @return Debounced key state, valid until the next update.
+ */
+const struct keyset *debounce_update(struct debounce *db,
+				     const struct keyset *raw);
+
+/** @brief Check whether any key is still being debounced.
+ *
+ * @param db Debounce state.
+ *
+ * @retval true If no key is locked or waiting to settle.
+ */
+bool debounce_is_settled(const struct debounce *db);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_DEBOUNCE_H_ */
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Activity governor of the peripheral half
+ *
+ * The state is only changed by one delayable work item on the system
+ * workqueue, which also runs the split link parameter requests. The
+ * matrix thread only stamps the key changes and kicks the work item when
+ * the state has to go up.
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
+#include "governor.h"
+#include "matrix.h"
+#include "split_link.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(governor, CONFIG_KB_GOVERNOR_LOG_LEVEL);
+
+BUILD_ASSERT(CONFIG_KB_GOVERNOR_SLEEP_TIMEOUT_MS >
+	     CONFIG_KB_GOVERNOR_IDLE_TIMEOUT_MS,
+	     "Sleep timeout must be longer than the idle timeout");
+BUILD_ASSERT(CONFIG_KB_GOVERNOR_SLEEP_LATENCY >=
+	     CONFIG_KB_GOVERNOR_IDLE_LATENCY,
+	     "Sleep latency must not be lower than the idle latency");
+/* The supervision timeout must cover two intervals of skipped events. */
+BUILD_ASSERT(CONFIG_KB_SPLIT_LINK_TIMEOUT * 4 >
+	     (1 + CONFIG_KB_GOVERNOR_SLEEP_LATENCY) *
+	     CONFIG_KB_SPLIT_LINK_INTERVAL,
+	     "Supervision timeout too short for the sleep latency");
+
+/* Scans that see a key change before it is reported. */
+#define WAKE_SCANS (IS_ENABLED(CONFIG_KB_DEBOUNCE_DEFERRED) ? \
+		    CONFIG_KB_DEBOUNCE_SCANS : 1)
+
+static const char *const state_names[] = {
+	[GOVERNOR_ACTIVE] = "active",
+	[GOVERNOR_IDLE]   = "idle",
+	[GOVERNOR_SLEEP]  = "sleep",
+};
+
+static void state_work_fn(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(state_work, state_work_fn);
+static enum governor_state state;
+/* Uptime of the last key change [ms]. */
+static atomic_t last_change;
+/* Key changes since the last step down. */
+static atomic_t changes;
+/* Scan rate of the active state, kept if changed at run time. */
+static uint32_t active_rate = CONFIG_KB_MATRIX_SCAN_RATE_HZ;
+static uint16_t link_latency;
+static struct governor_stats stats;
+
+/* Lowest scan rate that keeps the scans of the first key change within
+ * the wake latency bound.
+ */
+static uint32_t idle_rate_get(void)
+{
+	uint32_t rate = DIV_ROUND_UP(WAKE_SCANS * MSEC_PER_SEC,
+				     CONFIG_KB_GOVERNOR_MAX_WAKE_LATENCY_MS);
+
+	rate = MAX(rate, CONFIG_KB_GOVERNOR_IDLE_SCAN_RATE_HZ);
+
+	return MIN(rate, active_rate);
+}
+
+static void scan_rate_set(uint32_t rate)
+{
+	int err = matrix_scan_rate_set(rate);
+
+	if (err) {
+		LOG_WRN("Scan rate %u Hz not set (err %d)", rate, err);
+	}
+}
+
+static void link_latency_set(uint16_t latency)
+{
+	int err;
+
+	if (latency == link_latency) {
+		return;
+	}
+
+	err = split_link_latency_set(latency);
+	if (err) {
+		LOG_WRN("Peripheral latency %u not set (err %d)", latency,
+			err);
+		return;
+	}
+
+	link_latency = latency;
+	stats.latency_updates++;
+}
+
+static void state_set(enum governor_state next)
+{
+	if (state == GOVERNOR_ACTIVE) {
+		active_rate = matrix_scan_rate_get();
+	}
+
+	LOG_DBG("%s -> %s", state_names[state], state_names[next]);
+
+	switch (next) {
+	case GOVERNOR_ACTIVE:
+		scan_rate_set(active_rate);
+		break;
+	case GOVERNOR_IDLE:
+		scan_rate_set(idle_rate_get());
+		/* A link that was never woken keeps the sleep latency. */
+		link_latency_set(MAX(link_latency,
+				     CONFIG_KB_GOVERNOR_IDLE_LATENCY));
+		atomic_clear(&changes);
+		break;
+	case GOVERNOR_SLEEP:
+		if (state == GOVERNOR_ACTIVE) {
+			scan_rate_set(idle_rate_get());
+		}
+		link_latency_set(CONFIG_KB_GOVERNOR_SLEEP_LATENCY);
+		atomic_clear(&changes);
+		break;
+	default:
+		return;
+	}
+
+	state = next;
+	stats.entered[next]++;
+}
+
+static void state_work_fn(struct k_work *work)
+{
+	uint32_t idle_ms = k_uptime_get_32() - atomic_get(&last_change);
+	enum governor_state next;
+	k_timeout_t wait;
+
+	if (idle_ms >= CONFIG_KB_GOVERNOR_SLEEP_TIMEOUT_MS) {
+		next = GOVERNOR_SLEEP;
+		wait = K_FOREVER;
+	} else if (idle_ms >= CONFIG_KB_GOVERNOR_IDLE_TIMEOUT_MS) {
+		next = GOVERNOR_IDLE;
+		wait = K_MSEC(CONFIG_KB_GOVERNOR_SLEEP_TIMEOUT_MS - idle_ms);
+	} else {
+		next = GOVERNOR_ACTIVE;
+		wait = K_MSEC(CONFIG_KB_GOVERNOR_IDLE_TIMEOUT_MS - idle_ms);
+	}
+
+	if (next != state) {
+		state_set(next);
+	}
+
+	if (state == GOVERNOR_ACTIVE &&
+	    atomic_get(&changes) >= CONFIG_KB_GOVERNOR_WAKE_CHANGES) {
+		link_latency_set(0);
+	}
+
+	if (!K_TIMEOUT_EQ(wait, K_FOREVER)) {
+		k_work_reschedule(&state_work, wait);
+	}
+}
+
+int governor_init(void)
+{
+	active_rate = matrix_scan_rate_get();
+	atomic_set(&last_change, k_uptime_get_32());
+	state = GOVERNOR_ACTIVE;
+	stats.entered[GOVERNOR_ACTIVE]++;
+
+	k_work_schedule(&state_work,
+			K_MSEC(CONFIG_KB_GOVERNOR_IDLE_TIMEOUT_MS));
+
+	return 0;
+}
+
+void governor_key_changed(void)
+{
+	atomic_set(&last_change, k_uptime_get_32());
+	atomic_inc(&changes);
+
+	/* While active with no latency the pending step down finds the
+	 * new stamp by itself.
+	 */
+	if (state != GOVERNOR_ACTIVE || link_latency) {
+		k_work_reschedule(&state_work, K_NO_WAIT);
+	}
+}
+
+void governor_wake(void)
+{
+	atomic_set(&last_change, k_uptime_get_32());
+	atomic_set(&changes, CONFIG_KB_GOVERNOR_WAKE_CHANGES);
+	k_work_reschedule(&state_work, K_NO_WAIT);
+}
+
+enum governor_state governor_state_get(void)
+{
+	return state;
+}
+
+void governor_stats_get(struct governor_stats *out)
+{
+	*out = stats;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_governor(const struct shell *sh, size_t argc, char **argv)
+{
+	struct governor_stats st;
+
+	governor_stats_get(&st);
+
+	shell_print(sh, "State %s, scan rate %u Hz, peripheral latency %u",
+		    state_names[governor_state_get()], matrix_scan_rate_get(),
+		    link_latency);
+	shell_print(sh, "Entered: active %u, idle %u, sleep %u",
+		    st.entered[GOVERNOR_ACTIVE], st.entered[GOVERNOR_IDLE],
+		    st.entered[GOVERNOR_SLEEP]);
+	shell_print(sh, "Latency updates %u", st.latency_updates);
+
+	return 0;
+}
+
+SHELL_CMD_REGISTER(governor, NULL, "Activity governor state", cmd_governor);
+#endif
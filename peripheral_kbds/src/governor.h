@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_GOVERNOR_H_
+#define KB_GOVERNOR_H_
+
+/**@file
+ * @defgroup kb_governor Activity governor API
+ * @{
+ * @brief Scan rate and split link latency of the peripheral half, by
+ *        typing activity.
+ *
+ * - Active: a key changed within CONFIG_KB_GOVERNOR_IDLE_TIMEOUT_MS. The
+ *   matrix is scanned at the active rate and the split link runs with no
+ *   peripheral latency.
+ * - Idle: held keys are scanned at a lower rate, bounded by
+ *   CONFIG_KB_GOVERNOR_MAX_WAKE_LATENCY_MS, and the split link runs with
+ *   CONFIG_KB_GOVERNOR_IDLE_LATENCY.
+ * - Sleep: no key changed for CONFIG_KB_GOVERNOR_SLEEP_TIMEOUT_MS. The
+ *   split link runs with CONFIG_KB_GOVERNOR_SLEEP_LATENCY. A released
+ *   matrix waits for a column interrupt in both idle and sleep.
+ *
+ * A key change brings the active scan rate back right away. The split
+ * link goes back to no latency only after
+ * CONFIG_KB_GOVERNOR_WAKE_CHANGES key changes, and steps down only after
+ * the timeouts, so short bursts do not flap the connection parameters.
+ * Peripheral latency does not hold up the key events of this half, the
+ * peripheral may send on any connection event.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+
+/** @brief Governor states, from the most to the least power. */
+enum governor_state {
+	GOVERNOR_ACTIVE,
+	GOVERNOR_IDLE,
+	GOVERNOR_SLEEP,
+
+	GOVERNOR_STATES
+};
+
+/** @brief Governor statistics. */
+struct governor_stats {
+	/** Times each state was entered. */
+	uint32_t entered[GOVERNOR_STATES];
+	/** Peripheral latency changes requested. */
+	uint32_t latency_updates;
+};
+
+/** @brief Start the governor in the active state.
+ *
+ * Takes the current matrix scan rate as the active rate. Call after
+ * matrix_init().
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int governor_init(void);
+
+/** @brief Report a key change.
+ *
+ * Cheap enough for the matrix handler, the state changes on the system
+ * workqueue.
+ */
+void governor_key_changed(void);
+
+/** @brief Go to the active state with no peripheral latency right away.
+ *
+ * For a new split link connection, so its setup is not slowed down by
+ * skipped connection events.
+ */
+void governor_wake(void);
+
+/** @brief Get the current state.
+ *
+ * @return Current state.
+ */
+enum governor_state governor_state_get(void);
+
+/** @brief Get the governor statistics.
+ *
+ * Also printed by the "governor" shell command.
+ *
+ * @param stats Filled with the statistics since boot.
+ */
+void governor_stats_get(struct governor_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_GOVERNOR_H_ */
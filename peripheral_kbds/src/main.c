@@ -25,16 +25,19 @@
 #include <zephyr/settings/settings.h>
 
 
+#include "conn_evt_scan.h"
 #include "kbds.h"
+#include "governor.h"
+#include "matrix.h"
+#include "split_link.h"
+#include "split_peer.h"
+#include "trace.h"
 
 #define DEVICE_NAME             CONFIG_BT_DEVICE_NAME
 #define DEVICE_NAME_LEN         (sizeof(DEVICE_NAME) - 1)
 
-#define RUN_LED_BLINK_INTERVAL  3
-
-#define NUM_OF_ROW 4
-#define NUM_OF_COL 6
-#define NUM_OF_BUT 0
+/* Retry time of a key state notification that found no TX buffer. */
+#define KEYSTATE_RETRY_MS 1
 
 const static struct gpio_dt_spec user_led[] = {GPIO_DT_SPEC_GET(DT_ALIAS(led0),gpios)};
 const static struct gpio_dt_spec conn_led[] = {GPIO_DT_SPEC_GET(DT_ALIAS(led1),gpios)};
@@ -57,8 +60,11 @@ const static struct gpio_dt_spec row[] = {GPIO_DT_SPEC_GET(DT_ALIAS(pin2),gpios)
 										GPIO_DT_SPEC_GET(DT_ALIAS(pin9),gpios),
 										};
 
+BUILD_ASSERT(ARRAY_SIZE(row) == MATRIX_ROWS);
+BUILD_ASSERT(ARRAY_SIZE(col) == MATRIX_COLS);
+
 
-static uint32_t app_keystate;
+static struct keyset app_keystate;
 
 static const struct bt_data ad[] = {
 	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
@@ -69,16 +75,72 @@ static const struct bt_data sd[] = {
 	BT_DATA_BYTES(BT_DATA_UUID128_ALL, BT_UUID_KBDS_VAL),
 };
 
+static struct k_work adv_work;
+/* Directed advertising went unanswered, advertise to anyone. */
+static bool adv_undirected;
+
+static void adv_work_fn(struct k_work *work)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+	bt_addr_le_t peer;
+	int err;
+
+	if (!adv_undirected && !split_peer_get(0, &peer)) {
+		bt_addr_le_to_str(&peer, addr, sizeof(addr));
+
+		err = bt_le_adv_start(BT_LE_ADV_CONN_DIR(&peer), NULL, 0,
+				      NULL, 0);
+		if (!err) {
+			printk("Directed advertising to %s started\n", addr);
+			return;
+		}
+		printk("Directed advertising failed to start (err %d)\n",
+		       err);
+	}
+
+	err = bt_le_adv_start(BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONNECTABLE |
+					      BT_LE_ADV_OPT_ONE_TIME,
+					      BT_GAP_ADV_FAST_INT_MIN_2,
+					      BT_GAP_ADV_FAST_INT_MAX_2, NULL),
+			      ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+	if (err) {
+		printk("Advertising failed to start (err %d)\n", err);
+		return;
+	}
+
+	printk("Advertising successfully started\n");
+}
+
 static void connected(struct bt_conn *conn, uint8_t err)
 {
+	struct bt_conn_info info;
+
+	if (err == BT_HCI_ERR_ADV_TIMEOUT) {
+		/* The peer may have lost the bond, let it find us. */
+		printk("Directed advertising timed out\n");
+		adv_undirected = true;
+		k_work_submit(&adv_work);
+		return;
+	}
 	if (err) {
 		printk("Connection failed (err %u)\n", err);
+		k_work_submit(&adv_work);
 		return;
 	}
 
-	printk("Connected\n");
+	printk("Connected after %u ms\n", split_peer_link_up());
+	adv_undirected = false;
 
 	gpio_pin_set_dt(conn_led,1);
+
+	if (!bt_conn_get_info(conn, &info)) {
+		conn_evt_scan_interval_set(info.le.interval);
+	}
+
+	governor_wake();
+	if (split_link_start(conn)) {
+		printk("Split link start failed\n");
+	}
 }
 
 static void disconnected(struct bt_conn *conn, uint8_t reason)
@@ -87,19 +149,63 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 
 	//dk_set_led_off(CON_STATUS_LED);
 	gpio_pin_set_dt(conn_led,0);
+
+	split_peer_link_lost();
+	/* Advertising is restarted once the connection is released. */
+	k_work_submit(&adv_work);
 }
 
+static void security_changed(struct bt_conn *conn, bt_security_t level,
+			     enum bt_security_err err)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+
+	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+
+	if (err) {
+		printk("Security failed: %s level %u err %d\n", addr, level,
+		       err);
+		return;
+	}
+
+	printk("Security changed: %s level %u\n", addr, level);
+	if (!split_peer_set(bt_conn_get_dst(conn))) {
+		printk("Split peer is %s\n", addr);
+	}
+}
+
+static void split_link_updated(struct bt_conn *conn, uint16_t interval,
+			       uint16_t latency, uint16_t timeout)
+{
+	printk("Split link updated: interval %u, latency %u, timeout %u\n",
+	       interval, latency, timeout);
+	conn_evt_scan_interval_set(interval);
+}
+
+static void split_link_rejected(struct bt_conn *conn,
+				const struct bt_le_conn_param *param, int err)
+{
+	printk("Split link parameters rejected: interval %u, latency %u "
+	       "(err %d)\n", param->interval_min, param->latency, err);
+}
+
+static const struct split_link_cb split_link_callbacks = {
+	.updated  = split_link_updated,
+	.rejected = split_link_rejected,
+};
+
 BT_CONN_CB_DEFINE(conn_callbacks) = {
 	.connected        = connected,
 	.disconnected     = disconnected,
+	.security_changed = security_changed,
 };
 
 static struct bt_conn_auth_cb conn_auth_callbacks;
 static struct bt_conn_auth_info_cb conn_auth_info_callbacks;
 
-static uint32_t app_button_cb(void)
+static void app_button_cb(struct keyset *keystate)
 {
-	return app_keystate;
+	*keystate = app_keystate;
 }
 
 static struct bt_kbds_cb kbds_callbacs = {
@@ -134,7 +240,10 @@ uint32_t test_func(uint32_t last_val){
 	gpio_pin_set_dt(&row[1],0);//set to VCC
 
 	if(val != last_val){
-		bt_kbds_send_keystate(val);
+		struct keyset keystate = {0};
+
+		keyset_write(&keystate, 0, val);
+		bt_kbds_send_keystate(&keystate);
 	}
 
 	return val;
@@ -149,26 +258,37 @@ uint32_t test_func(uint32_t last_val){
 	*/
 }
 
-uint32_t get_keystate(uint32_t last_button_state){
-	static uint32_t has_changed, button_state;
-	button_state = 0;
+static struct k_work_delayable keystate_work;
 
-	for(int i = 0; i<NUM_OF_ROW; i++){
-		gpio_pin_set_dt(&row[i],1); //set pin to GND
-		for(int j = 0; j<NUM_OF_COL; j++){
-			button_state |= gpio_pin_get_dt(&col[j]) << (NUM_OF_BUT + (NUM_OF_ROW - 1 -i )*
-														NUM_OF_COL + (NUM_OF_COL-1 -j));
-		}
-		gpio_pin_set_dt(&row[i],0); //set pin to VCC
+/* Send the key state to a peer that does not use key events. From the
+ * system work queue a notification fails instead of waiting for a TX
+ * buffer, and only the latest state is sent.
+ */
+static void keystate_work_fn(struct k_work *work)
+{
+	if (bt_kbds_send_keystate(&app_keystate) == -ENOMEM) {
+		k_work_schedule(&keystate_work, K_MSEC(KEYSTATE_RETRY_MS));
 	}
+}
 
-	has_changed = button_state ^ last_button_state;
-	//if you want to analyse the button_state, do it between these 2 operations of has_changed 
-	app_keystate = button_state;
-	if(has_changed != 0){
-		bt_kbds_send_keystate(button_state);
+static void matrix_changed(const struct keyset *key_state,
+			   const struct keyset *has_changed)
+{
+	//if you want to analyse the key_state, do it here
+	app_keystate = *key_state;
+	governor_key_changed();
+
+	KEYSET_FOREACH(has_changed, i) {
+		trace_key(TRACE_MATRIX, CONFIG_BT_KBDS_MODULE_ID, i);
+		if (bt_kbds_send_key_event(i, keyset_test(key_state, i)) ==
+		    -EACCES) {
+			/* Peer does not use key events, send the bitmap
+			 * without holding up the scan.
+			 */
+			k_work_reschedule(&keystate_work, K_NO_WAIT);
+			return;
+		}
 	}
-	return button_state;
 }
 
 int gpio_init(void){
@@ -199,21 +319,9 @@ int gpio_init(void){
 		return err;
 	}
 
-	for(int i = 0; i < NUM_OF_ROW; i++){
-		err = gpio_pin_configure_dt(&row[i], GPIO_OUTPUT);
-		if(err){
-			printk("problem with row %d (err %d)\n",i,err);
-			return err;
-		}
-		gpio_pin_set_dt(&row[i],0);//VCC aka 5v
-	}
-	
-	for(int i = 0; i < NUM_OF_COL; i++){
-		err = gpio_pin_configure_dt(&col[i], GPIO_INPUT);
-		if(err){
-			printk("problem with row %d (err %d)\n",i,err);
-			return err;
-		}
+	err = matrix_init(row, col, matrix_changed);
+	if(err != 0){
+		return err;
 	}
 
 	return err;
@@ -221,17 +329,25 @@ int gpio_init(void){
 
 void main(void)
 {
-	int blink_status = 0;
 	int err;
 
 	printk("Starting Bluetooth Peripheral KBDS example\n");
 
+	/* Before the matrix starts calling matrix_changed(). */
+	k_work_init_delayable(&keystate_work, keystate_work_fn);
+
 	err = gpio_init();
 	if (err) {
 		printk("Button init failed (err %d)\n", err);
 		return;
 	}
 
+	err = governor_init();
+	if (err) {
+		printk("Failed to init governor (err %d)\n", err);
+		return;
+	}
+
 	/*
 	if (IS_ENABLED(CONFIG_BT_KBDS_SECURITY_ENABLED)) {
 		err = bt_conn_auth_cb_register(&conn_auth_callbacks);
@@ -256,30 +372,33 @@ void main(void)
 
 	printk("Bluetooth initialized\n");
 
+	err = conn_evt_scan_init();
+	if (err) {
+		printk("Failed to init connection event scan (err %d)\n",
+		       err);
+		return;
+	}
+
 	if (IS_ENABLED(CONFIG_SETTINGS)) {
 		settings_load();
 	}
 
-	err = bt_kbds_init(&kbds_callbacs);
+	err = split_link_init(&split_link_callbacks);
 	if (err) {
-		printk("Failed to init KBDS (err:%d)\n", err);
+		printk("Failed to init split link (err:%d)\n", err);
 		return;
 	}
 
-	err = bt_le_adv_start(BT_LE_ADV_CONN, ad, ARRAY_SIZE(ad),
-			      sd, ARRAY_SIZE(sd));
+	err = bt_kbds_init(&kbds_callbacs);
 	if (err) {
-		printk("Advertising failed to start (err %d)\n", err);
+		printk("Failed to init KBDS (err:%d)\n", err);
 		return;
 	}
 
-	printk("Advertising successfully started\n");
-	uint32_t button_state;
-	for (;;) {
-		//dk_set_led(RUN_STATUS_LED, (++blink_status) % 2);
-		//gpio_pin_set_dt(run_led,(++blink_status) % 2);
-		button_state = get_keystate(button_state);
-		//button_state = test_func(button_state);
-		k_sleep(K_MSEC(RUN_LED_BLINK_INTERVAL));
-	}
+	k_work_init(&adv_work, adv_work_fn);
+	k_work_submit(&adv_work);
+
+	/* The key matrix is scanned on the matrix thread, nothing
+	 * left to do here.
+	 */
 }
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_MATRIX_H_
+#define KB_MATRIX_H_
+
+/**@file
+ * @defgroup kb_matrix Key matrix scanning API
+ * @{
+ * @brief API for scanning the row/column key matrix of one keyboard half.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+#include <zephyr/drivers/gpio.h>
+
+#include "keyset.h"
+
+#define MATRIX_ROWS CONFIG_KB_MATRIX_ROWS
+#define MATRIX_COLS CONFIG_KB_MATRIX_COLS
+
+/** @brief Lowest scan rate [Hz]. */
+#define MATRIX_SCAN_RATE_MIN_HZ 125
+/** @brief Highest scan rate [Hz]. */
+#define MATRIX_SCAN_RATE_MAX_HZ 2000
+
+/** @brief Callback type for when the matrix state changes.
+ *
+ * @param key_state   Keys that are currently pressed.
+ * @param has_changed Keys that changed since the last call.
+ */
+typedef void (*matrix_handler_t)(const struct keyset *key_state,
+				 const struct keyset *has_changed);
+
+/** @brief Scan timing statistics. */
+struct matrix_stats {
+	/** Scans since the statistics were reset. */
+	uint32_t scans;
+	/** Timer periods that passed without a scan. */
+	uint32_t overruns;
+	/** Scans started by matrix_scan_trigger(). */
+	uint32_t triggers;
+	/** Nominal period, the scan timer period [us]. */
+	uint32_t period_us;
+	/** Measured periods, between two scans of one burst. */
+	uint32_t periods;
+	/** Shortest period [us]. */
+	uint32_t period_min_us;
+	/** Longest period [us]. */
+	uint32_t period_max_us;
+	/** Average period [us]. */
+	uint32_t period_avg_us;
+	/** Shortest scan, including the matrix handler [us]. */
+	uint32_t scan_min_us;
+	/** Longest scan [us]. */
+	uint32_t scan_max_us;
+	/** Average scan [us]. */
+	uint32_t scan_avg_us;
+};
+
+/** @brief Initialize the key matrix.
+ *
+ * Configures the rows as outputs and the columns as inputs and starts the
+ * scanning engine. While no key is pressed all rows are driven active and
+ * the columns wait for an interrupt, so the CPU is not woken up at all.
+ * The first column edge starts a burst of scans at
+ * CONFIG_KB_MATRIX_SCAN_RATE_HZ, which keeps running until the matrix
+ * has been released for CONFIG_KB_MATRIX_IDLE_TIMEOUT_MS. The scans run
+ * on the matrix thread, at CONFIG_KB_MATRIX_THREAD_PRIORITY.
+ *
+ * @param rows    Row pins, MATRIX_ROWS entries.
+ * @param cols    Column pins, MATRIX_COLS entries.
+ * @param handler Called from the matrix thread when the debounced key
+ *                state changes. Can be NULL. Should not block, it
+ *                holds up the next scan.
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int matrix_init(const struct gpio_dt_spec *rows, const struct gpio_dt_spec *cols,
+		matrix_handler_t handler);
+
+/** @brief Get the last scanned key state.
+ *
+ * Key position n is counted from the last column of the last row.
+ *
+ * @param key_state Filled with the keys that are currently pressed.
+ */
+void matrix_get_keystate(struct keyset *key_state);
+
+/** @brief Set the scan rate.
+ *
+ * Takes effect right away, also during a burst of scans. The period is
+ * rounded to kernel ticks. Call from a thread, after matrix_init().
+ *
+ * The scan timing statistics are kept, so an activity governor that
+ * steps the rate does not wipe them. Call matrix_stats_reset() to
+ * measure one rate alone, as the "matrix rate" shell command does.
+ *
+ * Debouncing counts scans, so a higher rate shortens the debounce time.
+ *
+ * @param rate_hz Scans per second, MATRIX_SCAN_RATE_MIN_HZ to
+ *                MATRIX_SCAN_RATE_MAX_HZ.
+ *
+ * @retval 0 If the operation was successful.
+ * @retval -EINVAL If the rate is out of range.
+ */
+int matrix_scan_rate_set(uint32_t rate_hz);
+
+/** @brief Get the scan rate.
+ *
+ * @return Scans per second, from the rounded period.
+ */
+uint32_t matrix_scan_rate_get(void);
+
+/** @brief Scan right away, on an external trigger.
+ *
+ * Only during a burst of scans, a matrix waiting for a column interrupt
+ * is left alone. The timer scans resume one scan period after
+ * holdoff_us, so a trigger that comes at least every holdoff_us replaces
+ * them and sets the scan times. Callable from an ISR.
+ *
+ * @param holdoff_us Time the next trigger is expected within [us].
+ */
+void matrix_scan_trigger(uint32_t holdoff_us);
+
+/** @brief Get the scan timing statistics.
+ *
+ * The period is measured from the start of one scan to the start of the
+ * next, its spread around the nominal period is the scan jitter. Also
+ * printed by the "matrix stats" shell command.
+ *
+ * @param stats Filled with the statistics since the last reset.
+ */
+void matrix_stats_get(struct matrix_stats *stats);
+
+/** @brief Reset the scan timing statistics. */
+void matrix_stats_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_MATRIX_H_ */
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Bonded identity of the other half
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "split_peer.h"
+#include "bg_work.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(split_peer, CONFIG_KB_SPLIT_PEER_LOG_LEVEL);
+
+/* Settings key of a peer, followed by its index. */
+#define PEER_KEY "split/peer/"
+
+BUILD_ASSERT(CONFIG_KB_SPLIT_LINK_MAX <= ATOMIC_BITS,
+	     "Too many peers for the pending save mask");
+
+static bt_addr_le_t peers[CONFIG_KB_SPLIT_LINK_MAX];
+static bool peers_valid[CONFIG_KB_SPLIT_LINK_MAX];
+/* Peers set but not written to settings yet, by index. */
+static atomic_t save_pending;
+/* Uptime of the last link loss [ms], 0 for boot. */
+static uint32_t lost_time;
+
+struct bond_find {
+	const bt_addr_le_t *addr;
+	bool found;
+};
+
+static void bond_find_cb(const struct bt_bond_info *info, void *user_data)
+{
+	struct bond_find *find = user_data;
+
+	if (!bt_addr_le_cmp(&info->addr, find->addr)) {
+		find->found = true;
+	}
+}
+
+static bool is_bonded(const bt_addr_le_t *addr)
+{
+	struct bond_find find = {
+		.addr = addr,
+	};
+
+	bt_foreach_bond(BT_ID_DEFAULT, bond_find_cb, &find);
+
+	return find.found;
+}
+
+static int peer_settings_set(const char *name, size_t len,
+			     settings_read_cb read_cb, void *cb_arg)
+{
+	const char *next;
+	unsigned long idx;
+	ssize_t rc;
+
+	if (!settings_name_steq(name, "peer", &next) || !next) {
+		return -ENOENT;
+	}
+	idx = strtoul(next, NULL, 10);
+	if (idx >= ARRAY_SIZE(peers)) {
+		/* Stored with a larger CONFIG_KB_SPLIT_LINK_MAX. */
+		return 0;
+	}
+	if (len != sizeof(peers[idx])) {
+		return -EINVAL;
+	}
+
+	rc = read_cb(cb_arg, &peers[idx], sizeof(peers[idx]));
+	if (rc < 0) {
+		return rc;
+	}
+
+	peers_valid[idx] = true;
+
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(split_peer, "split", NULL, peer_settings_set,
+			       NULL, NULL);
+
+static void peer_save_fn(struct k_work *work)
+{
+	char key[sizeof(PEER_KEY) + 3];
+	int err;
+
+	for (size_t i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (!atomic_test_and_clear_bit(&save_pending, i)) {
+			continue;
+		}
+
+		snprintk(key, sizeof(key), PEER_KEY "%d", (int)i);
+		err = settings_save_one(key, &peers[i], sizeof(peers[i]));
+		if (err) {
+			LOG_ERR("Cannot store split peer %d (err %d)", (int)i,
+				err);
+		}
+	}
+}
+
+static K_WORK_DEFINE(peer_save_work, peer_save_fn);
+
+int split_peer_get(size_t idx, bt_addr_le_t *addr)
+{
+	if (idx >= ARRAY_SIZE(peers)) {
+		return -EINVAL;
+	}
+	/* The bond may have been removed since the peer was stored. */
+	if (!peers_valid[idx] || !is_bonded(&peers[idx])) {
+		return -ENOENT;
+	}
+
+	bt_addr_le_copy(addr, &peers[idx]);
+
+	return 0;
+}
+
+int split_peer_set(const bt_addr_le_t *addr)
+{
+	int free_idx = -1;
+
+	if (!is_bonded(addr)) {
+		return -ENOENT;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (!peers_valid[i] || !is_bonded(&peers[i])) {
+			if (free_idx < 0) {
+				free_idx = i;
+			}
+		} else if (!bt_addr_le_cmp(addr, &peers[i])) {
+			return 0;
+		}
+	}
+	if (free_idx < 0) {
+		return -ENOMEM;
+	}
+
+	bt_addr_le_copy(&peers[free_idx], addr);
+	peers_valid[free_idx] = true;
+
+	/* The flash write can take milliseconds, keep it off the caller. */
+	atomic_set_bit(&save_pending, free_idx);
+	bg_work_submit(&peer_save_work);
+
+	return 0;
+}
+
+void split_peer_link_lost(void)
+{
+	lost_time = k_uptime_get_32();
+}
+
+uint32_t split_peer_link_up(void)
+{
+	return k_uptime_get_32() - lost_time;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_SPLIT_PEER_H_
+#define KB_SPLIT_PEER_H_
+
+/**@file
+ * @defgroup kb_split_peer Split peer API
+ * @{
+ * @brief Bonded identities of the other halves.
+ *
+ * Once the halves have bonded, each one stores the identity address of
+ * the other in settings under "split/peer/<n>". The central half keeps
+ * up to CONFIG_KB_SPLIT_LINK_MAX peers, one per module, a peripheral half
+ * only its central. After a reset or a link loss the halves reconnect to
+ * those addresses alone: the peripheral half with high duty directed
+ * advertising, the central half by initiating from the filter accept
+ * list, skipping the scan.
+ *
+ * The time from the link loss, or from boot, until the link is up again
+ * is measured as well.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/addr.h>
+
+/** @brief Get a bonded peer.
+ *
+ * @param idx  Peer index, below CONFIG_KB_SPLIT_LINK_MAX.
+ * @param addr Filled with the identity address of the peer.
+ *
+ * @retval 0 If the operation was successful.
+ * @retval -ENOENT If no peer is stored or its bond has been removed.
+ * @retval -EINVAL If the index is out of range.
+ */
+int split_peer_get(size_t idx, bt_addr_le_t *addr);
+
+/** @brief Store the bonded peer.
+ *
+ * Call once the link is encrypted. The address is only stored if there
+ * is a bond with it and it is not stored yet. It takes the first free
+ * slot, or the slot of a peer whose bond has been removed. It is
+ * written to settings later, from the background work queue.
+ *
+ * @param addr Identity address of the peer.
+ *
+ * @retval 0 If the operation was successful.
+ * @retval -ENOENT If there is no bond with the address.
+ * @retval -ENOMEM If CONFIG_KB_SPLIT_LINK_MAX peers are stored already.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int split_peer_set(const bt_addr_le_t *addr);
+
+/** @brief Report that the split link was lost.
+ *
+ * Starts the reconnect time measurement.
+ */
+void split_peer_link_lost(void);
+
+/** @brief Report that the split link is up again.
+ *
+ * @return Time since the link was lost or since boot [ms].
+ */
+uint32_t split_peer_link_up(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_SPLIT_PEER_H_ */
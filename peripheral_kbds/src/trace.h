@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_TRACE_H_
+#define KB_TRACE_H_
+
+/**@file
+ * @defgroup kb_trace Key latency trace API
+ * @{
+ * @brief Cycle stamped trace of key events on their way to the host.
+ *
+ * Every stage a key event passes is stamped with k_cycle_get_32() into a
+ * fixed size ring of binary records, the oldest records are overwritten.
+ * The time from the previous stage of the same key is added to a
+ * histogram per stage, and the time from the key change to the sent
+ * report to a total histogram.
+ *
+ * Stamps of a remote key change cannot be compared with local cycles, so
+ * the remote receive stage takes the delay measured on the synchronized
+ * KBDS clock instead.
+ *
+ * With CONFIG_KB_TRACE disabled all functions are empty and nothing is
+ * compiled in.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+
+/** @brief Stages of a key event. */
+enum trace_stage {
+	/** Key change detected by the matrix scan. */
+	TRACE_MATRIX,
+	/** Key event notification queued on the peripheral half. */
+	TRACE_KBDS_NOTIFY,
+	/** Key event received from a module. */
+	TRACE_REMOTE_RX,
+	/** Key change applied to the HID state. */
+	TRACE_HID_APPLY,
+	/** Key change applied to a built HID report. */
+	TRACE_REPORT_BUILD,
+	/** HID report sent to the host. */
+	TRACE_REPORT_SENT,
+
+	TRACE_STAGES
+};
+
+/** @brief Trace record, as stored in the ring. */
+struct trace_record {
+	/** k_cycle_get_32() at the stage. */
+	uint32_t cycles;
+	/** Stage, enum trace_stage. */
+	uint8_t stage;
+	/** Keymap side, the module ID of the key. */
+	uint8_t side;
+	/** Key position. */
+	uint8_t position;
+	/** Reserved. */
+	uint8_t reserved;
+};
+
+#if defined(CONFIG_KB_TRACE)
+
+/** @brief Stamp a stage of one key.
+ *
+ * @ref TRACE_MATRIX starts tracking the key, @ref TRACE_KBDS_NOTIFY ends
+ * it on the peripheral half. @ref TRACE_HID_APPLY marks it for the next
+ * report built.
+ *
+ * @param stage    Stage.
+ * @param side     Keymap side of the key.
+ * @param position Key position.
+ */
+void trace_key(enum trace_stage stage, uint8_t side, uint8_t position);
+
+/** @brief Stamp the reception of a remote key.
+ *
+ * Starts tracking the key with @ref TRACE_REMOTE_RX.
+ *
+ * @param side     Keymap side of the key.
+ * @param position Key position.
+ * @param delay_us Time since the key changed on the module [us].
+ */
+void trace_key_remote(uint8_t side, uint8_t position, uint32_t delay_us);
+
+/** @brief Stamp the build of a HID report.
+ *
+ * Stamps @ref TRACE_REPORT_BUILD for the keys applied to the HID state
+ * since the last report, keys still waiting to be applied are not in it.
+ *
+ * @return ID of the report, for trace_report_sent() and
+ *         trace_report_discard().
+ */
+uint32_t trace_report_build(void);
+
+/** @brief Stamp the completion of a HID report.
+ *
+ * Stamps @ref TRACE_REPORT_SENT and ends tracking the keys of the report
+ * and of the reports built before it, a later report carries their
+ * changes as well. With several hosts the first completion counts.
+ *
+ * @param report ID of the report, from trace_report_build().
+ */
+void trace_report_sent(uint32_t report);
+
+/** @brief Stop tracking the keys of a report that is not sent.
+ *
+ * @param report ID of the report, from trace_report_build().
+ */
+void trace_report_discard(uint32_t report);
+
+/** @brief Print the records in the ring, oldest first. */
+void trace_dump(void);
+
+/** @brief Print the latency histograms. */
+void trace_hist_print(void);
+
+/** @brief Clear the records and the histograms. */
+void trace_clear(void);
+
+#else
+
+static inline void trace_key(enum trace_stage stage, uint8_t side,
+			     uint8_t position) {}
+static inline void trace_key_remote(uint8_t side, uint8_t position,
+				    uint32_t delay_us) {}
+static inline uint32_t trace_report_build(void) { return 0; }
+static inline void trace_report_sent(uint32_t report) {}
+static inline void trace_report_discard(uint32_t report) {}
+static inline void trace_dump(void) {}
+static inline void trace_hist_print(void) {}
+static inline void trace_clear(void) {}
+
+#endif /* CONFIG_KB_TRACE */
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_TRACE_H_ */
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief BabbleSim test helpers
+ */
+
+#include "bs_common.h"
+
+/* Simulated time a test has to pass in [us]. */
+#define TEST_DEADLINE_US (20 * 1000 * 1000)
+
+void bs_common_tick(bs_time_t HW_device_time)
+{
+	if (bst_result != Passed) {
+		FAIL("Test not passed after %u seconds\n",
+		     TEST_DEADLINE_US / (1000 * 1000));
+	}
+}
+
+void bs_common_init(void)
+{
+	bst_ticker_set_next_tick_absolute(TEST_DEADLINE_US);
+	bst_result = In_progress;
+}
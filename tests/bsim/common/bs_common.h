@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef KB_BS_COMMON_H_
+#define KB_BS_COMMON_H_
+
+/**@file
+ * @defgroup kb_bs_common BabbleSim test helpers
+ * @{
+ * @brief Pass and fail reporting shared by the two-device tests.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include "bs_types.h"
+#include "bs_tracing.h"
+#include "bstests.h"
+
+#define CREATE_FLAG(flag) static atomic_t flag = (atomic_t)false
+#define SET_FLAG(flag) (void)atomic_set(&flag, (atomic_t)true)
+#define UNSET_FLAG(flag) (void)atomic_set(&flag, (atomic_t)false)
+#define WAIT_FOR_FLAG(flag)                       \
+	while (!(bool)atomic_get(&flag)) {        \
+		(void)k_sleep(K_MSEC(1));         \
+	}
+
+#define FAIL(...)                                         \
+	do {                                              \
+		bst_result = Failed;                      \
+		bs_trace_error_time_line(__VA_ARGS__);    \
+	} while (0)
+
+#define PASS(...)                                         \
+	do {                                              \
+		bst_result = Passed;                      \
+		bs_trace_info_time(1, __VA_ARGS__);       \
+	} while (0)
+
+extern enum bst_result_t bst_result;
+
+/** @brief Fail the test if it has not passed when the tick comes.
+ *
+ * @param HW_device_time Simulated time of the device.
+ */
+void bs_common_tick(bs_time_t HW_device_time);
+
+/** @brief Start the test, with its deadline. */
+void bs_common_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* KB_BS_COMMON_H_ */
@@ -0,0 +1,24 @@
+#!/usr/bin/env bash
+#
+# Copyright (c) 2018 Nordic Semiconductor
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+# Build the two-device tests for the nrf52_bsim board and place them in
+# ${BSIM_OUT_PATH}/bin, where the test_scripts of each test run them.
+
+set -ue
+
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be defined}"
+: "${BSIM_COMPONENTS_PATH:?BSIM_COMPONENTS_PATH must be defined}"
+
+BOARD="${BOARD:-nrf52_bsim}"
+tests_dir="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+build_dir="${tests_dir}/build"
+
+for app in split_link split_reconnect; do
+	west build -p always -b ${BOARD} -d ${build_dir}/${app} \
+		${tests_dir}/${app}
+	cp ${build_dir}/${app}/zephyr/zephyr.exe \
+		${BSIM_OUT_PATH}/bin/bs_${BOARD}_kb_${app}
+done
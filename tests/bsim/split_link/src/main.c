@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Split link connection parameter test
+ *
+ * The central connects with the default connection parameters, as the
+ * halves used to. Once the split link manager is started on both sides,
+ * the link must run at the split link interval with no peripheral
+ * latency, on the 2M PHY with long packets. The peripheral then asks
+ * for a peripheral latency, as while its keys are idle, and drops it
+ * again.
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/hci.h>
+
+#include "bs_common.h"
+#include "split_link.h"
+
+/* Peripheral latency asked for while idle [connection events]. */
+#define IDLE_LATENCY 4
+
+static const struct bt_data ad[] = {
+	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+	BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME,
+		sizeof(CONFIG_BT_DEVICE_NAME) - 1),
+};
+
+static struct bt_conn *default_conn;
+static atomic_t link_interval;
+static atomic_t link_latency;
+
+CREATE_FLAG(flag_connected);
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+	struct bt_conn_info info;
+
+	if (err) {
+		FAIL("Connection failed (err %u)\n", err);
+		return;
+	}
+
+	if (!default_conn) {
+		default_conn = bt_conn_ref(conn);
+	}
+
+	if (bt_conn_get_info(conn, &info)) {
+		FAIL("No connection info\n");
+		return;
+	}
+	atomic_set(&link_interval, info.le.interval);
+	atomic_set(&link_latency, info.le.latency);
+
+	printk("Connected: interval %u, latency %u\n", info.le.interval,
+	       info.le.latency);
+	SET_FLAG(flag_connected);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	FAIL("Disconnected (reason %u)\n", reason);
+}
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+};
+
+static void link_updated(struct bt_conn *conn, uint16_t interval,
+			 uint16_t latency, uint16_t timeout)
+{
+	printk("Split link updated: interval %u, latency %u, timeout %u\n",
+	       interval, latency, timeout);
+
+	atomic_set(&link_interval, interval);
+	atomic_set(&link_latency, latency);
+}
+
+static void link_rejected(struct bt_conn *conn,
+			  const struct bt_le_conn_param *param, int err)
+{
+	FAIL("Split link parameters rejected: interval %u, latency %u "
+	     "(err %d)\n", param->interval_min, param->latency, err);
+}
+
+static const struct split_link_cb link_cb = {
+	.updated = link_updated,
+	.rejected = link_rejected,
+};
+
+/* Wait for the link to run with the given parameters. */
+static void link_wait(uint16_t interval, uint16_t latency)
+{
+	while (atomic_get(&link_interval) != interval ||
+	       atomic_get(&link_latency) != latency) {
+		k_sleep(K_MSEC(1));
+	}
+}
+
+static void device_found(const bt_addr_le_t *addr, int8_t rssi,
+			 uint8_t type, struct net_buf_simple *ad)
+{
+	int err;
+
+	if (default_conn || type != BT_GAP_ADV_TYPE_ADV_IND) {
+		return;
+	}
+
+	err = bt_le_scan_stop();
+	if (err) {
+		FAIL("Scanning failed to stop (err %d)\n", err);
+		return;
+	}
+
+	/* The default parameters the halves used to connect with. */
+	err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN,
+				BT_LE_CONN_PARAM_DEFAULT, &default_conn);
+	if (err) {
+		FAIL("Connection failed to start (err %d)\n", err);
+	}
+}
+
+static void link_start(void)
+{
+	int err;
+
+	err = bt_enable(NULL);
+	if (err) {
+		FAIL("Bluetooth init failed (err %d)\n", err);
+		return;
+	}
+
+	err = split_link_init(&link_cb);
+	if (err) {
+		FAIL("Split link init failed (err %d)\n", err);
+	}
+}
+
+static void test_central_main(void)
+{
+	struct split_link_info info;
+	int err;
+
+	link_start();
+
+	err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+	if (err) {
+		FAIL("Scanning failed to start (err %d)\n", err);
+		return;
+	}
+
+	WAIT_FOR_FLAG(flag_connected);
+	if (atomic_get(&link_interval) == CONFIG_KB_SPLIT_LINK_INTERVAL) {
+		FAIL("Connected at the split link interval already\n");
+		return;
+	}
+
+	/* The halves start the link once the KBDS has been discovered. */
+	err = split_link_start(default_conn);
+	if (err) {
+		FAIL("Split link start failed (err %d)\n", err);
+		return;
+	}
+	link_wait(CONFIG_KB_SPLIT_LINK_INTERVAL, 0);
+
+	/* Wait for the PHY, data length and MTU updates as well. */
+	do {
+		k_sleep(K_MSEC(10));
+		err = split_link_info_get(default_conn, &info);
+		if (err) {
+			FAIL("No split link info (err %d)\n", err);
+			return;
+		}
+	} while (info.tx_phy != BT_GAP_LE_PHY_2M ||
+		 info.rx_phy != BT_GAP_LE_PHY_2M ||
+		 info.tx_len != CONFIG_BT_CTLR_DATA_LENGTH_MAX ||
+		 info.mtu != CONFIG_BT_L2CAP_TX_MTU);
+
+	if (info.interval != CONFIG_KB_SPLIT_LINK_INTERVAL) {
+		FAIL("Split link info interval %u\n", info.interval);
+		return;
+	}
+
+	/* The peripheral goes idle and wakes up again. */
+	link_wait(CONFIG_KB_SPLIT_LINK_INTERVAL, IDLE_LATENCY);
+	link_wait(CONFIG_KB_SPLIT_LINK_INTERVAL, 0);
+
+	PASS("Central passed\n");
+}
+
+static void test_peripheral_main(void)
+{
+	int err;
+
+	link_start();
+
+	err = bt_le_adv_start(BT_LE_ADV_CONN, ad, ARRAY_SIZE(ad), NULL, 0);
+	if (err) {
+		FAIL("Advertising failed to start (err %d)\n", err);
+		return;
+	}
+
+	WAIT_FOR_FLAG(flag_connected);
+
+	err = split_link_start(default_conn);
+	if (err) {
+		FAIL("Split link start failed (err %d)\n", err);
+		return;
+	}
+	link_wait(CONFIG_KB_SPLIT_LINK_INTERVAL, 0);
+
+	/* Latencies the supervision timeout does not cover are refused. */
+	if (split_link_latency_set(CONFIG_KB_SPLIT_LINK_TIMEOUT * 4 /
+				   CONFIG_KB_SPLIT_LINK_INTERVAL) !=
+	    -EINVAL) {
+		FAIL("Latency beyond the supervision timeout accepted\n");
+		return;
+	}
+
+	err = split_link_latency_set(IDLE_LATENCY);
+	if (err) {
+		FAIL("Idle latency not set (err %d)\n", err);
+		return;
+	}
+	link_wait(CONFIG_KB_SPLIT_LINK_INTERVAL, IDLE_LATENCY);
+
+	err = split_link_latency_set(0);
+	if (err) {
+		FAIL("Latency not cleared (err %d)\n", err);
+		return;
+	}
+	link_wait(CONFIG_KB_SPLIT_LINK_INTERVAL, 0);
+
+	PASS("Peripheral passed\n");
+}
+
+static const struct bst_test_instance test_def[] = {
+	{
+		.test_id = "central",
+		.test_descr = "Connects with the default parameters and "
+			      "starts the split link",
+		.test_post_init_f = bs_common_init,
+		.test_tick_f = bs_common_tick,
+		.test_main_f = test_central_main
+	},
+	{
+		.test_id = "peripheral",
+		.test_descr = "Starts the split link and asks for an idle "
+			      "latency",
+		.test_post_init_f = bs_common_init,
+		.test_tick_f = bs_common_tick,
+		.test_main_f = test_peripheral_main
+	},
+	BSTEST_END_MARKER
+};
+
+static struct bst_test_list *test_split_link_install(
+	struct bst_test_list *tests)
+{
+	return bst_add_tests(tests, test_def);
+}
+
+bst_test_install_t test_installers[] = {
+	test_split_link_install,
+	NULL
+};
+
+void main(void)
+{
+	bst_main();
+}
@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Split link reconnection test
+ *
+ * The halves connect and bond the first time as before: the peripheral
+ * advertises to anyone and the central scans. Both store the identity of
+ * the other with split_peer_set(). The central then drops the link, as
+ * on a range dropout, and the halves reconnect the way the keyboard
+ * does: the peripheral with high duty directed advertising to its
+ * stored central, the central from the filter accept list, without a
+ * scan. The reconnection has to take less than RECONNECT_MAX_MS and the
+ * link has to be encrypted again with the stored keys, without pairing.
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/hci.h>
+
+#include "bs_common.h"
+#include "split_peer.h"
+
+/* Longest time from the link loss to the link being up again [ms]. */
+#define RECONNECT_MAX_MS 100
+
+static const struct bt_data ad[] = {
+	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+	BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME,
+		sizeof(CONFIG_BT_DEVICE_NAME) - 1),
+};
+
+static struct bt_conn *default_conn;
+static atomic_t pairings;
+static bool reconnecting;
+
+CREATE_FLAG(flag_connected);
+CREATE_FLAG(flag_disconnected);
+CREATE_FLAG(flag_secured);
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+	uint32_t time;
+
+	if (err) {
+		FAIL("Connection failed (err %u)\n", err);
+		return;
+	}
+
+	if (!default_conn) {
+		default_conn = bt_conn_ref(conn);
+	}
+
+	time = split_peer_link_up();
+	printk("Connected after %u ms\n", time);
+
+	if (reconnecting && time >= RECONNECT_MAX_MS) {
+		FAIL("Reconnected after %u ms, more than %u ms\n", time,
+		     RECONNECT_MAX_MS);
+		return;
+	}
+
+	SET_FLAG(flag_connected);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	if (!reconnecting) {
+		FAIL("Disconnected (reason %u)\n", reason);
+		return;
+	}
+
+	printk("Disconnected (reason %u)\n", reason);
+
+	split_peer_link_lost();
+	bt_conn_unref(default_conn);
+	default_conn = NULL;
+
+	SET_FLAG(flag_disconnected);
+}
+
+static void security_changed(struct bt_conn *conn, bt_security_t level,
+			     enum bt_security_err err)
+{
+	int ret;
+
+	if (err) {
+		FAIL("Security failed: level %u err %d\n", level, err);
+		return;
+	}
+
+	ret = split_peer_set(bt_conn_get_dst(conn));
+	if (ret) {
+		FAIL("Split peer not stored (err %d)\n", ret);
+		return;
+	}
+
+	SET_FLAG(flag_secured);
+}
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+	.security_changed = security_changed,
+};
+
+static void pairing_complete(struct bt_conn *conn, bool bonded)
+{
+	if (!bonded) {
+		FAIL("Paired without bonding\n");
+		return;
+	}
+
+	atomic_inc(&pairings);
+}
+
+static struct bt_conn_auth_info_cb auth_info_cb = {
+	.pairing_complete = pairing_complete,
+};
+
+static void device_found(const bt_addr_le_t *addr, int8_t rssi,
+			 uint8_t type, struct net_buf_simple *ad)
+{
+	int err;
+
+	if (default_conn || type != BT_GAP_ADV_TYPE_ADV_IND) {
+		return;
+	}
+
+	err = bt_le_scan_stop();
+	if (err) {
+		FAIL("Scanning failed to stop (err %d)\n", err);
+		return;
+	}
+
+	err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN,
+				BT_LE_CONN_PARAM_DEFAULT, &default_conn);
+	if (err) {
+		FAIL("Connection failed to start (err %d)\n", err);
+	}
+}
+
+static void half_start(void)
+{
+	int err;
+
+	err = bt_enable(NULL);
+	if (err) {
+		FAIL("Bluetooth init failed (err %d)\n", err);
+		return;
+	}
+
+	err = bt_conn_auth_info_cb_register(&auth_info_cb);
+	if (err) {
+		FAIL("Auth info callbacks not registered (err %d)\n", err);
+	}
+}
+
+/* Wait for the link to be encrypted, after pairing the first time and
+ * with the bonded keys after that.
+ */
+static void bond_check(void)
+{
+	WAIT_FOR_FLAG(flag_secured);
+
+	/* Pairing completes after the link is encrypted. */
+	while (!atomic_get(&pairings)) {
+		k_sleep(K_MSEC(1));
+	}
+	if (atomic_get(&pairings) != 1) {
+		FAIL("Paired %d times\n", (int)atomic_get(&pairings));
+	}
+}
+
+static void test_central_main(void)
+{
+	bt_addr_le_t peer;
+	int err;
+
+	half_start();
+
+	err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+	if (err) {
+		FAIL("Scanning failed to start (err %d)\n", err);
+		return;
+	}
+
+	WAIT_FOR_FLAG(flag_connected);
+	err = bt_conn_set_security(default_conn, BT_SECURITY_L2);
+	if (err) {
+		FAIL("Security not requested (err %d)\n", err);
+		return;
+	}
+	bond_check();
+
+	/* Give the peripheral time to store its peer as well. */
+	k_sleep(K_MSEC(500));
+
+	UNSET_FLAG(flag_connected);
+	UNSET_FLAG(flag_secured);
+	reconnecting = true;
+
+	err = bt_conn_disconnect(default_conn,
+				 BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+	if (err) {
+		FAIL("Disconnect failed (err %d)\n", err);
+		return;
+	}
+	WAIT_FOR_FLAG(flag_disconnected);
+
+	err = split_peer_get(0, &peer);
+	if (err) {
+		FAIL("No split peer (err %d)\n", err);
+		return;
+	}
+
+	err = bt_le_filter_accept_list_clear();
+	if (!err) {
+		err = bt_le_filter_accept_list_add(&peer);
+	}
+	if (err) {
+		FAIL("Split peer not accepted (err %d)\n", err);
+		return;
+	}
+
+	err = bt_conn_le_create_auto(BT_CONN_LE_CREATE_CONN,
+				     BT_LE_CONN_PARAM_DEFAULT);
+	if (err) {
+		FAIL("Auto connect failed (err %d)\n", err);
+		return;
+	}
+
+	WAIT_FOR_FLAG(flag_connected);
+	if (bt_addr_le_cmp(bt_conn_get_dst(default_conn), &peer)) {
+		FAIL("Reconnected to another device\n");
+		return;
+	}
+
+	err = bt_conn_set_security(default_conn, BT_SECURITY_L2);
+	if (err) {
+		FAIL("Security not requested (err %d)\n", err);
+		return;
+	}
+	bond_check();
+
+	PASS("Central passed\n");
+}
+
+static void test_peripheral_main(void)
+{
+	bt_addr_le_t peer;
+	int err;
+
+	half_start();
+
+	if (split_peer_get(0, &peer) != -ENOENT) {
+		FAIL("Split peer before bonding\n");
+		return;
+	}
+
+	err = bt_le_adv_start(BT_LE_ADV_CONN, ad, ARRAY_SIZE(ad), NULL, 0);
+	if (err) {
+		FAIL("Advertising failed to start (err %d)\n", err);
+		return;
+	}
+
+	WAIT_FOR_FLAG(flag_connected);
+	bond_check();
+
+	UNSET_FLAG(flag_connected);
+	UNSET_FLAG(flag_secured);
+	reconnecting = true;
+
+	WAIT_FOR_FLAG(flag_disconnected);
+
+	err = split_peer_get(0, &peer);
+	if (err) {
+		FAIL("No split peer (err %d)\n", err);
+		return;
+	}
+
+	err = bt_le_adv_start(BT_LE_ADV_CONN_DIR(&peer), NULL, 0, NULL, 0);
+	if (err) {
+		FAIL("Directed advertising failed to start (err %d)\n", err);
+		return;
+	}
+
+	WAIT_FOR_FLAG(flag_connected);
+	bond_check();
+
+	PASS("Peripheral passed\n");
+}
+
+static const struct bst_test_instance test_def[] = {
+	{
+		.test_id = "central",
+		.test_descr = "Bonds, drops the link and reconnects from the "
+			      "filter accept list",
+		.test_post_init_f = bs_common_init,
+		.test_tick_f = bs_common_tick,
+		.test_main_f = test_central_main
+	},
+	{
+		.test_id = "peripheral",
+		.test_descr = "Bonds and reconnects with directed advertising",
+		.test_post_init_f = bs_common_init,
+		.test_tick_f = bs_common_tick,
+		.test_main_f = test_peripheral_main
+	},
+	BSTEST_END_MARKER
+};
+
+static struct bst_test_list *test_split_reconnect_install(
+	struct bst_test_list *tests)
+{
+	return bst_add_tests(tests, test_def);
+}
+
+bst_test_install_t test_installers[] = {
+	test_split_reconnect_install,
+	NULL
+};
+
+void main(void)
+{
+	bst_main();
+}
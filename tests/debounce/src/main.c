@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Key debounce tests
+ *
+ * Chatter traces are fed through debounce_update() and checked against a
+ * plain per-key model of the configured algorithm.
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/ztest.h>
+
+#include "debounce.h"
+
+#define SCANS CONFIG_KB_DEBOUNCE_SCANS
+
+/* Per-key model of the debouncer. */
+struct model {
+	bool state[KEYSET_KEYS];
+	uint8_t cnt[KEYSET_KEYS];
+};
+
+static struct debounce db;
+static struct model ref;
+
+static bool model_update(struct model *m, size_t key, bool raw)
+{
+#ifdef CONFIG_KB_DEBOUNCE_EAGER
+	if (m->cnt[key]) {
+		m->cnt[key]--;
+	} else if (raw != m->state[key]) {
+		m->state[key] = raw;
+		m->cnt[key] = SCANS;
+	}
+#else
+	if (raw == m->state[key]) {
+		m->cnt[key] = 0;
+	} else if (++m->cnt[key] == SCANS) {
+		m->state[key] = raw;
+		m->cnt[key] = 0;
+	}
+#endif
+	return m->state[key];
+}
+
+static bool model_is_settled(const struct model *m)
+{
+	for (size_t key = 0; key < KEYSET_KEYS; key++) {
+		if (m->cnt[key]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Feed one raw scan of a single key and return its debounced state. */
+static bool key_scan(size_t key, bool raw)
+{
+	struct keyset scan;
+
+	keyset_clear(&scan);
+	keyset_write(&scan, key, raw);
+
+	return keyset_test(debounce_update(&db, &scan), key);
+}
+
+/* Feed a trace of raw scans, '#' pressed, of one key and return the
+ * debounced states in the same notation.
+ */
+static void trace_run(size_t key, const char *raw, char *out)
+{
+	for (; *raw; raw++, out++) {
+		*out = key_scan(key, *raw == '#') ? '#' : '_';
+	}
+	*out = '\0';
+}
+
+static void trace_check(const char *raw, const char *expect)
+{
+	char out[64];
+
+	/* First and last key of the matrix, and one in a middle word. */
+	const size_t keys[] = { 0, 33, KEYSET_KEYS - 1 };
+
+	for (size_t i = 0; i < ARRAY_SIZE(keys); i++) {
+		debounce_init(&db);
+		trace_run(keys[i], raw, out);
+		zassert_str_equal(out, expect, "key %zu: raw %s",
+				  keys[i], raw);
+	}
+}
+
+/* Simple pseudo-random generator, the same traces on every run. */
+static uint32_t rand_state;
+
+static uint32_t rand_next(void)
+{
+	rand_state = rand_state * 1664525 + 1013904223;
+
+	return rand_state >> 8;
+}
+
+static void before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	debounce_init(&db);
+	memset(&ref, 0, sizeof(ref));
+	rand_state = 1;
+}
+
+ZTEST_SUITE(debounce, NULL, NULL, before, NULL, NULL);
+
+ZTEST(debounce, test_init)
+{
+	struct keyset none;
+
+	keyset_clear(&none);
+	zassert_true(debounce_is_settled(&db), NULL);
+	zassert_true(keyset_equal(debounce_update(&db, &none), &none), NULL);
+	zassert_true(debounce_is_settled(&db), NULL);
+}
+
+ZTEST(debounce, test_random_chatter)
+{
+	struct keyset raw;
+
+	keyset_clear(&raw);
+
+	/* Each key changes on about one scan in four, shorter bursts than
+	 * the debounce length are common for every length.
+	 */
+	for (int scan = 0; scan < 2000; scan++) {
+		const struct keyset *state;
+
+		for (size_t key = 0; key < KEYSET_KEYS; key++) {
+			bool bit = keyset_test(&raw, key);
+
+			if ((rand_next() & 3) == 0) {
+				bit = !bit;
+			}
+			keyset_write(&raw, key, bit);
+		}
+
+		state = debounce_update(&db, &raw);
+
+		for (size_t key = 0; key < KEYSET_KEYS; key++) {
+			bool expect = model_update(&ref, key,
+						   keyset_test(&raw, key));
+
+			zassert_equal(keyset_test(state, key), expect,
+				      "scan %d key %zu", scan, key);
+		}
+		zassert_equal(debounce_is_settled(&db),
+			      model_is_settled(&ref), "scan %d", scan);
+	}
+}
+
+ZTEST(debounce, test_all_keys_together)
+{
+	struct keyset all;
+	struct keyset none;
+
+	keyset_clear(&none);
+	keyset_clear(&all);
+	for (size_t key = 0; key < KEYSET_KEYS; key++) {
+		keyset_write(&all, key, true);
+	}
+
+	for (int scan = 0; scan < SCANS; scan++) {
+		debounce_update(&db, &all);
+	}
+	zassert_true(keyset_equal(&db.state, &all), NULL);
+
+	for (int scan = 0; scan < 2 * SCANS + 1; scan++) {
+		debounce_update(&db, &none);
+	}
+	zassert_true(keyset_equal(&db.state, &none), NULL);
+	zassert_true(debounce_is_settled(&db), NULL);
+}
+
+#ifdef CONFIG_KB_DEBOUNCE_EAGER
+ZTEST(debounce, test_eager_lockout)
+{
+	/* The press is reported on the edge scan, the release that follows
+	 * right away only once the lockout is over.
+	 */
+	zassert_true(key_scan(5, true), NULL);
+	for (int scan = 0; scan < SCANS; scan++) {
+		zassert_false(debounce_is_settled(&db), "scan %d", scan);
+		zassert_true(key_scan(5, false), "scan %d", scan);
+	}
+	zassert_true(debounce_is_settled(&db), NULL);
+	zassert_false(key_scan(5, false), NULL);
+}
+
+ZTEST(debounce, test_eager_chatter)
+{
+	if (SCANS != 2) {
+		ztest_test_skip();
+	}
+
+	/* Bounces on press and release. */
+	trace_check("__#_##_#####_#__#______",
+		    "__####___###____###____");
+	/* A single scan glitch is still reported, for the lockout. */
+	trace_check("___#______",
+		    "___###____");
+	/* Steady chatter is sampled once every lockout. */
+	trace_check("_#_#_#_#_#_#",
+		    "_###___###__");
+}
+#else
+ZTEST(debounce, test_deferred_short_press)
+{
+	/* A press one scan shorter than the debounce length is never
+	 * reported.
+	 */
+	for (int scan = 0; scan < SCANS - 1; scan++) {
+		zassert_false(key_scan(5, true), "scan %d", scan);
+	}
+	for (int scan = 0; scan < 2 * SCANS; scan++) {
+		zassert_false(key_scan(5, false), "scan %d", scan);
+	}
+	zassert_true(debounce_is_settled(&db), NULL);
+
+	/* A stable press is reported on its last debounce scan. */
+	for (int scan = 0; scan < SCANS - 1; scan++) {
+		zassert_false(key_scan(5, true), "scan %d", scan);
+	}
+	zassert_true(key_scan(5, true), NULL);
+	zassert_true(debounce_is_settled(&db), NULL);
+}
+
+ZTEST(debounce, test_deferred_chatter)
+{
+	if (SCANS != 2) {
+		ztest_test_skip();
+	}
+
+	/* Bounces on press and release. */
+	trace_check("__#_##_#####_#__#______",
+		    "_____##########________");
+	/* A single scan glitch is filtered. */
+	trace_check("___#______",
+		    "__________");
+	/* Steady chatter is filtered. */
+	trace_check("_#_#_#_#_#_#",
+		    "____________");
+}
+#endif /* CONFIG_KB_DEBOUNCE_EAGER */
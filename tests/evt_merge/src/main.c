@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Key event merge tests
+ *
+ * Typing on both halves is simulated with the left events reaching the
+ * right half on the next split link connection event, and the order and
+ * latency of the applied events are checked.
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/ztest.h>
+
+#include "evt_merge.h"
+
+#define LEFT   0
+#define RIGHT  1
+#define MODULE 2
+
+/* Split link interval and merge window, 7.5 ms in 125 us time units. */
+#define INTERVAL 60
+#define WINDOW   60
+
+/* Key events per half in a simulation. */
+#define SIM_EVTS 400
+
+struct sim_evt {
+	struct hid_evt evt;
+	/* Time the event reaches the HID thread. */
+	uint32_t arrival;
+};
+
+static struct sim_evt sim[2][SIM_EVTS];
+
+static struct hid_evt out[2 * SIM_EVTS + 1];
+static uint32_t out_at[ARRAY_SIZE(out)];
+static size_t out_cnt;
+static uint32_t now;
+
+static void handler(const struct hid_evt *evt)
+{
+	zassert_true(out_cnt < ARRAY_SIZE(out), NULL);
+	out[out_cnt] = *evt;
+	out_at[out_cnt] = now;
+	out_cnt++;
+}
+
+/* Simple pseudo-random generator, the same typing on every run. */
+static uint32_t rand_state;
+
+static uint32_t rand_next(void)
+{
+	rand_state = rand_state * 1664525 + 1013904223;
+
+	return rand_state >> 8;
+}
+
+static struct hid_evt evt_make(uint8_t side, uint32_t time)
+{
+	return (struct hid_evt){
+		.time = time,
+		.position = time % 24,
+		.side = side,
+		.pressed = time & 1,
+	};
+}
+
+/* Type on both halves from start on. Left events arrive on the next
+ * connection event, right events right away.
+ */
+static void sim_type(uint32_t start)
+{
+	for (int side = LEFT; side <= RIGHT; side++) {
+		uint32_t time = start;
+
+		for (int i = 0; i < SIM_EVTS; i++) {
+			struct sim_evt *e = &sim[side][i];
+
+			/* Both halves type fast, with bursts. */
+			time += 1 + rand_next() % 40;
+			e->evt = evt_make(side, time);
+			if (side == LEFT) {
+				uint32_t evts = (time - start) / INTERVAL;
+
+				e->arrival = start + (evts + 1) * INTERVAL;
+			} else {
+				e->arrival = time;
+			}
+		}
+	}
+}
+
+/* Run the HID thread on every time unit until all events are applied.
+ * Returns the number of events applied before an older one.
+ */
+static int sim_run(uint32_t start, uint32_t window, uint32_t *max_latency)
+{
+	size_t next[2] = { 0, 0 };
+	int inversions = 0;
+
+	*max_latency = 0;
+
+	for (now = start; out_cnt < 2 * SIM_EVTS; now++) {
+		for (int side = LEFT; side <= RIGHT; side++) {
+			while (next[side] < SIM_EVTS &&
+			       sim[side][next[side]].arrival == now) {
+				evt_merge_insert(&sim[side][next[side]].evt);
+				next[side]++;
+			}
+		}
+		evt_merge_release(now, window, false);
+
+		zassert_true(now - start < 100 * SIM_EVTS, "stuck");
+	}
+
+	for (size_t i = 0; i < out_cnt; i++) {
+		*max_latency = MAX(*max_latency, out_at[i] - out[i].time);
+		if (i && (int32_t)(out[i].time - out[i - 1].time) < 0) {
+			inversions++;
+		}
+	}
+
+	return inversions;
+}
+
+static void before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	evt_merge_init(RIGHT, handler);
+	out_cnt = 0;
+	rand_state = 1;
+}
+
+ZTEST_SUITE(evt_merge, NULL, NULL, before, NULL, NULL);
+
+ZTEST(evt_merge, test_typing_order)
+{
+	/* The clock wraps while typing. */
+	uint32_t start = UINT32_MAX - 1000;
+	uint32_t latency;
+	int inversions;
+
+	sim_type(start);
+	inversions = sim_run(start, WINDOW, &latency);
+
+	TC_PRINT("Window %u: %d events out of order, latency up to %u\n",
+		 WINDOW, inversions, latency);
+	zassert_equal(inversions, 0, NULL);
+	/* No event waits longer than the window. */
+	zassert_true(latency <= WINDOW, "latency %u", latency);
+}
+
+ZTEST(evt_merge, test_typing_no_window)
+{
+	uint32_t latency;
+	int inversions;
+
+	sim_type(0);
+	inversions = sim_run(0, 0, &latency);
+
+	/* Right events overtake the left events still on the link. */
+	TC_PRINT("Window 0: %d events out of order, latency up to %u\n",
+		 inversions, latency);
+	zassert_true(inversions > 0, NULL);
+	zassert_true(latency <= INTERVAL, "latency %u", latency);
+}
+
+ZTEST(evt_merge, test_wait)
+{
+	struct hid_evt evt = evt_make(RIGHT, 100);
+
+	now = 100;
+	evt_merge_insert(&evt);
+	zassert_equal(evt_merge_release(100, WINDOW, false), WINDOW, NULL);
+	zassert_equal(evt_merge_release(130, WINDOW, false), WINDOW - 30,
+		      NULL);
+	zassert_equal(out_cnt, 0, NULL);
+
+	/* A left event older than the held one goes first. */
+	evt = evt_make(LEFT, 99);
+	evt_merge_insert(&evt);
+	zassert_equal(evt_merge_release(131, WINDOW, false), WINDOW - 31,
+		      NULL);
+	zassert_equal(out_cnt, 1, NULL);
+	zassert_equal(out[0].side, LEFT, NULL);
+
+	zassert_equal(evt_merge_release(100 + WINDOW, WINDOW, false), 0,
+		      NULL);
+	zassert_equal(out_cnt, 2, NULL);
+	zassert_equal(out[1].side, RIGHT, NULL);
+}
+
+ZTEST(evt_merge, test_same_time)
+{
+	struct hid_evt evt;
+
+	/* Events of the same time keep their arrival order. */
+	for (int i = 0; i < 4; i++) {
+		evt = evt_make(i % 2 ? RIGHT : LEFT, 10);
+		evt.position = i;
+		evt_merge_insert(&evt);
+	}
+	zassert_equal(evt_merge_release(10, 0, false), 0, NULL);
+
+	zassert_equal(out_cnt, 4, NULL);
+	for (int i = 0; i < 4; i++) {
+		zassert_equal(out[i].position, i, NULL);
+	}
+}
+
+ZTEST(evt_merge, test_hold_all)
+{
+	struct hid_evt evt = evt_make(MODULE, 50);
+
+	/* With one module its events are applied as they arrive. */
+	evt_merge_insert(&evt);
+	zassert_equal(evt_merge_release(50, WINDOW, false), 0, NULL);
+	zassert_equal(out_cnt, 1, NULL);
+
+	/* With several, a module event may be overtaken as well. */
+	evt_merge_insert(&evt);
+	zassert_equal(evt_merge_release(50, WINDOW, true), WINDOW, NULL);
+	zassert_equal(out_cnt, 1, NULL);
+	zassert_equal(evt_merge_release(50 + WINDOW, WINDOW, true), 0, NULL);
+	zassert_equal(out_cnt, 2, NULL);
+}
+
+ZTEST(evt_merge, test_full)
+{
+	const size_t len = 2 * CONFIG_KB_HID_EVT_QUEUE_SIZE;
+	struct hid_evt evt;
+
+	for (uint32_t i = 0; i < len; i++) {
+		evt = evt_make(RIGHT, i);
+		evt_merge_insert(&evt);
+	}
+	zassert_equal(out_cnt, 0, NULL);
+
+	/* A full buffer stops waiting for the oldest event. */
+	evt = evt_make(RIGHT, len);
+	evt_merge_insert(&evt);
+	zassert_equal(out_cnt, 1, NULL);
+	zassert_equal(out[0].time, 0, NULL);
+
+	zassert_equal(evt_merge_release(len + WINDOW, WINDOW, false), 0,
+		      NULL);
+	zassert_equal(out_cnt, len + 1, NULL);
+	for (uint32_t i = 0; i <= len; i++) {
+		zassert_equal(out[i].time, i, NULL);
+	}
+}
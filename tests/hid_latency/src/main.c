@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Key event to HID report latency tests
+ *
+ * Key events go the way of the right half: through an event ring and the
+ * merge buffer to a HID thread that builds the report. The time from
+ * posting an event to its report being built is measured with the HID
+ * thread woken by every event, and with the main loop polling it used to
+ * replace.
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "evt_merge.h"
+#include "hid_report.h"
+#include "keys.h"
+#include "spsc_ring.h"
+
+/* Key events posted by a test. */
+#define EVTS 100
+
+/* Polling period of the old main loop. */
+#define POLL_MS 20
+
+/* Slowest event-driven latency accepted, well within one connection
+ * interval of the split link.
+ */
+#define LATENCY_MAX_US 1000
+
+SPSC_RING_DEFINE(evt_ring, struct hid_evt, CONFIG_KB_HID_EVT_QUEUE_SIZE);
+static K_SEM_DEFINE(evt_sem, 0, 1);
+
+static K_THREAD_STACK_DEFINE(hid_stack, 1024);
+static struct k_thread hid_thread;
+
+static struct keyboard_state state;
+static uint8_t report[INPUT_REPORT_KEYS_MAX_LEN];
+static bool polling;
+static int applied;
+static uint32_t latency_max_us;
+static uint32_t latency_sum_us;
+
+/* Simple pseudo-random generator, the same typing on every run. */
+static uint32_t rand_state;
+
+static uint32_t rand_next(void)
+{
+	rand_state = rand_state * 1664525 + 1013904223;
+
+	return rand_state >> 8;
+}
+
+/* Event times are in cycles here. */
+static void evt_apply(const struct hid_evt *evt)
+{
+	uint32_t latency_us;
+
+	hid_report_key_write(&state, KEY_A + evt->position, evt->pressed);
+	hid_report_encode(&state, false, report);
+
+	latency_us = k_cyc_to_us_ceil32(k_cycle_get_32() - evt->time);
+	latency_max_us = MAX(latency_max_us, latency_us);
+	latency_sum_us += latency_us;
+	applied++;
+}
+
+static void hid_thread_fn(void *p1, void *p2, void *p3)
+{
+	struct hid_evt evt;
+
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	while (applied < EVTS) {
+		if (polling) {
+			k_sleep(K_MSEC(POLL_MS));
+		} else {
+			k_sem_take(&evt_sem, K_FOREVER);
+		}
+
+		while (spsc_ring_get(&evt_ring, &evt)) {
+			evt_merge_insert(&evt);
+		}
+		/* Without a module there is no merge window. */
+		evt_merge_release(k_cycle_get_32(), 0, false);
+	}
+}
+
+/* Type EVTS key changes, 5 to 45 ms apart, and wait for the reports. */
+static void type(void)
+{
+	k_thread_create(&hid_thread, hid_stack,
+			K_THREAD_STACK_SIZEOF(hid_stack), hid_thread_fn,
+			NULL, NULL, NULL, K_PRIO_PREEMPT(0), 0, K_NO_WAIT);
+
+	for (int i = 0; i < EVTS; i++) {
+		struct hid_evt evt = {
+			.position = i % 16,
+			.side = 1,
+			.pressed = !(i & 16),
+		};
+
+		k_sleep(K_USEC(5000 + rand_next() % 40000));
+
+		evt.time = k_cycle_get_32();
+		zassert_true(spsc_ring_put(&evt_ring, &evt), "event %d", i);
+		if (!polling) {
+			k_sem_give(&evt_sem);
+		}
+	}
+
+	zassert_ok(k_thread_join(&hid_thread, K_MSEC(2 * POLL_MS)), NULL);
+	zassert_equal(applied, EVTS, NULL);
+
+	TC_PRINT("%s: latency %u us average, %u us max\n",
+		 polling ? "Polling" : "Event-driven",
+		 latency_sum_us / EVTS, latency_max_us);
+}
+
+static void before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	memset(&state, 0, sizeof(state));
+	evt_merge_init(1, evt_apply);
+	k_sem_reset(&evt_sem);
+	applied = 0;
+	latency_max_us = 0;
+	latency_sum_us = 0;
+	rand_state = 1;
+}
+
+ZTEST_SUITE(hid_latency, NULL, NULL, before, NULL, NULL);
+
+ZTEST(hid_latency, test_event_driven)
+{
+	polling = false;
+	type();
+
+	zassert_true(latency_max_us <= LATENCY_MAX_US, "latency %u us",
+		     latency_max_us);
+}
+
+ZTEST(hid_latency, test_polling)
+{
+	polling = true;
+	type();
+
+	/* The polling period adds up to POLL_MS to every key. */
+	zassert_true(latency_max_us > POLL_MS * 1000 / 2, "latency %u us",
+		     latency_max_us);
+}
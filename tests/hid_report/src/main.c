@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief HID keyboard report tests
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <string.h>
+#include <zephyr/ztest.h>
+
+#include "hid_report.h"
+#include "keys.h"
+
+/* Keys held together by the rollover tests. */
+#define HELD_KEYS 24
+
+#define REPORT_LEN MAX(INPUT_REPORT_KEYS_MAX_LEN, BOOT_REPORT_KEYS_LEN)
+
+static struct keyboard_state state;
+static uint8_t report[REPORT_LEN];
+
+/* HELD_KEYS usages spread over the whole bitmap. */
+BUILD_ASSERT(KEY_A + (HELD_KEYS - 1) * 5 <= KEY_BITMAP_USAGE_MAX);
+
+static uint8_t held_key(int i)
+{
+	return KEY_A + i * 5;
+}
+
+static void keys_write(int first, int cnt, bool pressed)
+{
+	for (int i = first; i < first + cnt; i++) {
+		zassert_ok(hid_report_key_write(&state, held_key(i), pressed),
+			   "key %d", i);
+	}
+}
+
+static bool bitmap_test(const uint8_t *bitmap, uint8_t key)
+{
+	return bitmap[key / 8] & BIT(key % 8);
+}
+
+static void key_array_check(const uint8_t *keys, int first, int cnt)
+{
+	for (int i = 0; i < KEY_PRESS_MAX; i++) {
+		uint8_t expect = (i < cnt) ? held_key(first + i) : KEY_NONE;
+
+		zassert_equal(keys[i], expect, "slot %d", i);
+	}
+}
+
+static void rollover_check(const uint8_t *keys)
+{
+	for (int i = 0; i < KEY_PRESS_MAX; i++) {
+		zassert_equal(keys[i], KEY_ERR_OVF, "slot %d", i);
+	}
+}
+
+static void before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	memset(&state, 0, sizeof(state));
+	memset(report, 0xAA, sizeof(report));
+}
+
+ZTEST_SUITE(hid_report, NULL, NULL, before, NULL, NULL);
+
+ZTEST(hid_report, test_key_write)
+{
+	/* Usage 0 is no key. */
+	zassert_ok(hid_report_key_write(&state, KEY_NONE, true), NULL);
+	zassert_equal(hid_report_encode(&state, true, report),
+		      BOOT_REPORT_KEYS_LEN, NULL);
+	key_array_check(&report[2], 0, 0);
+
+	/* Usages beyond the bitmap cannot be reported. */
+	zassert_equal(hid_report_key_write(&state, KEY_BITMAP_USAGE_MAX + 1,
+					   true), -EINVAL, NULL);
+	zassert_ok(hid_report_key_write(&state, KEY_BITMAP_USAGE_MAX, true),
+		   NULL);
+	zassert_true(bitmap_test(state.keys_bitmap, KEY_BITMAP_USAGE_MAX),
+		     NULL);
+
+	/* Control keys go to the control byte, not to the bitmap. */
+	zassert_ok(hid_report_key_write(&state, KEY_LEFTCTRL, true), NULL);
+	zassert_ok(hid_report_key_write(&state, KEY_RIGHTMETA, true), NULL);
+	zassert_equal(state.ctrl_keys_state, KEY_MOD_LCTRL | KEY_MOD_RMETA,
+		      NULL);
+	zassert_ok(hid_report_key_write(&state, KEY_LEFTCTRL, false), NULL);
+	zassert_equal(state.ctrl_keys_state, KEY_MOD_RMETA, NULL);
+
+	hid_report_encode(&state, true, report);
+	zassert_equal(report[0], KEY_MOD_RMETA, NULL);
+	zassert_equal(report[1], 0, NULL);
+}
+
+ZTEST(hid_report, test_boot_rollover)
+{
+	/* Up to six keys are listed in usage order. */
+	keys_write(0, KEY_PRESS_MAX, true);
+	zassert_equal(hid_report_encode(&state, true, report),
+		      BOOT_REPORT_KEYS_LEN, NULL);
+	key_array_check(&report[2], 0, KEY_PRESS_MAX);
+
+	/* One more reports ErrorRollOver in every slot. */
+	keys_write(KEY_PRESS_MAX, HELD_KEYS - KEY_PRESS_MAX, true);
+	zassert_ok(hid_report_key_write(&state, KEY_LEFTSHIFT, true), NULL);
+	hid_report_encode(&state, true, report);
+	zassert_equal(report[0], KEY_MOD_LSHIFT, NULL);
+	rollover_check(&report[2]);
+
+	/* The keys still held are listed again once six are left. */
+	keys_write(KEY_PRESS_MAX, HELD_KEYS - KEY_PRESS_MAX, false);
+	hid_report_encode(&state, true, report);
+	key_array_check(&report[2], 0, KEY_PRESS_MAX);
+}
+
+ZTEST(hid_report, test_usage_max)
+{
+	zassert_ok(hid_report_key_write(&state, KEY_A, true), NULL);
+	zassert_ok(hid_report_key_write(&state, KEY_F13, true), NULL);
+	zassert_ok(hid_report_key_write(&state, KEY_F24, true), NULL);
+
+	/* The boot report has no usages above KEY_CODE_MAX. */
+	hid_report_encode(&state, true, report);
+	zassert_equal(report[2], KEY_A, NULL);
+	zassert_equal(report[3], KEY_NONE, NULL);
+
+	/* Keys above it are not counted for the rollover either. */
+	keys_write(1, KEY_PRESS_MAX - 1, true);
+	hid_report_encode(&state, true, report);
+	key_array_check(&report[2], 0, KEY_PRESS_MAX);
+
+	/* The report mode declares the usages of the whole bitmap. */
+	keys_write(1, KEY_PRESS_MAX - 1, false);
+	hid_report_encode(&state, false, report);
+#if defined(CONFIG_KB_HID_NKRO)
+	zassert_true(bitmap_test(&report[2], KEY_F13), NULL);
+	zassert_true(bitmap_test(&report[2], KEY_F24), NULL);
+#else
+	zassert_equal(report[2], KEY_A, NULL);
+	zassert_equal(report[3], KEY_F13, NULL);
+	zassert_equal(report[4], KEY_F24, NULL);
+	zassert_equal(report[5], KEY_NONE, NULL);
+#endif
+}
+
+ZTEST(hid_report, test_report_mode)
+{
+	size_t len;
+
+	keys_write(0, HELD_KEYS, true);
+	zassert_ok(hid_report_key_write(&state, KEY_LEFTSHIFT, true), NULL);
+
+	len = hid_report_encode(&state, false, report);
+	zassert_equal(len, INPUT_REPORT_KEYS_MAX_LEN, NULL);
+	zassert_equal(report[0], KEY_MOD_LSHIFT, NULL);
+	zassert_equal(report[1], 0, NULL);
+
+#if defined(CONFIG_KB_HID_NKRO)
+	/* Every held key is in the bitmap, and nothing else. */
+	for (int key = 0; key <= KEY_BITMAP_USAGE_MAX; key++) {
+		bool held = key >= KEY_A && (key - KEY_A) % 5 == 0 &&
+			    (key - KEY_A) / 5 < HELD_KEYS;
+
+		zassert_equal(bitmap_test(&report[2], key), held, "key %d",
+			      key);
+	}
+
+	/* Releases clear single bits. */
+	keys_write(1, HELD_KEYS - 2, false);
+	hid_report_encode(&state, false, report);
+	for (int i = 0; i < HELD_KEYS; i++) {
+		bool held = i == 0 || i == HELD_KEYS - 1;
+
+		zassert_equal(bitmap_test(&report[2], held_key(i)), held,
+			      "key %d", i);
+	}
+#else
+	/* Without NKRO report mode uses the boot layout. */
+	rollover_check(&report[2]);
+#endif
+}
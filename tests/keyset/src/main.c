@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Key set tests
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/ztest.h>
+
+#include "keyset.h"
+
+/* Simple pseudo-random generator, the same sets on every run. */
+static uint32_t rand_state = 1;
+
+static uint32_t rand_next(void)
+{
+	rand_state = rand_state * 1664525 + 1013904223;
+
+	return rand_state >> 8;
+}
+
+static void keyset_random(struct keyset *set, bool *keys)
+{
+	keyset_clear(set);
+	for (unsigned int key = 0; key < KEYSET_KEYS; key++) {
+		keys[key] = rand_next() & 1;
+		keyset_write(set, key, keys[key]);
+	}
+}
+
+ZTEST_SUITE(keyset, NULL, NULL, NULL, NULL, NULL);
+
+ZTEST(keyset, test_write)
+{
+	struct keyset set;
+
+	keyset_clear(&set);
+	zassert_true(keyset_is_empty(&set), NULL);
+
+	for (unsigned int key = 0; key < KEYSET_KEYS; key++) {
+		keyset_write(&set, key, true);
+		zassert_true(keyset_test(&set, key), "key %u", key);
+		zassert_equal(keyset_count(&set), key + 1, "key %u", key);
+	}
+	for (unsigned int key = 0; key < KEYSET_KEYS; key++) {
+		zassert_false(keyset_is_empty(&set), "key %u", key);
+		keyset_write(&set, key, false);
+		zassert_false(keyset_test(&set, key), "key %u", key);
+	}
+	zassert_true(keyset_is_empty(&set), NULL);
+}
+
+ZTEST(keyset, test_xor)
+{
+	bool keys_a[KEYSET_KEYS];
+	bool keys_b[KEYSET_KEYS];
+	struct keyset a;
+	struct keyset b;
+	struct keyset diff;
+	unsigned int cnt = 0;
+
+	keyset_random(&a, keys_a);
+	keyset_random(&b, keys_b);
+	keyset_xor(&diff, &a, &b);
+
+	for (unsigned int key = 0; key < KEYSET_KEYS; key++) {
+		bool differ = keys_a[key] != keys_b[key];
+
+		zassert_equal(keyset_test(&diff, key), differ, "key %u", key);
+		cnt += differ;
+	}
+	zassert_equal(keyset_count(&diff), cnt, NULL);
+
+	keyset_xor(&diff, &a, &a);
+	zassert_true(keyset_is_empty(&diff), NULL);
+	zassert_true(keyset_equal(&a, &a), NULL);
+	zassert_equal(keyset_equal(&a, &b), cnt == 0, NULL);
+}
+
+ZTEST(keyset, test_next)
+{
+	struct keyset set;
+	int prev = -1;
+	unsigned int cnt = 0;
+
+	keyset_clear(&set);
+	zassert_equal(keyset_next(&set, 0), -1, NULL);
+
+	/* Only the last key, the search crosses every word. */
+	keyset_write(&set, KEYSET_KEYS - 1, true);
+	zassert_equal(keyset_next(&set, 0), KEYSET_KEYS - 1, NULL);
+	zassert_equal(keyset_next(&set, KEYSET_KEYS - 1), KEYSET_KEYS - 1,
+		      NULL);
+	zassert_equal(keyset_next(&set, KEYSET_KEYS), -1, NULL);
+
+	/* Every seventh key, also both keys around each word boundary. */
+	for (unsigned int key = 0; key < KEYSET_KEYS; key += 7) {
+		keyset_write(&set, key, true);
+	}
+	for (unsigned int key = 32; key < KEYSET_KEYS; key += 32) {
+		keyset_write(&set, key - 1, true);
+		keyset_write(&set, key, true);
+	}
+
+	KEYSET_FOREACH(&set, key) {
+		zassert_true(key > prev, "key %d after %d", key, prev);
+		zassert_true(keyset_test(&set, key), "key %d", key);
+		/* No key in the set is skipped. */
+		for (int skipped = prev + 1; skipped < key; skipped++) {
+			zassert_false(keyset_test(&set, skipped), "key %d",
+				      skipped);
+		}
+		prev = key;
+		cnt++;
+	}
+	zassert_equal(prev, KEYSET_KEYS - 1, NULL);
+	zassert_equal(cnt, keyset_count(&set), NULL);
+}
+
+ZTEST(keyset, test_bytes)
+{
+	bool keys[KEYSET_KEYS];
+	uint8_t buf[KEYSET_BYTES + 4];
+	struct keyset set;
+	struct keyset out;
+
+	/* Key n is bit n % 8 of byte n / 8. */
+	keyset_clear(&set);
+	keyset_write(&set, 9, true);
+	keyset_to_bytes(&set, buf);
+	zassert_equal(buf[0], 0x00, NULL);
+	zassert_equal(buf[1], 0x02, NULL);
+
+	keyset_random(&set, keys);
+	keyset_to_bytes(&set, buf);
+	keyset_from_bytes(&out, buf, KEYSET_BYTES);
+	zassert_true(keyset_equal(&set, &out), NULL);
+
+	/* A shorter encoding leaves the remaining keys released. */
+	keyset_from_bytes(&out, buf, 1);
+	for (unsigned int key = 0; key < KEYSET_KEYS; key++) {
+		zassert_equal(keyset_test(&out, key), key < 8 && keys[key],
+			      "key %u", key);
+	}
+
+	/* Keys beyond the matrix in a longer encoding are dropped. */
+	memset(buf, 0xff, sizeof(buf));
+	keyset_from_bytes(&out, buf, sizeof(buf));
+	zassert_equal(keyset_count(&out), KEYSET_KEYS, NULL);
+	zassert_equal(keyset_next(&out, KEYSET_KEYS - 1), KEYSET_KEYS - 1,
+		      NULL);
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Key path logging cost benchmark
+ *
+ * Times building a HID report together with the message the module
+ * notification logs for it: formatted right away with printk and the
+ * peer address, as before, and through the logging subsystem, as now.
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/ztest.h>
+#include <zephyr/logging/log.h>
+
+#include "hid_report.h"
+#include "keys.h"
+
+LOG_MODULE_REGISTER(log_cost, LOG_LEVEL_DBG);
+
+/* Reports built per run, every one logged. */
+#define REPORTS 100
+
+/* Length of "XX:XX:XX:XX:XX:XX (random)", as from bt_addr_le_to_str(). */
+#define ADDR_STR_LEN 30
+
+static const uint8_t peer_addr[6] = { 0xC0, 0x12, 0x34, 0x56, 0x78, 0x9A };
+static struct keyboard_state state;
+static uint8_t report[INPUT_REPORT_KEYS_MAX_LEN];
+
+static unsigned int report_build(int i)
+{
+	hid_report_key_write(&state, KEY_A + i % 16, !(i & 16));
+	hid_report_encode(&state, false, report);
+
+	return i % 16 + 1;
+}
+
+static uint32_t printk_run(void)
+{
+	uint32_t start = k_cycle_get_32();
+
+	for (int i = 0; i < REPORTS; i++) {
+		unsigned int keys = report_build(i);
+		char addr[ADDR_STR_LEN];
+
+		snprintk(addr, sizeof(addr),
+			 "%02X:%02X:%02X:%02X:%02X:%02X (random)",
+			 peer_addr[5], peer_addr[4], peer_addr[3],
+			 peer_addr[2], peer_addr[1], peer_addr[0]);
+		printk("[%s] Module %u notification: %u keys pressed\n", addr,
+		       1, keys);
+	}
+
+	return k_cycle_get_32() - start;
+}
+
+static uint32_t log_run(void)
+{
+	uint32_t start = k_cycle_get_32();
+
+	for (int i = 0; i < REPORTS; i++) {
+		unsigned int keys = report_build(i);
+
+		LOG_DBG("Module %u notification: %u keys pressed", 1, keys);
+	}
+
+	return k_cycle_get_32() - start;
+}
+
+static void cycles_print(const char *name, uint32_t cycles)
+{
+	TC_PRINT("%s: %u cycles, %u ns per report\n", name, cycles / REPORTS,
+		 (uint32_t)(k_cyc_to_ns_floor64(cycles) / REPORTS));
+}
+
+static void before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	memset(&state, 0, sizeof(state));
+}
+
+ZTEST_SUITE(log_cost, NULL, NULL, before, NULL, NULL);
+
+ZTEST(log_cost, test_report_build_cycles)
+{
+	uint32_t printk_cycles;
+	uint32_t log_cycles;
+
+	printk_cycles = printk_run();
+	log_cycles = log_run();
+
+	/* Let the log thread catch up before printing the results. */
+	k_sleep(K_MSEC(100));
+
+	cycles_print("printk with address", printk_cycles);
+	cycles_print(IS_ENABLED(CONFIG_LOG_MODE_DEFERRED) ? "Deferred log" :
+							     "Immediate log",
+		     log_cycles);
+
+#if defined(CONFIG_LOG_MODE_DEFERRED)
+	/* Only the arguments are copied on the key path. */
+	zassert_true(log_cycles <= printk_cycles, NULL);
+#endif
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Matrix scan benchmark on emulated GPIO ports
+ *
+ * Times the scan backend selected by CONFIG_KB_MATRIX_PORT_IO, so the
+ * port-wide and the per-pin scan are compared by building both. The
+ * backend is static, matrix.c is built into this file to reach it.
+ */
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/ztest.h>
+
+#include "matrix.c"
+
+#define SCANS 1000
+
+#define USER_NODE DT_PATH(zephyr_user)
+
+#define PIN_SPEC(node, prop, idx) GPIO_DT_SPEC_GET_BY_IDX(node, prop, idx),
+
+static const struct gpio_dt_spec rows[] = {
+	DT_FOREACH_PROP_ELEM(USER_NODE, row_gpios, PIN_SPEC)
+};
+static const struct gpio_dt_spec cols[] = {
+	DT_FOREACH_PROP_ELEM(USER_NODE, col_gpios, PIN_SPEC)
+};
+
+BUILD_ASSERT(ARRAY_SIZE(rows) == MATRIX_ROWS, "Row count mismatch");
+BUILD_ASSERT(ARRAY_SIZE(cols) == MATRIX_COLS, "Column count mismatch");
+
+/* Drive the raw level of a column input. */
+static void col_press(int i, bool pressed)
+{
+	bool active_low = cols[i].dt_flags & GPIO_ACTIVE_LOW;
+	int err;
+
+	err = gpio_emul_input_set(cols[i].port, cols[i].pin,
+				  pressed != active_low);
+	zassert_ok(err, "col %d", i);
+}
+
+static void *setup(void)
+{
+	zassert_ok(matrix_init(rows, cols, NULL), NULL);
+
+	/* Scans are run by the test only. */
+	state = STATE_WAITING;
+	k_timer_stop(&scan_timer);
+	k_sem_reset(&scan_sem);
+
+	return NULL;
+}
+
+static void before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	for (int i = 0; i < MATRIX_COLS; i++) {
+		col_press(i, false);
+	}
+}
+
+ZTEST_SUITE(matrix_scan, NULL, setup, before, NULL, NULL);
+
+ZTEST(matrix_scan, test_scan_keys)
+{
+	struct keyset raw;
+
+	scan(&raw);
+	zassert_true(keyset_is_empty(&raw), NULL);
+
+	/* The emulator has no row to column wiring, a held column reads
+	 * active on every row.
+	 */
+	col_press(2, true);
+	scan(&raw);
+	zassert_equal(keyset_count(&raw), MATRIX_ROWS, NULL);
+	for (int i = 0; i < MATRIX_ROWS; i++) {
+		unsigned int key = (MATRIX_ROWS - 1 - i) * MATRIX_COLS +
+				   (MATRIX_COLS - 1 - 2);
+
+		zassert_true(keyset_test(&raw, key), "row %d", i);
+	}
+
+	/* Every row is released after the scan. */
+	for (int i = 0; i < MATRIX_ROWS; i++) {
+		bool active_low = rows[i].dt_flags & GPIO_ACTIVE_LOW;
+
+		zassert_equal(gpio_emul_output_get(rows[i].port, rows[i].pin),
+			      active_low, "row %d", i);
+	}
+}
+
+ZTEST(matrix_scan, test_scan_cycles)
+{
+	struct keyset raw;
+	uint32_t start;
+	uint32_t cycles;
+
+	col_press(0, true);
+	col_press(MATRIX_COLS - 1, true);
+
+	start = k_cycle_get_32();
+	for (int i = 0; i < SCANS; i++) {
+		scan(&raw);
+	}
+	cycles = k_cycle_get_32() - start;
+
+	TC_PRINT("%s scan, %d x %d matrix: %u cycles, %u ns per scan\n",
+		 IS_ENABLED(CONFIG_KB_MATRIX_PORT_IO) ? "Port-wide" : "Per-pin",
+		 MATRIX_ROWS, MATRIX_COLS, cycles / SCANS,
+		 (uint32_t)(k_cyc_to_ns_floor64(cycles) / SCANS));
+
+	zassert_equal(keyset_count(&raw), 2 * MATRIX_ROWS, NULL);
+}
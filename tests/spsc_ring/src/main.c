@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2018 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/** @file
+ *  @brief Single producer, single consumer ring tests
+ */
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "spsc_ring.h"
+
+#define RING_LEN     8
+#define THREAD_ELEMS 10000
+
+struct test_evt {
+	uint16_t key;
+	bool pressed;
+	uint32_t time;
+};
+
+SPSC_RING_DEFINE(ring, struct test_evt, RING_LEN);
+
+static K_THREAD_STACK_DEFINE(producer_stack, 1024);
+static struct k_thread producer_thread;
+
+static struct test_evt evt_make(uint32_t i)
+{
+	return (struct test_evt){
+		.key = i % 84,
+		.pressed = i & 1,
+		.time = i,
+	};
+}
+
+static void evt_check(const struct test_evt *evt, uint32_t i)
+{
+	struct test_evt expect = evt_make(i);
+
+	zassert_equal(evt->key, expect.key, "elem %u", i);
+	zassert_equal(evt->pressed, expect.pressed, "elem %u", i);
+	zassert_equal(evt->time, expect.time, "elem %u", i);
+}
+
+/* Start the ring with the free-running counters at start. */
+static void ring_reset(uint32_t start)
+{
+	atomic_set(&ring.head, start);
+	atomic_set(&ring.tail, start);
+	atomic_clear(&ring.overflows);
+}
+
+static void before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	ring_reset(0);
+}
+
+ZTEST_SUITE(spsc_ring, NULL, NULL, before, NULL, NULL);
+
+ZTEST(spsc_ring, test_empty)
+{
+	struct test_evt evt;
+
+	zassert_false(spsc_ring_get(&ring, &evt), NULL);
+
+	evt = evt_make(1);
+	zassert_true(spsc_ring_put(&ring, &evt), NULL);
+	zassert_true(spsc_ring_get(&ring, &evt), NULL);
+	evt_check(&evt, 1);
+	zassert_false(spsc_ring_get(&ring, &evt), NULL);
+	zassert_equal(spsc_ring_overflows(&ring), 0, NULL);
+}
+
+ZTEST(spsc_ring, test_full)
+{
+	struct test_evt evt;
+
+	for (uint32_t i = 0; i < RING_LEN; i++) {
+		evt = evt_make(i);
+		zassert_true(spsc_ring_put(&ring, &evt), "elem %u", i);
+	}
+
+	/* A full ring drops the new element and keeps the old ones. */
+	evt = evt_make(RING_LEN);
+	zassert_false(spsc_ring_put(&ring, &evt), NULL);
+	zassert_false(spsc_ring_put(&ring, &evt), NULL);
+	zassert_equal(spsc_ring_overflows(&ring), 2, NULL);
+
+	/* One free slot takes one element. */
+	zassert_true(spsc_ring_get(&ring, &evt), NULL);
+	evt_check(&evt, 0);
+	evt = evt_make(RING_LEN);
+	zassert_true(spsc_ring_put(&ring, &evt), NULL);
+	zassert_false(spsc_ring_put(&ring, &evt), NULL);
+	zassert_equal(spsc_ring_overflows(&ring), 3, NULL);
+
+	for (uint32_t i = 1; i <= RING_LEN; i++) {
+		zassert_true(spsc_ring_get(&ring, &evt), "elem %u", i);
+		evt_check(&evt, i);
+	}
+	zassert_false(spsc_ring_get(&ring, &evt), NULL);
+}
+
+ZTEST(spsc_ring, test_wraparound)
+{
+	struct test_evt evt;
+	uint32_t put = 0;
+	uint32_t got = 0;
+
+	/* The counters wrap past UINT32_MAX while the ring is full. */
+	ring_reset(UINT32_MAX - RING_LEN / 2);
+
+	while (got < 4 * RING_LEN) {
+		/* Fill the ring, then take a few, so the fill level and the
+		 * slot index both cross the wrap at different points.
+		 */
+		evt = evt_make(put);
+		while (spsc_ring_put(&ring, &evt)) {
+			evt = evt_make(++put);
+		}
+		zassert_equal(put - got, RING_LEN, NULL);
+
+		for (int i = 0; i < 3; i++) {
+			zassert_true(spsc_ring_get(&ring, &evt), "elem %u",
+				     got);
+			evt_check(&evt, got++);
+		}
+	}
+
+	while (spsc_ring_get(&ring, &evt)) {
+		evt_check(&evt, got++);
+	}
+	zassert_equal(got, put, NULL);
+}
+
+static void producer_fn(void *p1, void *p2, void *p3)
+{
+	for (uint32_t i = 0; i < THREAD_ELEMS; i++) {
+		struct test_evt evt = evt_make(i);
+
+		while (!spsc_ring_put(&ring, &evt)) {
+			k_yield();
+		}
+	}
+}
+
+ZTEST(spsc_ring, test_threads)
+{
+	struct test_evt evt;
+	uint32_t got = 0;
+
+	k_thread_create(&producer_thread, producer_stack,
+			K_THREAD_STACK_SIZEOF(producer_stack), producer_fn,
+			NULL, NULL, NULL,
+			k_thread_priority_get(k_current_get()), 0, K_NO_WAIT);
+
+	/* Every element arrives once and in order, a full ring only makes
+	 * the producer retry.
+	 */
+	while (got < THREAD_ELEMS) {
+		if (!spsc_ring_get(&ring, &evt)) {
+			k_yield();
+			continue;
+		}
+		evt_check(&evt, got++);
+	}
+
+	zassert_ok(k_thread_join(&producer_thread, K_FOREVER), NULL);
+	zassert_false(spsc_ring_get(&ring, &evt), NULL);
+}